@@ -260,17 +260,18 @@ def writeAlignment(file, trimmed, extended, threads):
                 "echo 'Generating three-way alignment...'\n" \
                 "aligner=${lrcstats}/src/aligner/aligner\n" \
                 "mafOutput=${data}/${experiment_name}.maf\n" \
+                "statsOutput=${data}/${experiment_name}.stats\n" \
                 "\n"
         file.write(line)
 
 	if trimmed and extended: 
 		command = "$aligner maf -m $maf -c $clr -t -e -o ${mafOutput} -p %s\n" % (threads)
         elif trimmed:
-                command = "$aligner maf -m $maf -c $clr -t -o $mafOutput -p %s\n" % (threads)
+                command = "$aligner run -m $maf -c $clr -t -o $mafOutput --stats $statsOutput -p %s\n" % (threads)
         elif extended:
                 command = "$aligner maf -m $maf -c $clr -e -o $mafOutput -p %s\n" % (threads)
         else:
-                command = "$aligner maf -m $maf -c $clr -o $mafOutput -p %s\n" % (threads)
+                command = "$aligner run -m $maf -c $clr -o $mafOutput --stats $statsOutput -p %s\n" % (threads)
 	file.write(command)
 	line = "maf=${mafOutput}\n"
 	file.write(line)
@@ -308,11 +309,13 @@ def writeStats(file, trimmed, extended):
                 "\n"
 	file.write(line)
 
-	if trimmed:
-		command = "$aligner stats -m ${maf} -o ${statsOutput} -t\n\n"
-	else:
-		command = "$aligner stats -m ${maf} -o ${statsOutput}\n\n"
-	file.write(command)
+	# Without extensions, the aligner already wrote the stats along with the MAF file
+	if extended:
+		if trimmed:
+			command = "$aligner stats -m ${maf} -o ${statsOutput} -t\n\n"
+		else:
+			command = "$aligner stats -m ${maf} -o ${statsOutput}\n\n"
+		file.write(command)
 
 	line = "input=${statsOutput}\n" \
 		"\n"
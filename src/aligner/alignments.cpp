@@ -6,11 +6,69 @@
 #include <cmath>
 #include <cassert>
 #include <cstdint>
-// for std::exit
+#include <cstring>
+#include <utility>
+// for std::exit, posix_memalign and free
 #include <cstdlib>
+// for madvise
+#include <sys/mman.h>
+// for the threads of the wavefront
+#include <thread>
 
 #include "alignments.hpp"
 #include "data.hpp"
+#include "kernels.hpp"
+
+constexpr int64_t Alignments::cost;
+constexpr int64_t Alignments::fractionalCost;
+
+MemoryBudget::MemoryBudget(int64_t bytes)
+{
+	total = bytes;
+	reserved = 0;
+}
+
+bool MemoryBudget::tryReserve(int64_t bytes)
+{
+	std::lock_guard<std::mutex> lock (mutex);
+	if (reserved + bytes > total) {
+		return false;
+	}
+	reserved = reserved + bytes;
+	return true;
+}
+
+void MemoryBudget::reserve(int64_t bytes)
+{
+	std::unique_lock<std::mutex> lock (mutex);
+	released.wait(lock, [this, bytes]() {
+		return reserved + bytes <= total or reserved == 0;
+	});
+	reserved = reserved + bytes;
+}
+
+void MemoryBudget::release(int64_t bytes)
+{
+	{
+		std::lock_guard<std::mutex> lock (mutex);
+		reserved = reserved - bytes;
+	}
+	released.notify_all();
+}
+
+int64_t MemoryBudget::totalBytes()
+{
+	std::lock_guard<std::mutex> lock (mutex);
+	return total;
+}
+
+int64_t MemoryBudget::reservedBytes()
+{
+	std::lock_guard<std::mutex> lock (mutex);
+	return reserved;
+}
+
+/* --------------------------------------------------------------------------------------------- */
 
 Alignments::Alignments()
 /* Constructor for general reads class - is the parent of UntrimmedAlignments and TrimmedAlignments */
@@ -21,9 +79,30 @@ Alignments::Alignments()
 	refAlignment = "";
 	ulrAlignment = "";
 	clrAlignment = "";
+	countingOnly = false;
+	inCountedSegment = false;
 	matrix = NULL;
-	cost = 10;
-	fractionalCost = 5;
+	matrixCapacity = 0;
+	engine = FullMatrix;
+	readEngine = FullMatrix;
+	memoryLimit = std::numeric_limits<int64_t>::max();
+	memoryBudget = NULL;
+	budgetBytes = 0;
+	operationsFirstRow = 0;
+	operationsLastRow = 0;
+	batchColumns = 0;
+	batchLane = 0;
+	matrixCells = 0;
+	bandRadius = 0;
+	scoreBound = 0;
+	bandEdgeReached = false;
+	smallReads = 0;
+	smallReadsBytes = 0;
+	shrinkAfterReads = 0;
+	wavefrontCells = std::numeric_limits<int64_t>::max();
+	idleThreads = NULL;
+	rows = 0;
+	columns = 0;
 	alignmentSuccessful = true;
 }
 
@@ -31,80 +110,865 @@ Alignments::~Alignments()
 /* Delete the matrix when calling the destructor */
 {
 	deleteMatrix();
+	if (memoryBudget != NULL) {
+		memoryBudget->release(budgetBytes);
+	}
 }
 
-Read_t Alignments::align(std::string reference, std::string uRead, std::string cRead)
+Read_t Alignments::align(const std::string &reference, const std::string &uRead, const std::string &cRead)
 {
-	refAlignment = "";
-	ulrAlignment = "";
-	clrAlignment = "";
 	ref = reference;
 	ulr = uRead;
 	clr = cRead;
-	deleteMatrix();
 	preprocessReads();
-	createMatrix();
-	findAlignments();
 
 	int64_t maxValue = std::numeric_limits<int64_t>::max();
-	if (matrix[rows-1][columns-1] > maxValue - 100) {
-		alignmentSuccessful = false;	
+
+	readEngine = engine;
+	if (readEngine == Anchored and !findAnchors()) {
+		readEngine = supportsAntiDiagonal() ? AntiDiagonal : FullMatrix;
+	}
+	if (readEngine == Banded and !supportsBanding()) {
+		readEngine = FullMatrix;
+	}
+	if (readEngine == AntiDiagonal and !supportsAntiDiagonal()) {
+		readEngine = FullMatrix;
+	}
+	if (readEngine == BitParallel and !supportsBitParallel()) {
+		readEngine = FullMatrix;
+	}
+	if (readEngine == Segmented and !findSegmentBand()) {
+		readEngine = supportsBitParallel() ? BitParallel : FullMatrix;
+	}
+	if (readEngine == Banded) {
+		// Start with a band a few percent of the read wide, and never narrower than the slope
+		// of the diagonal so that neighbouring rows overlap
+		int64_t slope = (columns - 1) / std::max(rows - 1, (int64_t) 1) + 1;
+		bandRadius = std::max( std::max( (int64_t) 64, columns/32 ), slope );
+	} else if (readEngine == Anchored) {
+		// The segments are placed by their anchors, so the band only has to absorb their indels
+		bandRadius = 32;
+	} else if (readEngine == ScoreBounded) {
+		// Corrected reads usually differ from the reference in a few percent of their bases
+		scoreBound = 16*cost;
+	}
+	planMemory();
+
+	while (true) {
+		refAlignment = "";
+		ulrAlignment = "";
+		clrAlignment = "";
+		alignmentSuccessful = true;
+		bandEdgeReached = false;
+		layoutMatrix();
+
+		if (!createMatrix()) {
+			if (readEngine != LinearSpace) {
+				readEngine = LinearSpace;
+				continue;
+			}
+			std::cout << "Memory allocation failed; unable to create DP matrix.\n";
+			alignmentSuccessful = false;
+			break;
+		}
+
+		bool reachable = score(rows-1,columns-1) <= maxValue - 100;
+		bool widenBand = false;
+
+		// No alignment scores within the bound; raise it, unless the cells within it are no longer a small
+		// part of the matrix or the bound already allows every alignment
+		if (!reachable and readEngine == ScoreBounded) {
+			if (matrixCells > scoreBoundedCells() or scoreBound >= cost*(rows + columns)) {
+				readEngine = supportsAntiDiagonal() ? AntiDiagonal : supportsBitParallel() ? BitParallel : FullMatrix;
+				planMemory();
+			} else {
+				scoreBound *= 2;
+			}
+			continue;
+		}
+		// The end of the matrix is cut off from the start by the band; widen it
+		if (!reachable and (readEngine == Banded or readEngine == Anchored) and !isFullBand()) {
+			widenBand = true;
+		} else {
+			findAlignments();
+
+			if (!reachable) {
+				alignmentSuccessful = false;	
+			}
+			// A better alignment may exist outside the band; widen it and try again. The band of the
+			// Segmented engine holds every cell an alignment can pass through, so it never needs to.
+			widenBand = (readEngine == Banded or readEngine == Anchored) and bandEdgeReached and !isFullBand();
+		}
+
+		if (!widenBand) {
+			break;
+		}
+		bandRadius *= 2;
+		planMemory();
+	}
+
+	trackWorkspace( std::max(estimatedMatrixBytes(readEngine), matrixCells*(int64_t) sizeof(int64_t)) );
+	settleMemory();
+	return alignedRead();
+}
+
+std::vector<Read_t> Alignments::alignBatch(const std::vector<Read_t> &reads)
+/* Fills the matrices of the reads together with the batched kernel and then backtracks through each
+ * read's lane in turn. Reads the kernel cannot take, and whole batches that would not fit within the
+ * memory limit, are aligned one at a time with align(). */
+{
+	std::vector<Read_t> alignedReads (reads.size());
+	std::vector<int64_t> laneReads;
+	int64_t laneCount = 0;
+	int64_t batchRows = 0;
+	batchColumns = 0;
+
+	for (int64_t index = 0; index < reads.size(); index++) {
+		ref = reads.at(index).ref;
+		ulr = reads.at(index).ulr;
+		clr = reads.at(index).clr;
+		preprocessReads();
+
+		if (laneCount < batchLanes() and supportsBatching()) {
+			if (laneCount == lanes.size()) {
+				lanes.push_back( BatchLane() );
+			}
+			describeLane( lanes.at(laneCount) );
+			laneCount++;
+			laneReads.push_back(index);
+			batchRows = std::max(batchRows, rows);
+			batchColumns = std::max(batchColumns, columns);
+		} else {
+			alignedReads.at(index) = align(reads.at(index).ref, reads.at(index).ulr, reads.at(index).clr);
+		}
+	}
+
+	// Only a short last batch drops lanes, and with them their buffers
+	lanes.resize(laneCount);
+	bool filled = false;
+	int64_t batchBytes = batchRows*batchColumns*(int64_t) sizeof(uint32_t);
+	if (!lanes.empty() and batchBytes <= memoryLimit and reserveMemory(batchBytes)) {
+		try {
+			fillBatch(lanes, batchRows, batchColumns, batchOperations);
+			filled = true;
+		} catch( std::bad_alloc& ba ) {
+			filled = false;
+		}
 	}
 
+	for (int64_t lane = 0; lane < lanes.size(); lane++) {
+		const Read_t &read = reads.at( laneReads.at(lane) );
+		if (!filled) {
+			alignedReads.at( laneReads.at(lane) ) = align(read.ref, read.ulr, read.clr);
+			continue;
+		}
+		ref = read.ref;
+		ulr = read.ulr;
+		clr = read.clr;
+		preprocessReads();
+
+		readEngine = Batched;
+		batchLane = lane;
+		refAlignment = "";
+		ulrAlignment = "";
+		clrAlignment = "";
+		alignmentSuccessful = lanes.at(lane).reachable;
+		bandEdgeReached = false;
+		layoutMatrix();
+		if (alignmentSuccessful) {
+			findAlignments();
+		}
+		alignedReads.at( laneReads.at(lane) ) = alignedRead();
+	}
+	if (filled) {
+		trackWorkspace(batchBytes);
+	}
+	settleMemory();
+	return alignedReads;
+}
+
+Read_t Alignments::alignedRead()
+{
 	Read_t alignedReads;
-	alignedReads.ref = refAlignment;
-	alignedReads.ulr = ulrAlignment;
-	alignedReads.clr = clrAlignment;
+	// The alignments are rebuilt for every read, so hand their buffers over rather than copying them
+	alignedReads.ref = std::move(refAlignment);
+	alignedReads.ulr = std::move(ulrAlignment);
+	alignedReads.clr = std::move(clrAlignment);
 	alignedReads.alignmentSuccessful = alignmentSuccessful;
+	if (countingOnly) {
+		alignedReads.counts = std::move(readCounts);
+		readCounts = ReadCounts();
+	}
 	return alignedReads;
 }
 
-void Alignments::preprocessReads()
+void Alignments::setEngine(EngineType engineType)
+{
+	engine = engineType;
+}
+
+void Alignments::setMemoryLimit(int64_t bytes)
+{
+	memoryLimit = bytes;
+}
+
+void Alignments::setMemoryBudget(MemoryBudget *budget)
+{
+	memoryBudget = budget;
+}
+
+void Alignments::setWorkspaceShrinking(int64_t reads)
+{
+	shrinkAfterReads = reads;
+}
+
+void Alignments::setCountingOnly(bool counting)
+{
+	countingOnly = counting;
+}
+
+void Alignments::releaseMemory()
+{
+	releaseWorkspace();
+	if (memoryBudget != NULL) {
+		memoryBudget->release(budgetBytes);
+		budgetBytes = 0;
+	}
+}
+
+void Alignments::setWavefront(int64_t minimumCells, std::atomic<int64_t> *idleThreads)
+{
+	wavefrontCells = minimumCells;
+	this->idleThreads = idleThreads;
+}
+
+int64_t Alignments::estimatedMatrixBytes(EngineType engineType)
+/* Returns roughly how many bytes the DP structures of the current read take with the given engine */
+{
+	int64_t cellBytes = sizeof(int64_t);
+	if (engineType == Banded or engineType == Anchored) {
+		return rows * std::min(2*bandRadius + 1, columns) * cellBytes;
+	} else if (engineType == Traceback or engineType == BitParallel) {
+		return rows*columns/4 + 2*columns*cellBytes;
+	} else if (engineType == AntiDiagonal) {
+		return rows*columns/4 + (rows + columns)*cellBytes + 3*rows*sizeof(int32_t);
+	} else if (engineType == Segmented) {
+		return matrixCells*cellBytes;
+	} else if (engineType == ScoreBounded) {
+		// The matrix grows with the score, and filling stops once it passes this many cells
+		return scoreBoundedCells()*cellBytes;
+	} else if (engineType == LinearSpace) {
+		int64_t interval = checkpointInterval();
+		return (rows/interval + 1)*columns*cellBytes + (interval + 1)*columns/4 + 2*columns*cellBytes;
+	} else {
+		return rows*columns*cellBytes;
+	}
+}
+
+void Alignments::planMemory()
+/* Traceback keeps 2 bits per cell instead of 8 bytes and LinearSpace only a few rows, each taking
+ * about twice as long as the engine before it. If not even LinearSpace fits in what is left of the
+ * budget, the read waits for other threads to give memory back. */
+{
+	std::vector<EngineType> candidates (1, readEngine);
+	if (readEngine != LinearSpace and estimatedMatrixBytes(Traceback) < estimatedMatrixBytes(readEngine)) {
+		candidates.push_back(Traceback);
+	}
+	candidates.push_back(LinearSpace);
+
+	for (EngineType candidate : candidates) {
+		int64_t bytes = estimatedMatrixBytes(candidate);
+		if (bytes <= memoryLimit and reserveMemory(bytes)) {
+			readEngine = candidate;
+			return;
+		}
+	}
+	readEngine = LinearSpace;
+	if (memoryBudget != NULL) {
+		// Hold nothing while waiting, so that threads never wait for each other
+		releaseWorkspace();
+		memoryBudget->release(budgetBytes);
+		budgetBytes = estimatedMatrixBytes(LinearSpace);
+		memoryBudget->reserve(budgetBytes);
+	}
+}
+
+bool Alignments::reserveMemory(int64_t bytes)
+{
+	if (memoryBudget == NULL or bytes <= budgetBytes) {
+		return true;
+	}
+	if (memoryBudget->tryReserve(bytes - budgetBytes)) {
+		budgetBytes = bytes;
+		return true;
+	}
+	// The buffers of earlier reads may be what is in the way
+	releaseWorkspace();
+	memoryBudget->release(budgetBytes);
+	budgetBytes = 0;
+	if (memoryBudget->tryReserve(bytes)) {
+		budgetBytes = bytes;
+		return true;
+	}
+	return false;
+}
+
+void Alignments::settleMemory()
+/* The buffers are kept for the next read, so they stay reserved; what the estimates reserved beyond
+ * them is given back. Buffers that outgrew their reservation and cannot reserve the rest are freed. */
+{
+	if (memoryBudget == NULL) {
+		return;
+	}
+	int64_t heldBytes = workspaceBytes();
+	if (heldBytes > budgetBytes and !memoryBudget->tryReserve(heldBytes - budgetBytes)) {
+		releaseWorkspace();
+		heldBytes = 0;
+	}
+	if (heldBytes < budgetBytes) {
+		memoryBudget->release(budgetBytes - heldBytes);
+	}
+	budgetBytes = heldBytes;
+}
+
+int64_t Alignments::checkpointInterval()
+/* Rows between two saved rows of the LinearSpace engine. Balances the memory of the saved rows
+ * (8 bytes per cell) against that of the recomputed block of operations (2 bits per cell). */
+{
+	return std::max( (int64_t) std::sqrt( 32.0*rows ), (int64_t) 1 );
+}
+
+void Alignments::layoutMatrix()
+{
+	if (readEngine == Banded) {
+		setDiagonalBand();
+	} else if (readEngine == Segmented) {
+		setBandRows();
+	} else if (readEngine == Anchored) {
+		setAnchoredBand();
+	} else if (readEngine == ScoreBounded) {
+		// fillWithinScore lays the rows out as it fills them
+	} else if (readEngine == Traceback or readEngine == LinearSpace or readEngine == AntiDiagonal or
+	           readEngine == Batched or readEngine == BitParallel) {
+		setRollingRows();
+	} else {
+		setFullBand();
+	}
+}
+
+bool Alignments::supportsBanding()
+{
+	return false;
+}
+
+bool Alignments::supportsAntiDiagonal()
+{
+	return false;
+}
+
+int64_t Alignments::fillByAntiDiagonals()
+{
+	return std::numeric_limits<int64_t>::max();
+}
+
+bool Alignments::supportsBitParallel()
+{
+	return false;
+}
+
+void Alignments::fillByBitVectors()
+{
+	fillRows(0, rows - 1, true);
+}
+
+bool Alignments::findSegmentBand()
+{
+	return false;
+}
+
+bool Alignments::findAnchors()
+{
+	return false;
+}
+
+void Alignments::setAnchoredBand()
+{
+	setFullBand();
+}
+
+bool Alignments::supportsBatching()
+{
+	return false;
+}
+
+void Alignments::describeLane(BatchLane &lane) {}
+
+bool Alignments::fitsVectorLanes()
+{
+	int64_t maxCost = std::max( std::max(cost, fractionalCost), (int64_t) 1 );
+	return (rows + columns) * maxCost < batchInfinity();
+}
+
+void Alignments::preprocessReads()
+{
+	rows = clr.length() + 1;
+	columns = ulr.length() + 1;
+}
+
+bool Alignments::reserveMatrix(int64_t cells, int64_t keptCells)
+/* Grow the matrix block so that it holds at least the given number of cells. The block is aligned to
+ * a cache line, or to a huge page for large matrices so the kernel can back it with huge pages. */
+{
+	if (cells <= matrixCapacity) {
+		return true;
+	}
+
+	// Nothing to keep; free the old block first so that both never take memory at the same time
+	if (keptCells == 0) {
+		deleteMatrix();
+	}
+
+	// Over-allocate a little so that slightly longer reads do not trigger another allocation
+	int64_t capacity = cells + cells/8;
+	size_t bytes = capacity*sizeof(int64_t);
+	size_t hugePageSize = 2*1024*1024;
+	size_t alignment = bytes >= hugePageSize ? hugePageSize : 64;
+	void* block = NULL;
+
+	if (posix_memalign(&block, alignment, bytes) != 0) {
+		return false;
+	}
+#ifdef MADV_HUGEPAGE
+	if (alignment == hugePageSize) {
+		madvise(block, bytes, MADV_HUGEPAGE);
+	}
+#endif
+	if (keptCells > 0) {
+		std::copy(matrix, matrix + keptCells, static_cast<int64_t*>(block));
+		deleteMatrix();
+	}
+	matrix = static_cast<int64_t*>(block);
+	matrixCapacity = capacity;
+	return true;
+}
+
+void Alignments::setFullBand()
+{
+	rowStart.resize(rows);
+	bandBegin.assign(rows, 0);
+	bandEnd.assign(rows, columns - 1);
+	for (int64_t rowIndex = 0; rowIndex < rows; rowIndex++) {
+		rowStart[rowIndex] = rowIndex*columns;
+	}
+	matrixCells = rows*columns;
+}
+
+void Alignments::setRollingRows()
+{
+	rowStart.resize(rows);
+	bandBegin.assign(rows, 0);
+	bandEnd.assign(rows, columns - 1);
+	for (int64_t rowIndex = 0; rowIndex < rows; rowIndex++) {
+		rowStart[rowIndex] = (rowIndex % 2)*columns;
+	}
+	matrixCells = std::min(rows, (int64_t) 2)*columns;
+}
+
+void Alignments::setDiagonalBand()
+/* Centre the band of each row on the straight line between the two corners of the matrix; the
+ * corners themselves are always inside the band. */
+{
+	bandBegin.resize(rows);
+	bandEnd.resize(rows);
+
+	for (int64_t rowIndex = 0; rowIndex < rows; rowIndex++) {
+		int64_t center = rows > 1 ? rowIndex * (columns - 1) / (rows - 1) : 0;
+		bandBegin[rowIndex] = std::max( center - bandRadius, (int64_t) 0 );
+		bandEnd[rowIndex] = std::min( center + bandRadius, columns - 1 );
+	}
+	setBandRows();
+}
+
+void Alignments::setBandRows()
+{
+	rowStart.resize(rows);
+	int64_t offset = 0;
+	for (int64_t rowIndex = 0; rowIndex < rows; rowIndex++) {
+		rowStart[rowIndex] = offset - bandBegin[rowIndex];
+		offset = offset + bandEnd[rowIndex] - bandBegin[rowIndex] + 1;
+	}
+	matrixCells = offset;
+}
+
+bool Alignments::isFullBand()
+{
+	for (int64_t rowIndex = 0; rowIndex < rows; rowIndex++) {
+		if (bandBegin[rowIndex] > 0 or bandEnd[rowIndex] < columns - 1) {
+			return false;
+		}
+	}
+	return true;
+}
+
+int64_t Alignments::workspaceBytes()
+{
+	return matrixCapacity*sizeof(int64_t) + operations.capacity() + checkpoints.capacity()*sizeof(int64_t) +
+	       diagonalOperations.capacity()*sizeof(uint64_t) + diagonalStart.capacity()*sizeof(int64_t) +
+	       batchOperations.capacity()*sizeof(uint32_t);
+}
+
+void Alignments::trackWorkspace(int64_t neededBytes)
+/* Buffers the size of the reads that followed are allocated again by the next read that needs them,
+ * so only memory that a run of reads went without is given back. */
+{
+	if (shrinkAfterReads <= 0) {
+		return;
+	}
+	if (8*neededBytes >= workspaceBytes()) {
+		smallReads = 0;
+		smallReadsBytes = 0;
+		return;
+	}
+	smallReads++;
+	smallReadsBytes = std::max(smallReadsBytes, neededBytes);
+	if (smallReads < shrinkAfterReads) {
+		return;
+	}
+	releaseWorkspace();
+}
+
+void Alignments::releaseWorkspace()
+{
+	deleteMatrix();
+	std::vector<uint8_t>().swap(operations);
+	std::vector<int64_t>().swap(checkpoints);
+	std::vector<uint64_t>().swap(diagonalOperations);
+	std::vector<int64_t>().swap(diagonalStart);
+	std::vector<uint32_t>().swap(batchOperations);
+	smallReads = 0;
+	smallReadsBytes = 0;
+}
+
+void Alignments::checkBandEdge(int64_t rowIndex, int64_t columnIndex)
+{
+	if ( (columnIndex == bandBegin[rowIndex] and columnIndex > 0) or
+	     (columnIndex == bandEnd[rowIndex] and columnIndex < columns - 1) ) {
+		bandEdgeReached = true;
+	}
+}
+
+bool Alignments::createMatrix()
+/* Allocates the DP structures of the current engine and fills the matrix. Returns false if there
+ * is not enough memory. The LinearSpace engine only saves every checkpointInterval()-th row here;
+ * the rest is recomputed a block at a time while backtracking. */
+{
+	if (readEngine == ScoreBounded) {
+		return fillWithinScore();
+	}
+
+	bool allocated = reserveMatrix(matrixCells);
+	int64_t operationRows = 0;
+
+	if (readEngine == Traceback or readEngine == BitParallel) {
+		operationRows = rows;
+	} else if (readEngine == LinearSpace) {
+		operationRows = std::min( checkpointInterval() + 1, rows );
+	}
+	try {
+		if (allocated and operationRows > 0) {
+			// The bit-parallel kernel stores whole words of operations and needs some slack at the end
+			operations.resize( (operationRows*columns + 3) / 4 + 24 );
+		}
+		if (allocated and readEngine == LinearSpace) {
+			checkpoints.resize( ((rows - 1)/checkpointInterval() + 1)*columns );
+		}
+	} catch( std::bad_alloc& ba ) {
+		allocated = false;
+	}
+	if (!allocated) {
+		return false;
+	}
+
+	if (readEngine == AntiDiagonal) {
+		int64_t finalScore;
+		try {
+			diagonalStart.resize(rows + columns - 1);
+			int64_t start = 0;
+			for (int64_t diagonal = 0; diagonal < rows + columns - 1; diagonal++) {
+				diagonalStart[diagonal] = start;
+				start = start + antiDiagonalLength(diagonal, rows, columns);
+			}
+			finalScore = fillByAntiDiagonals();
+		} catch( std::bad_alloc& ba ) {
+			return false;
+		}
+		// Only the bottom right score is needed after filling
+		cell(rows-1,columns-1) = finalScore;
+	} else if (readEngine == LinearSpace) {
+		int64_t interval = checkpointInterval();
+		for (int64_t rowIndex = 0; rowIndex < rows; rowIndex++) {
+			fillRows(rowIndex, rowIndex, false);
+			if (rowIndex % interval == 0) {
+				std::copy( &cell(rowIndex,0), &cell(rowIndex,0) + columns,
+				           checkpoints.begin() + (rowIndex/interval)*columns );
+			}
+		}
+		// No block of operations has been computed yet
+		operationsFirstRow = rows;
+		operationsLastRow = rows;
+	} else if (readEngine == BitParallel) {
+		operationsFirstRow = 0;
+		operationsLastRow = rows - 1;
+		fillByBitVectors();
+	} else {
+		operationsFirstRow = 0;
+		operationsLastRow = rows - 1;
+		// Traceback keeps only two rows of scores, which the tiles cannot share
+		if (readEngine == Traceback or !fillByWavefront()) {
+			fillRows(0, rows - 1, readEngine == Traceback);
+		}
+	}
+	return true;
+}
+
+void Alignments::fillRows(int64_t firstRow, int64_t lastRow, bool recordOperations)
+/* Fill the band of each row from left to right, setting the base cases along the way.
+ * Requires the row before firstRow to be filled already. */
+{
+	for (int64_t rowIndex = firstRow; rowIndex <= lastRow; rowIndex++) {
+		for (int64_t columnIndex = bandBegin[rowIndex]; columnIndex <= bandEnd[rowIndex]; columnIndex++) {
+			if (rowIndex == 0 and columnIndex == 0) {
+				cell(0,0) = 0;
+			} else if (columnIndex == 0) {
+				cell(rowIndex,0) = rowBaseCase(rowIndex);	
+			} else if (rowIndex == 0) {
+				cell(0,columnIndex) = columnBaseCase(columnIndex);
+			} else {
+				cell(rowIndex,columnIndex) = editDistance(rowIndex,columnIndex);
+			}
+			if (recordOperations) {
+				storeOperation(rowIndex, columnIndex, backtrackOperation(rowIndex,columnIndex));
+			}
+		}
+	}
+}
+
+template <class Recurrence>
+void Alignments::fillRowsOf(int64_t firstRow, int64_t lastRow, bool recordOperations, int64_t firstColumn,
+                            int64_t lastColumn)
+/* Same as fillRows, with the cell functions of the recurrence bound at compile time. Only the cells
+ * between firstColumn and lastColumn are filled. */
+{
+	Recurrence &recurrence = static_cast<Recurrence&>(*this);
+	for (int64_t rowIndex = firstRow; rowIndex <= lastRow; rowIndex++) {
+		int64_t rowEnd = std::min(bandEnd[rowIndex], lastColumn);
+		for (int64_t columnIndex = std::max(bandBegin[rowIndex], firstColumn); columnIndex <= rowEnd; columnIndex++) {
+			if (rowIndex == 0 and columnIndex == 0) {
+				cell(0,0) = 0;
+			} else if (columnIndex == 0) {
+				cell(rowIndex,0) = recurrence.rowScore(rowIndex);
+			} else if (rowIndex == 0) {
+				cell(0,columnIndex) = recurrence.columnScore(columnIndex);
+			} else {
+				cell(rowIndex,columnIndex) = recurrence.cellScore(rowIndex,columnIndex);
+			}
+			if (recordOperations) {
+				storeOperation(rowIndex, columnIndex, recurrence.cellOperation(rowIndex,columnIndex));
+			}
+		}
+	}
+}
+
+void Alignments::fillTile(int64_t firstRow, int64_t lastRow, int64_t firstColumn, int64_t lastColumn)
+/* Same as fillRows for the cells between firstColumn and lastColumn, without recording operations. */
+{
+	for (int64_t rowIndex = firstRow; rowIndex <= lastRow; rowIndex++) {
+		int64_t rowEnd = std::min(bandEnd[rowIndex], lastColumn);
+		for (int64_t columnIndex = std::max(bandBegin[rowIndex], firstColumn); columnIndex <= rowEnd; columnIndex++) {
+			if (rowIndex == 0 and columnIndex == 0) {
+				cell(0,0) = 0;
+			} else if (columnIndex == 0) {
+				cell(rowIndex,0) = rowBaseCase(rowIndex);
+			} else if (rowIndex == 0) {
+				cell(0,columnIndex) = columnBaseCase(columnIndex);
+			} else {
+				cell(rowIndex,columnIndex) = editDistance(rowIndex,columnIndex);
+			}
+		}
+	}
+}
+
+bool Alignments::fillWithinScore()
+/* Costs are never negative, so a cell scoring at most scoreBound can only be reached from cells that
+ * do too. Each row is therefore filled from the first kept column of the row above to one past its
+ * last, and further right only while the scores stay within the bound; only the columns between the
+ * first and last cell within the bound are kept. Every other cell scores more than the bound, so
+ * taking it as infinite changes neither the score of a kept cell nor the operation backtracking picks
+ * there. Filling stops, leaving the remaining rows empty, at a row without any cell within the bound
+ * or once the kept cells pass scoreBoundedCells(). */
+{
+	int64_t cellLimit = scoreBoundedCells();
+	int64_t offset = 0;
+	rowStart.assign(rows, 0);
+	bandBegin.assign(rows, 1);
+	bandEnd.assign(rows, 0);
+
+	for (int64_t rowIndex = 0; rowIndex < rows; rowIndex++) {
+		int64_t firstColumn = rowIndex > 0 ? bandBegin[rowIndex-1] : 0;
+		int64_t lastColumn = rowIndex > 0 ? std::min(bandEnd[rowIndex-1] + 1, columns - 1) : 0;
+		// The row may run to the last column; grow the block geometrically so that it is copied rarely
+		if (offset + columns > matrixCapacity and !reserveMatrix(2*(offset + columns), offset)) {
+			return false;
+		}
+		rowStart[rowIndex] = offset - firstColumn;
+		bandBegin[rowIndex] = firstColumn;
+		bandEnd[rowIndex] = columns - 1;
+		fillTile(rowIndex, rowIndex, firstColumn, lastColumn);
+		while (lastColumn < columns - 1 and cell(rowIndex,lastColumn) <= scoreBound) {
+			lastColumn++;
+			fillTile(rowIndex, rowIndex, lastColumn, lastColumn);
+		}
+
+		int64_t begin = firstColumn;
+		int64_t end = lastColumn;
+		while (begin <= end and cell(rowIndex,begin) > scoreBound) {
+			begin++;
+		}
+		while (end >= begin and cell(rowIndex,end) > scoreBound) {
+			end--;
+		}
+		if (begin > end) {
+			bandBegin[rowIndex] = 1;
+			bandEnd[rowIndex] = 0;
+			break;
+		}
+		std::memmove( matrix + offset, &cell(rowIndex,begin), (end - begin + 1)*sizeof(int64_t) );
+		rowStart[rowIndex] = offset - begin;
+		bandBegin[rowIndex] = begin;
+		bandEnd[rowIndex] = end;
+		offset = offset + end - begin + 1;
+		if (offset > cellLimit) {
+			break;
+		}
+	}
+	matrixCells = offset;
+	return true;
+}
+
+int64_t Alignments::scoreBoundedCells()
+{
+	return std::min( rows*columns/16, memoryLimit/(int64_t) sizeof(int64_t) );
+}
+
+bool Alignments::fillByWavefront()
+/* Splits the matrix into tiles small enough to stay in the cache. A cell only needs the cells to its
+ * left, above it and above left of it, so a tile can be filled once the tile to its left and the tiles
+ * above it are. Each thread takes the next row of tiles and fills it from left to right, staying behind
+ * the row of tiles above; the tiles are thereby filled one anti-diagonal of tiles after the other. */
+{
+	const int64_t tileRows = 128;
+	const int64_t tileColumns = 256;
+	int64_t tileRowCount = (rows - 1)/tileRows + 1;
+	if (matrixCells < wavefrontCells or tileRowCount < 2) {
+		return false;
+	}
+	// More threads than rows of tiles would have nothing to do
+	int64_t helpers = borrowIdleThreads(tileRowCount - 1);
+	if (helpers == 0) {
+		return false;
+	}
+
+	// Number of tiles of each row of tiles that have been filled, counting from the left edge of the
+	// matrix; the tiles left of the band need no filling and count as filled from the start
+	std::vector< std::atomic<int64_t> > filledTiles(tileRowCount);
+	std::vector<int64_t> lastTile(tileRowCount);
+	for (int64_t tileRow = 0; tileRow < tileRowCount; tileRow++) {
+		int64_t firstRow = tileRow*tileRows;
+		int64_t lastRow = std::min(firstRow + tileRows, rows) - 1;
+		int64_t firstColumn = *std::min_element(&bandBegin[firstRow], &bandBegin[lastRow] + 1);
+		int64_t lastColumn = *std::max_element(&bandEnd[firstRow], &bandEnd[lastRow] + 1);
+		filledTiles[tileRow].store(firstColumn/tileColumns);
+		lastTile[tileRow] = lastColumn/tileColumns;
+	}
+
+	std::atomic<int64_t> nextTileRow(0);
+	auto fillTileRows = [&]() {
+		int64_t tileRow;
+		while ((tileRow = nextTileRow++) < tileRowCount) {
+			int64_t firstRow = tileRow*tileRows;
+			int64_t lastRow = std::min(firstRow + tileRows, rows) - 1;
+			for (int64_t tile = filledTiles[tileRow].load(); tile <= lastTile[tileRow]; tile++) {
+				// Wait for the tiles above and above left of this one
+				while (tileRow > 0 and filledTiles[tileRow-1].load(std::memory_order_acquire) <= tile) {
+					std::this_thread::yield();
+				}
+				fillTile( firstRow, lastRow, tile*tileColumns, std::min((tile + 1)*tileColumns, columns) - 1 );
+				filledTiles[tileRow].store(tile + 1, std::memory_order_release);
+			}
+			// The tiles right of the band need no filling either
+			filledTiles[tileRow].store(std::numeric_limits<int64_t>::max(), std::memory_order_release);
+		}
+	};
+
+	std::vector<std::thread> threads;
+	for (int64_t helper = 0; helper < helpers; helper++) {
+		threads.push_back( std::thread(fillTileRows) );
+	}
+	fillTileRows();
+	for (int64_t helper = 0; helper < helpers; helper++) {
+		threads[helper].join();
+	}
+	returnIdleThreads(helpers);
+	return true;
+}
+
+int64_t Alignments::borrowIdleThreads(int64_t most)
+/* Takes every idle thread at once and gives back those beyond most, so that two reads never wait for
+ * each other's threads. */
 {
-	rows = clr.length() + 1;
-	columns = ulr.length() + 1;
+	if (idleThreads == NULL or rows*columns < wavefrontCells or most <= 0) {
+		return 0;
+	}
+	int64_t threads = idleThreads->load();
+	while (threads > 0 and !idleThreads->compare_exchange_weak(threads, 0)) {}
+	int64_t surplus = std::max(threads - most, (int64_t) 0);
+	*idleThreads += surplus;
+	return threads - surplus;
 }
 
-void Alignments::createMatrix()
+void Alignments::returnIdleThreads(int64_t threads)
 {
-	try {
-		matrix = new int64_t*[rows];
-	} catch( std::bad_alloc& ba ) {
-		std::cout << "Memory allocation failed; unable to create DP matrix.\n";
-	}
-	for (int64_t rowIndex = 0; rowIndex < rows; rowIndex++) {
-		try {
-			matrix[rowIndex] = new int64_t[columns];
-		} catch( std::bad_alloc& ba ) {
-			std::cout << "Memory allocation failed; unable to create DP matrix.\n";
-		}
+	if (threads > 0) {
+		*idleThreads += threads;
 	}
-	// Set the base cases for the DP matrix
-	matrix[0][0] = 0;
-	for (int64_t rowIndex = 1; rowIndex < rows; rowIndex++) {
-		matrix[rowIndex][0] = rowBaseCase(rowIndex);	
-	}
-	for (int64_t columnIndex = 1; columnIndex < columns; columnIndex++) {
-		matrix[0][columnIndex] = columnBaseCase(columnIndex);
-	}
-	for (int64_t rowIndex = 1; rowIndex < rows; rowIndex++) {
-		for (int64_t columnIndex = 1; columnIndex < columns; columnIndex++) {
-			matrix[rowIndex][columnIndex] = editDistance(rowIndex,columnIndex);
-		}
+}
+
+void Alignments::recomputeBlock(int64_t rowIndex)
+/* Recompute the operations of the rows between the closest saved row above rowIndex and rowIndex
+ * itself for the LinearSpace engine. */
+{
+	int64_t interval = checkpointInterval();
+	int64_t savedRow = rowIndex > 0 ? ((rowIndex - 1)/interval)*interval : 0;
+
+	operationsLastRow = rowIndex;
+	if (savedRow == 0) {
+		// Row 0 is cheap to recompute, and backtracking needs its operations
+		operationsFirstRow = 0;
+		fillRows(0, rowIndex, true);
+	} else {
+		operationsFirstRow = savedRow + 1;
+		std::copy( checkpoints.begin() + (savedRow/interval)*columns,
+		           checkpoints.begin() + (savedRow/interval + 1)*columns, &cell(savedRow,0) );
+		fillRows(savedRow + 1, rowIndex, true);
 	}
 }
 
 void Alignments::deleteMatrix()
-/* Delete the matrix allocated in the heap */
+/* Release the matrix block */
 {
-	if (matrix != NULL) {
-		for (int64_t rowIndex = 0; rowIndex < rows; rowIndex++) {
-			if (matrix[rowIndex] != NULL) {
-				delete matrix[rowIndex];
-			} 	
-		}
-		delete matrix;
-	}
+	free(matrix);
+	matrix = NULL;
+	matrixCapacity = 0;
 }
 
 int64_t Alignments::rowBaseCase(int64_t rowIndex)
@@ -115,7 +979,7 @@ int64_t Alignments::rowBaseCase(int64_t rowIndex)
 int64_t Alignments::columnBaseCase(int64_t columnIndex)
 {
 	int64_t rIndex = columnIndex - 1;
-	return matrix[0][columnIndex-1] + delta(ref[rIndex],'-');
+	return score(0,columnIndex-1) + delta(ref[rIndex],'-');
 }	
 
 int64_t Alignments::editDistance(int64_t rowIndex, int64_t columnIndex) {}
@@ -126,7 +990,95 @@ void Alignments::placeInsertion(int64_t cIndex, int64_t urIndex) {}
 
 void Alignments::placeSubstitution(int64_t cIndex, int64_t urIndex) {}
 
-void Alignments::findAlignments() {}
+Operation Alignments::backtrackOperation(int64_t rowIndex, int64_t columnIndex)
+{
+	return Failed;
+}
+
+void Alignments::findAlignments()
+/* Backtracks through the DP matrix to find the optimal alignments, following the best path from
+ * the bottom right to the top left of the matrix. X chars are inserted around the corrected
+ * sequences (or trimmed segments) by the placement functions to indicate their start and end.
+ * The placement functions append the alignments back to front, and they are reversed once the
+ * path has been followed, so building them is linear in their length.
+ */
+{
+	int64_t rowIndex = rows - 1;
+	int64_t columnIndex = columns - 1;
+
+	if (countingOnly) {
+		readCounts = ReadCounts();
+		inCountedSegment = false;
+	} else {
+		// Every step of the path places one column, and each cLR base adds at most two delimiters
+		int64_t maxLength = rows + columns + 2*rows;
+		refAlignment.reserve(maxLength);
+		ulrAlignment.reserve(maxLength);
+		clrAlignment.reserve(maxLength);
+	}
+
+	while ( (rowIndex > 0 or columnIndex > 0) and alignmentSuccessful) {
+		int64_t urIndex = columnIndex - 1;
+		int64_t cIndex = rowIndex - 1;
+		checkBandEdge(rowIndex,columnIndex);
+
+		Operation operation;
+		if (readEngine == Traceback or readEngine == BitParallel) {
+			operation = storedOperation(rowIndex,columnIndex);
+		} else if (readEngine == AntiDiagonal) {
+			operation = diagonalOperation(rowIndex,columnIndex);
+		} else if (readEngine == Batched) {
+			operation = batchedOperation(rowIndex,columnIndex);
+		} else if (readEngine == LinearSpace) {
+			if (rowIndex < operationsFirstRow or rowIndex > operationsLastRow) {
+				recomputeBlock(rowIndex);
+			}
+			operation = storedOperation(rowIndex,columnIndex);
+		} else {
+			operation = backtrackOperation(rowIndex,columnIndex);
+		}
+
+		if (operation == Deletion) {
+			placeDeletion(cIndex,urIndex);
+			columnIndex--;
+		} else if (operation == Insertion) {
+			placeInsertion(cIndex,urIndex);
+			rowIndex--;
+		} else if (operation == Substitution) {
+			placeSubstitution(cIndex,urIndex);
+			rowIndex--;
+			columnIndex--;
+		} else {
+			alignmentSuccessful = false;
+		}
+	}
+	if (countingOnly) {
+		std::reverse(readCounts.segments.begin(), readCounts.segments.end());
+	} else {
+		std::reverse(refAlignment.begin(), refAlignment.end());
+		std::reverse(ulrAlignment.begin(), ulrAlignment.end());
+		std::reverse(clrAlignment.begin(), clrAlignment.end());
+	}
+}
+
+void Alignments::countPlacedColumn(char refBase, char uBase, char cBase)
+/* The columns come back to front, so the delimiter that closes a corrected segment is met first and
+ * the segments are counted from the last to the first. */
+{
+	if (cBase == 'X') {
+		if (inCountedSegment) {
+			readCounts.segments.push_back(segmentCounts);
+		} else {
+			segmentCounts = MutationCounts();
+		}
+		inCountedSegment = !inCountedSegment;
+		return;
+	}
+	countColumn(readCounts.read, refBase, uBase, cBase);
+	if (inCountedSegment) {
+		countColumn(segmentCounts, refBase, uBase, cBase);
+	}
+}
 
 int64_t Alignments::delta(char refBase, char cBase)
 /* Cost function for dynamic programming algorithm */
@@ -144,7 +1096,7 @@ void Alignments::printMatrix()
 	int64_t infinity = std::numeric_limits<int64_t>::max();
 	for (int64_t rowIndex = 0; rowIndex < rows; rowIndex++) {
 		for (int64_t columnIndex = 0; columnIndex < columns; columnIndex++) {
-			int64_t val = matrix[rowIndex][columnIndex];
+			int64_t val = score(rowIndex,columnIndex);
 			if (val == infinity) {
 				std::cout << "- ";
 			} else {
@@ -159,66 +1111,102 @@ void Alignments::printMatrix()
 
 UntrimmedAlignments::UntrimmedAlignments() : Alignments() {}
 
+bool UntrimmedAlignments::supportsBanding()
+{
+	return true;
+}
+
+void UntrimmedAlignments::preprocessReads()
+/* The DP and the placement functions look these facts up for every cell, so they are worked out once
+ * per row here instead of from the neighbouring bases each time. */
+{
+	Alignments::preprocessReads();
+	int64_t length = clr.length();
+	rowFlags.assign(rows, 0);
+	for (int64_t cIndex = 0; cIndex < length; cIndex++) {
+		bool lastIndex = cIndex == length - 1;
+		uint8_t flags = 0;
+		// An ending lower case base is a lowercase base followed by an uppercase base, or the last
+		// base of the sequence
+		if ( islower(clr[cIndex]) ) {
+			flags |= LowerCaseRow;
+			if ( lastIndex or isupper(clr[cIndex+1]) ) {
+				flags |= EndingLowerCaseRow;
+			}
+		}
+		if ( isupper(clr[cIndex]) and (lastIndex or islower(clr[cIndex+1])) ) {
+			flags |= SegmentEndRow;
+		}
+		// The current base is the beginning base of a corrected segment if
+		// it is the very first base of the entire cLR and it is uppercase or
+		// the previous base is an ending lowercase base
+		if ( (cIndex == 0 and isupper(clr[cIndex])) or (rowFlags[cIndex] & EndingLowerCaseRow) ) {
+			flags |= SegmentStartRow;
+		}
+		rowFlags[cIndex+1] = flags;
+	}
+}
+
+bool UntrimmedAlignments::isLowerCase(int64_t cIndex)
+{
+	return rowFlags[cIndex+1] & LowerCaseRow;
+}
+
 bool UntrimmedAlignments::checkIfEndingLowerCase(int64_t cIndex)
 /* Determine if we're at an ending lower case i.e. if the current base
  * in cLR is lowercase and the following base is uppercase or the
  * current base is lowercase and the last base in the sequene.
  */
 {
-	if ( (cIndex < clr.length() - 1 and islower(clr[cIndex]) and isupper(clr[cIndex+1])) or 
-	     (cIndex == clr.length() - 1 and islower(clr[cIndex])) ) {
-		return true;
-	} else {
-		return false;
-	}
+	return rowFlags[cIndex+1] & EndingLowerCaseRow;
 }
 
 bool UntrimmedAlignments::isBeginningCorrectedIndex(int64_t cIndex)
 {
-	// The current base is the beginning base of a corrected segment is
-	// it is the very first base of the entire cLR and it is uppercase or
-	// the previous base is an ending lowercase base
-	if ( (cIndex == 0 and isupper(clr[cIndex])) or checkIfEndingLowerCase(cIndex-1) ) {
-		return true;
-	} else {
-		return false;
-	}
+	return rowFlags[cIndex+1] & SegmentStartRow;
 }
 
 bool UntrimmedAlignments::isEndingCorrectedIndex(int64_t cIndex)
 {
-	if ( isupper(clr[cIndex]) and (cIndex == clr.length() - 1 or islower(clr[cIndex+1])) ) {
-		return true;
-	} else {
-		return false;
-	} 
+	return rowFlags[cIndex+1] & SegmentEndRow;
 }
 
-int64_t UntrimmedAlignments::rowBaseCase(int64_t rowIndex) 
+template <bool extended>
+int64_t UntrimmedAlignments::untrimmedRowScore(int64_t rowIndex) 
+/* Extended reads may start anywhere in the reference, so their corrected prefix is free */
 {
 	int64_t infinity = std::numeric_limits<int64_t>::max();
 
 	int64_t cIndex = rowIndex - 1;
 
-	if ( cIndex >= 0 and islower(clr[cIndex]) ) {
+	if ( cIndex >= 0 and isLowerCase(cIndex) ) {
 		return infinity;
+	} else if (extended) {
+		return score(rowIndex-1,0);
 	} else {
-		return matrix[rowIndex-1][0] + cost;
+		return score(rowIndex-1,0) + cost;
 	}
 }
 
+template <bool extended>
 int64_t UntrimmedAlignments::levenshteinDistance(int64_t rowIndex, int64_t columnIndex)
+/* Insertions in the last column are free for extended reads */
 {
 	int64_t cIndex = rowIndex - 1;
 	int64_t urIndex = columnIndex - 1;
-	int64_t deletion = std::abs( matrix[rowIndex][columnIndex-1] + cost );
-	int64_t insert = std::abs( matrix[rowIndex-1][columnIndex] + cost );
-	int64_t substitute = std::abs( matrix[rowIndex-1][columnIndex-1] + delta(ref[urIndex], clr[cIndex]) );
+	int64_t insert;
+	if (extended and columnIndex == columns - 1) {
+		insert = score(rowIndex-1,columnIndex);
+	} else {
+		insert = std::abs( score(rowIndex-1,columnIndex) + cost );
+	}
+	int64_t deletion = std::abs( score(rowIndex,columnIndex-1) + cost );
+	int64_t substitute = std::abs( score(rowIndex-1,columnIndex-1) + delta(ref[urIndex], clr[cIndex]) );
 	return std::min( deletion, std::min(insert,substitute) );
 }
 
-
-int64_t UntrimmedAlignments::editDistance(int64_t rowIndex, int64_t columnIndex)
+template <bool extended>
+int64_t UntrimmedAlignments::untrimmedScore(int64_t rowIndex, int64_t columnIndex)
 /* Given cLR, uLR and ref sequences, construct the DP matrix for the optimal alignments. 
  * Requires these member variables to be set before use. */
 {
@@ -232,53 +1220,55 @@ int64_t UntrimmedAlignments::editDistance(int64_t rowIndex, int64_t columnIndex)
 		// clr. If they are different, we can't keep both so we can only consider deleting the
 		// one from clr.
 		if ( toupper(ulr[urIndex]) == toupper(clr[cIndex]) ) {
-			int64_t keep = std::abs(matrix[rowIndex-1][columnIndex-1] + delta(ref[urIndex], clr[cIndex]));
-			int64_t del = std::abs(matrix[rowIndex][columnIndex-1] + delta(ref[urIndex], '-'));
+			int64_t keep = std::abs(score(rowIndex-1,columnIndex-1) + delta(ref[urIndex], clr[cIndex]));
+			int64_t del = std::abs(score(rowIndex,columnIndex-1) + delta(ref[urIndex], '-'));
 			return std::min(keep, del); 
 		} else {
 			// deletion
-			int64_t del = std::abs(matrix[rowIndex][columnIndex-1] + delta(ref[urIndex], '-'));
+			int64_t del = std::abs(score(rowIndex,columnIndex-1) + delta(ref[urIndex], '-'));
 			return del;
 		}
-	} else if (islower(clr[cIndex])) {
+	} else if (isLowerCase(cIndex)) {
 		if ( toupper( ulr[urIndex] ) == toupper( clr[cIndex] ) ) {
 			// substitution
-			return std::abs( matrix[rowIndex-1][columnIndex-1] + delta(ref[urIndex], clr[cIndex]) );
+			return std::abs( score(rowIndex-1,columnIndex-1) + delta(ref[urIndex], clr[cIndex]) );
 		} else if (ulr[urIndex] == '-') {
 			// deletion
-			return std::abs(matrix[rowIndex][columnIndex-1] + cost);
+			return std::abs(score(rowIndex,columnIndex-1) + cost);
 		} else {
 			// Setting the position in the matrix to infinity ensures that we can never
 			// find an alignment where the uncorrected segments are not perfectly aligned.
 			return infinity;
 		}
 	} else {
-		return levenshteinDistance(rowIndex,columnIndex);
+		return levenshteinDistance<extended>(rowIndex,columnIndex);
 	}
 }
 
+template <bool extended>
 void UntrimmedAlignments::operationCosts(int64_t rowIndex, int64_t columnIndex, 
                                          int64_t& deletion, int64_t& insert, int64_t& substitute)
 {
-	int64_t infinity = std::numeric_limits<int64_t>::max();
 	int64_t cIndex = rowIndex - 1;
 	int64_t urIndex = columnIndex - 1;
 	bool isEndingLC = checkIfEndingLowerCase(cIndex);
 
-	insert = std::abs(matrix[rowIndex-1][columnIndex] + cost);
+	if (extended and columnIndex == columns - 1) {
+		insert = score(rowIndex-1,columnIndex);
+	} else {
+		insert = std::abs(score(rowIndex-1,columnIndex) + cost);
+	}
 	if (isEndingLC) {
-		deletion = std::abs(matrix[rowIndex][columnIndex-1] + delta(ref[urIndex], '-'));
+		deletion = std::abs(score(rowIndex,columnIndex-1) + delta(ref[urIndex], '-'));
 	} else {
-		deletion = std::abs(matrix[rowIndex][columnIndex-1] + cost);
+		deletion = std::abs(score(rowIndex,columnIndex-1) + cost);
 	}
-	substitute = std::abs(matrix[rowIndex-1][columnIndex-1] + delta(ref[urIndex], clr[cIndex]));
+	substitute = std::abs(score(rowIndex-1,columnIndex-1) + delta(ref[urIndex], clr[cIndex]));
 }
 
 void UntrimmedAlignments::placeDeletion(int64_t cIndex, int64_t urIndex) 
 {
-	clrAlignment = '-' + clrAlignment;
-	ulrAlignment = ulr[urIndex] + ulrAlignment;
-	refAlignment = ref[urIndex] + refAlignment;
+	placeColumn(ref[urIndex], ulr[urIndex], '-');
 }
 
 void UntrimmedAlignments::placeInsertion(int64_t cIndex, int64_t urIndex) 
@@ -286,142 +1276,490 @@ void UntrimmedAlignments::placeInsertion(int64_t cIndex, int64_t urIndex)
 	bool endingCorrectedBase = isEndingCorrectedIndex(cIndex);
 	bool beginningCorrectedBase = isBeginningCorrectedIndex(cIndex);
 	if (endingCorrectedBase) {
-		refAlignment = '-' + refAlignment;
-		ulrAlignment = 'X' + ulrAlignment;
-		clrAlignment = 'X' + clrAlignment;	
+		placeColumn('-', 'X', 'X');
 	}
-	clrAlignment = clr[cIndex] + clrAlignment;
-	ulrAlignment = '-' + ulrAlignment;
-	refAlignment = '-' + refAlignment;
+	placeColumn('-', '-', clr[cIndex]);
 	// Insert the left and right boundaries of the corrected segments
 	if (beginningCorrectedBase) {
-		refAlignment = '-' + refAlignment;
-		ulrAlignment = 'X' + ulrAlignment;
-		clrAlignment = 'X' + clrAlignment;	
+		placeColumn('-', 'X', 'X');
+	}
+}
+
+void UntrimmedAlignments::placeSubstitution(int64_t cIndex, int64_t urIndex)
+{
+	bool endingCorrectedBase = isEndingCorrectedIndex(cIndex);
+	bool beginningCorrectedBase = isBeginningCorrectedIndex(cIndex);
+	// Insert the right boundary of a corrected segment
+	if (endingCorrectedBase) {
+		placeColumn('-', 'X', 'X');
+	}
+	placeColumn(ref[urIndex], ulr[urIndex], clr[cIndex]);
+	// Insert the left boundary of the corrected segment
+	if (beginningCorrectedBase) {
+		placeColumn('-', 'X', 'X');
+	}
+}
+
+template <bool extended>
+Operation UntrimmedAlignments::untrimmedOperation(int64_t rowIndex, int64_t columnIndex)
+/* Returns the operation that leads to the given cell of the DP matrix when backtracking.
+ * Follows same schema as the DP algorithm for untrimmed corrected long reads. 
+ * The path we follow is restricted to the conditions set when computing the matrix,
+ * i.e. we can never follow a path that the edit distance equations do not allow.
+ */
+{
+	int64_t urIndex = columnIndex - 1;
+	int64_t cIndex = rowIndex - 1;
+	int64_t currentCost = score(rowIndex,columnIndex);
+
+	if (rowIndex == 0) {
+		return Deletion;
+	} else if (columnIndex == 0) {
+		return Insertion;
+	}
+
+	// Set the costs of the different operations, 
+	// also ensuring we don't go out of bounds of the matrix.
+	int64_t deletion;
+	int64_t insert;
+	int64_t substitute;
+	operationCosts<extended>(rowIndex,columnIndex,deletion,insert,substitute);
+
+	// check to see if the current base in the corrected long read is lowercase
+	bool isEndingLC = checkIfEndingLowerCase(cIndex);
+	if (isEndingLC) {
+		if ( toupper( ulr[urIndex] ) == toupper( clr[cIndex] ) ) {
+			if (deletion == currentCost) {
+				return Deletion;
+			} else if (substitute == currentCost) {
+				// Insert the right boundary of a corrected segment
+				return Substitution;
+			} else {
+				std::cout << "ERROR CODE 1: Terminating backtracking.\n";
+				std::exit(1);
+			}
+		} else {
+			if (deletion == currentCost) {
+				return Deletion;
+			} else {
+				std::cout << "ERROR CODE 2: Terminating backtracking.\n";
+				std::exit(1);
+			}
+		}
+	} else if (isLowerCase(cIndex)) {
+		if ( toupper( ulr[urIndex] ) == toupper( clr[cIndex] ) ) {
+			if (substitute == currentCost) {
+				// Insert the right boundary of the corrected segment
+				return Substitution;
+			} else {
+				std::cout << "ERROR CODE 3: Terminating backtracking.\n";
+				std::exit(1);
+			}
+		} else if (ulr[urIndex] == '-') {
+			if (deletion == currentCost) {
+				return Deletion;
+			} else {
+				std::cout << "ERROR CODE 4: Terminating backtracking.\n";
+				std::exit(1);
+			}
+		} else {
+			return Failed;
+		}
+	// This condition is performed if the current corrected long read base is uppercase
+	} else {
+		if (deletion == currentCost) {
+			return Deletion;
+		} else if (insert == currentCost) {
+			// Insert the right boundary of the corrected segment
+			return Insertion;
+		} else if (substitute == currentCost) {
+			return Substitution;
+		} else {
+			std::cout << "ERROR CODE 6: Terminating backtracking.\n";
+			std::exit(1);	
+		}
+	} 		
+}
+
+int64_t UntrimmedAlignments::rowScore(int64_t rowIndex)
+{
+	return untrimmedRowScore<false>(rowIndex);
+}
+
+int64_t UntrimmedAlignments::columnScore(int64_t columnIndex)
+{
+	return Alignments::columnBaseCase(columnIndex);
+}
+
+int64_t UntrimmedAlignments::cellScore(int64_t rowIndex, int64_t columnIndex)
+{
+	return untrimmedScore<false>(rowIndex,columnIndex);
+}
+
+Operation UntrimmedAlignments::cellOperation(int64_t rowIndex, int64_t columnIndex)
+{
+	return untrimmedOperation<false>(rowIndex,columnIndex);
+}
+
+void UntrimmedAlignments::fillRows(int64_t firstRow, int64_t lastRow, bool recordOperations)
+{
+	fillRowsOf<UntrimmedAlignments>(firstRow, lastRow, recordOperations);
+}
+
+void UntrimmedAlignments::fillTile(int64_t firstRow, int64_t lastRow, int64_t firstColumn, int64_t lastColumn)
+{
+	fillRowsOf<UntrimmedAlignments>(firstRow, lastRow, false, firstColumn, lastColumn);
+}
+
+int64_t UntrimmedAlignments::rowBaseCase(int64_t rowIndex)
+{
+	return rowScore(rowIndex);
+}
+
+int64_t UntrimmedAlignments::editDistance(int64_t rowIndex, int64_t columnIndex)
+{
+	return cellScore(rowIndex,columnIndex);
+}
+
+Operation UntrimmedAlignments::backtrackOperation(int64_t rowIndex, int64_t columnIndex)
+{
+	return cellOperation(rowIndex,columnIndex);
+}
+
+bool UntrimmedAlignments::supportsBatching()
+{
+	return rows > 1 and columns > 1 and fitsVectorLanes();
+}
+
+void UntrimmedAlignments::describeLane(BatchLane &lane)
+/* Mirrors editDistance: an ending lower case row may only delete or keep a base that matches the
+ * uLR, other lower case rows may only keep a matching base or skip a uLR gap, and upper case rows
+ * take any move. Column 0 is unreachable from the first lower case row down. */
+{
+	lane.rowBases = clr;
+	lane.columnBases = ref;
+	lane.ulrBases = ulr;
+	std::transform(lane.rowBases.begin(), lane.rowBases.end(), lane.rowBases.begin(), ::toupper);
+	std::transform(lane.columnBases.begin(), lane.columnBases.end(), lane.columnBases.begin(), ::toupper);
+	std::transform(lane.ulrBases.begin(), lane.ulrBases.end(), lane.ulrBases.begin(), ::toupper);
+
+	lane.rowRules.assign(rows, 0);
+	lane.deletionCosts.assign(rows, cost);
+	lane.rowBaseScores.assign(rows, 0);
+	lane.columnBaseScores.assign(columns, 0);
+
+	bool lowerCaseSeen = false;
+	for (int64_t rowIndex = 1; rowIndex < rows; rowIndex++) {
+		int64_t cIndex = rowIndex - 1;
+		if (checkIfEndingLowerCase(cIndex)) {
+			lane.rowRules[rowIndex] = AllowDeletion | FreeDeletionAtRefGap | AllowSubstitutionAtUlrMatch;
+		} else if (isLowerCase(cIndex)) {
+			lane.rowRules[rowIndex] = AllowDeletionAtUlrGap | AllowSubstitutionAtUlrMatch;
+		} else {
+			lane.rowRules[rowIndex] = AllowDeletion | AllowInsertion | AllowSubstitution;
+		}
+		lowerCaseSeen = lowerCaseSeen or isLowerCase(cIndex);
+		lane.rowBaseScores[rowIndex] = lowerCaseSeen ? batchInfinity() : rowIndex*cost;
+	}
+	for (int64_t columnIndex = 1; columnIndex < columns; columnIndex++) {
+		lane.columnBaseScores[columnIndex] = lane.columnBaseScores[columnIndex-1] + delta(ref[columnIndex-1],'-');
+	}
+	lane.cost = cost;
+	lane.lastColumnInsertionCost = cost;
+}
+
+bool UntrimmedAlignments::supportsBitParallel()
+{
+	return columns > 2;
+}
+
+void UntrimmedAlignments::fillByBitVectors()
+{
+	fillRows(0, 0, true);
+	int64_t rowIndex = 1;
+	while (rowIndex < rows) {
+		if (isLowerCase(rowIndex-1)) {
+			fillLowerCaseRow(rowIndex);
+			rowIndex++;
+			continue;
+		}
+		int64_t lastRow = rowIndex;
+		while (lastRow + 1 < rows and !isLowerCase(lastRow)) {
+			lastRow++;
+		}
+		if (!fillUnitCostBlock(rowIndex - 1, lastRow)) {
+			fillRows(rowIndex, lastRow, true);
+		}
+		rowIndex = lastRow + 1;
+	}
+}
+
+bool UntrimmedAlignments::matchesUlr(int64_t rowIndex, int64_t columnIndex)
+{
+	return toupper(ulr[columnIndex-1]) == toupper(clr[rowIndex-1]);
+}
+
+bool UntrimmedAlignments::findSegmentBand()
+/* A cell is worth filling only if it can be reached from (0,0) and (rows-1,columns-1) can be reached
+ * from it; every optimal path, and every neighbour backtracking compares it with, lies in such cells.
+ * A forward pass finds the first column each row is reached at and a backward pass the last column
+ * each row can leave from. Upper case and ending lower case rows may delete into any column, so the
+ * columns they reach form an interval. Lower case rows only keep bases that match the uLR, along a
+ * diagonal, so the columns they reach are kept as a set; a few bases into a run, only the run's place
+ * in the uLR is left. Returns false if the end is unreachable or the band would save too little. */
+{
+	int64_t lastColumn = columns - 1;
+	bandBegin.resize(rows);
+	bandEnd.resize(rows);
+
+	// Columns reached in the previous row: every column from firstColumn on, or columnSet
+	std::vector<int64_t> columnSet;
+	std::vector<int64_t> candidates;
+	bool isInterval = true;
+	int64_t firstColumn = 0;
+	bandBegin[0] = 0;
+	for (int64_t rowIndex = 1; rowIndex < rows; rowIndex++) {
+		int64_t cIndex = rowIndex - 1;
+		if (!isLowerCase(cIndex)) {
+			// Insertions carry the first column down, and deletions reach the rest of the row
+			if (!isInterval) {
+				firstColumn = columnSet.front();
+				isInterval = true;
+			}
+			bandBegin[rowIndex] = firstColumn;
+			continue;
+		}
+		candidates.clear();
+		if (isInterval) {
+			for (int64_t columnIndex = firstColumn + 1; columnIndex <= lastColumn; columnIndex++) {
+				if (matchesUlr(rowIndex,columnIndex)) {
+					candidates.push_back(columnIndex);
+				}
+			}
+		} else {
+			for (int64_t columnIndex : columnSet) {
+				if (columnIndex < lastColumn and matchesUlr(rowIndex,columnIndex+1)) {
+					candidates.push_back(columnIndex+1);
+				}
+			}
+		}
+		if (candidates.empty()) {
+			return false;
+		}
+		if (checkIfEndingLowerCase(cIndex)) {
+			firstColumn = candidates.front();
+			isInterval = true;
+		} else {
+			// Gaps in the uLR are deleted
+			columnSet.clear();
+			for (int64_t columnIndex : candidates) {
+				if (!columnSet.empty() and columnIndex <= columnSet.back()) {
+					continue;
+				}
+				columnSet.push_back(columnIndex);
+				while (columnSet.back() < lastColumn and ulr[columnSet.back()] == '-') {
+					columnSet.push_back(columnSet.back() + 1);
+				}
+			}
+			isInterval = false;
+		}
+		bandBegin[rowIndex] = isInterval ? firstColumn : columnSet.front();
+	}
+
+	// Columns of the next row that lead to the end: every column up to lastReaching, or columnSet.
+	// The last cLR base is never a lower case base followed by another, so the last row is an interval.
+	int64_t lastReaching = lastColumn;
+	isInterval = true;
+	bandEnd[rows-1] = lastColumn;
+	for (int64_t rowIndex = rows - 2; rowIndex >= 0; rowIndex--) {
+		int64_t nextRow = rowIndex + 1;
+		// An upper case next row can be entered from any column up to its last one by an insertion;
+		// a lower case one only by keeping a base that matches the uLR. Columns before the first one
+		// this row is reached at lead nowhere useful.
+		if (isLowerCase(nextRow-1)) {
+			candidates.clear();
+			if (isInterval) {
+				for (int64_t columnIndex = bandBegin[rowIndex]; columnIndex < lastReaching; columnIndex++) {
+					if (matchesUlr(nextRow,columnIndex+1)) {
+						candidates.push_back(columnIndex);
+					}
+				}
+			} else {
+				for (int64_t columnIndex : columnSet) {
+					if (columnIndex > bandBegin[rowIndex] and matchesUlr(nextRow,columnIndex)) {
+						candidates.push_back(columnIndex-1);
+					}
+				}
+			}
+			if (candidates.empty()) {
+				return false;
+			}
+			if (rowIndex == 0 or !isLowerCase(rowIndex-1)) {
+				lastReaching = candidates.back();
+				isInterval = true;
+			} else {
+				// A cell reaches its right neighbour by deleting a uLR gap
+				columnSet.clear();
+				for (int64_t index = candidates.size() - 1; index >= 0; index--) {
+					int64_t columnIndex = candidates[index];
+					if (!columnSet.empty() and columnIndex >= columnSet.back()) {
+						continue;
+					}
+					columnSet.push_back(columnIndex);
+					while (columnSet.back() > bandBegin[rowIndex] and ulr[columnSet.back() - 1] == '-') {
+						columnSet.push_back(columnSet.back() - 1);
+					}
+				}
+				std::reverse(columnSet.begin(), columnSet.end());
+				isInterval = false;
+			}
+		}
+		bandEnd[rowIndex] = isInterval ? lastReaching : columnSet.back();
+		if (bandEnd[rowIndex] < bandBegin[rowIndex]) {
+			return false;
+		}
+	}
+
+	// Mostly upper case reads leave a band nearly as large as the matrix, which the bit-parallel
+	// kernel fills faster
+	int64_t cells = 0;
+	for (int64_t rowIndex = 0; rowIndex < rows; rowIndex++) {
+		cells = cells + bandEnd[rowIndex] - bandBegin[rowIndex] + 1;
+	}
+	return cells <= rows*columns/4;
+}
+
+void UntrimmedAlignments::fillLowerCaseRow(int64_t rowIndex)
+/* Same scores and operations as editDistance and backtrackOperation give for lower case rows */
+{
+	int64_t infinity = std::numeric_limits<int64_t>::max();
+	int64_t cIndex = rowIndex - 1;
+	char base = toupper(clr[cIndex]);
+	bool isEndingLC = checkIfEndingLowerCase(cIndex);
+
+	cell(rowIndex,0) = infinity;
+	storeOperation(rowIndex, 0, Insertion);
+	for (int64_t columnIndex = 1; columnIndex < columns; columnIndex++) {
+		int64_t urIndex = columnIndex - 1;
+		bool match = toupper(ulr[urIndex]) == base;
+		int64_t substitute = infinity;
+		if (match) {
+			substitute = std::abs( cell(rowIndex-1,columnIndex-1) + delta(ref[urIndex], clr[cIndex]) );
+		}
+
+		if (isEndingLC) {
+			int64_t deletion = std::abs( cell(rowIndex,columnIndex-1) + delta(ref[urIndex], '-') );
+			cell(rowIndex,columnIndex) = std::min(deletion, substitute);
+			storeOperation(rowIndex, columnIndex, deletion <= substitute ? Deletion : Substitution);
+		} else if (match) {
+			cell(rowIndex,columnIndex) = substitute;
+			storeOperation(rowIndex, columnIndex, Substitution);
+		} else if (ulr[urIndex] == '-') {
+			cell(rowIndex,columnIndex) = std::abs( cell(rowIndex,columnIndex-1) + cost );
+			storeOperation(rowIndex, columnIndex, Deletion);
+		} else {
+			cell(rowIndex,columnIndex) = infinity;
+			storeOperation(rowIndex, columnIndex, Failed);
+		}
 	}
 }
 
-void UntrimmedAlignments::placeSubstitution(int64_t cIndex, int64_t urIndex)
+bool UntrimmedAlignments::fillUnitCostBlock(int64_t topRow, int64_t lastRow)
+/* The kernel fills the columns between the first reachable column of topRow and the second to last
+ * column. The column left of them and the last column, where insertions may be free, are filled with
+ * editDistance. */
 {
-	bool endingCorrectedBase = isEndingCorrectedIndex(cIndex);
-	bool beginningCorrectedBase = isBeginningCorrectedIndex(cIndex);
-	// Insert the right boundary of a corrected segment
-	if (endingCorrectedBase) {
-		refAlignment = '-' + refAlignment;
-		ulrAlignment = 'X' + ulrAlignment;
-		clrAlignment = 'X' + clrAlignment;	
+	int64_t infinity = std::numeric_limits<int64_t>::max();
+	int64_t blockRows = lastRow - topRow;
+	std::vector<int64_t> topScores (&cell(topRow,0), &cell(topRow,0) + columns);
+
+	int64_t leftColumn = 0;
+	while (leftColumn < columns and topScores[leftColumn] > infinity - 100) {
+		leftColumn++;
 	}
-	clrAlignment = clr[cIndex] + clrAlignment;
-	ulrAlignment = ulr[urIndex] + ulrAlignment;
-	refAlignment = ref[urIndex] + refAlignment;
-	// Insert the left boundary of the corrected segment
-	if (beginningCorrectedBase) {
-		refAlignment = '-' + refAlignment;
-		ulrAlignment = 'X' + ulrAlignment;
-		clrAlignment = 'X' + clrAlignment;	
+	int64_t lastColumn = columns - 2;
+	int64_t width = lastColumn - leftColumn;
+	if (width < 1) {
+		return false;
 	}
-}
-
-void UntrimmedAlignments::findAlignments()
-/* Backtracks through the DP matrix to find the optimal alignments. 
- * Follows same schema as the DP algorithm for untrimmed corrected long reads. 
- * Inserts X chars around corrected sequences in the alignment
- * to indicate the start and end of corrected sequences. 
- */
-{
-	int64_t rowIndex = rows - 1;
-	int64_t columnIndex = columns - 1;
 
-	// Follow the best path from the bottom right to the top left of the matrix.
-	// This is equivalent to the optimal alignment between ulr and clr.
-	// The path we follow is restricted to the conditions set when computing the matrix,
-	// i.e. we can never follow a path that the edit distance equations do not allow.
-	while ( (rowIndex > 0 or columnIndex > 0) and alignmentSuccessful) {
-		int64_t urIndex = columnIndex - 1;
-		int64_t cIndex = rowIndex - 1;
-		int64_t currentCost = matrix[rowIndex][columnIndex];
+	// The kernel needs the scores of neighbouring cells on the boundaries to differ by at most one step
+	std::vector<int8_t> topDeltas (width);
+	for (int64_t columnIndex = leftColumn + 1; columnIndex <= lastColumn; columnIndex++) {
+		int64_t difference = topScores[columnIndex] - topScores[columnIndex-1];
+		if (difference != cost and difference != 0 and difference != -cost) {
+			return false;
+		}
+		topDeltas[columnIndex - leftColumn - 1] = difference / cost;
+	}
 
-		if (rowIndex == 0) {
-			placeDeletion(cIndex,urIndex);
-			columnIndex--;
-		} else if (columnIndex == 0) {
-			placeInsertion(cIndex,urIndex);
-			rowIndex--;
+	std::vector<int8_t> leftDeltas (blockRows);
+	std::vector<int64_t> leftScores (blockRows + 1, topScores[leftColumn]);
+	for (int64_t rowIndex = topRow + 1; rowIndex <= lastRow; rowIndex++) {
+		if (leftColumn == 0) {
+			cell(rowIndex,0) = rowBaseCase(rowIndex);
 		} else {
-			// Set the costs of the different operations, 
-			// also ensuring we don't go out of bounds of the matrix.
-			int64_t deletion;
-			int64_t insert;
-			int64_t substitute;
-			operationCosts(rowIndex,columnIndex,deletion,insert,substitute);
-
-			// check to see if the current base in the corrected long read is lowercase
-			bool isEndingLC = checkIfEndingLowerCase(cIndex);
-			if (isEndingLC) {
-				if ( toupper( ulr[urIndex] ) == toupper( clr[cIndex] ) ) {
-					if (deletion == currentCost) {
-						placeDeletion(cIndex,urIndex);
-						columnIndex--;
-					} else if (substitute == currentCost) {
-						// Insert the right boundary of a corrected segment
-						placeSubstitution(cIndex,urIndex);
-						rowIndex--;
-						columnIndex--;
-					} else {
-						std::cout << "ERROR CODE 1: Terminating backtracking.\n";
-						std::exit(1);
-					}
-				} else {
-					if (deletion == currentCost) {
-						placeDeletion(cIndex,urIndex);
-						columnIndex--;
-					} else {
-						std::cout << "ERROR CODE 2: Terminating backtracking.\n";
-						std::exit(1);
-					}
-				}
-			} else if (islower(clr[cIndex])) {
-				if ( toupper( ulr[urIndex] ) == toupper( clr[cIndex] ) ) {
-					if (substitute == currentCost) {
-						// Insert the right boundary of the corrected segment
-						placeSubstitution(cIndex,urIndex);
-						rowIndex--;
-						columnIndex--;
-					} else {
-						std::cout << "ERROR CODE 3: Terminating backtracking.\n";
-						std::exit(1);
-					}
-				} else if (ulr[urIndex] == '-') {
-					if (deletion == currentCost) {
-						placeDeletion(cIndex,urIndex);
-						columnIndex--;
-					} else {
-						std::cout << "ERROR CODE 4: Terminating backtracking.\n";
-						std::exit(1);
-					}
-				} else {
-					alignmentSuccessful = false;
-				}
-		// This condition is performed if the current corrected long read base is uppercase
-			} else {
-				if (deletion == currentCost) {
-					placeDeletion(cIndex,urIndex);
-					columnIndex--;
-				} else if (insert == currentCost) {
-					// Insert the right boundary of the corrected segment
-					placeInsertion(cIndex,urIndex);
-					rowIndex--;
-				} else if (substitute == currentCost) {
-					placeSubstitution(cIndex,urIndex);
-					rowIndex--;
-					columnIndex--;
-				} else {
-					std::cout << "ERROR CODE 6: Terminating backtracking.\n";
-					std::exit(1);	
-				}
-			} 		
+			cell(rowIndex,leftColumn-1) = infinity;
+			cell(rowIndex,leftColumn) = editDistance(rowIndex,leftColumn);
+		}
+		storeOperation(rowIndex, leftColumn, backtrackOperation(rowIndex,leftColumn));
+		leftScores[rowIndex - topRow] = cell(rowIndex,leftColumn);
+
+		int64_t difference = leftScores[rowIndex - topRow] - leftScores[rowIndex - topRow - 1];
+		if (difference != cost and difference != 0 and difference != -cost) {
+			std::copy(topScores.begin(), topScores.end(), &cell(topRow,0));
+			return false;
 		}
+		leftDeltas[rowIndex - topRow - 1] = difference / cost;
+	}
+
+	std::string rowBases = clr.substr(topRow, blockRows);
+	std::string columnBases = ref.substr(leftColumn, width);
+	std::transform(rowBases.begin(), rowBases.end(), rowBases.begin(), ::toupper);
+	std::transform(columnBases.begin(), columnBases.end(), columnBases.begin(), ::toupper);
+
+	BitParallelBlock block;
+	block.rowBases = rowBases.data();
+	block.rows = blockRows;
+	block.columnBases = columnBases.data();
+	block.width = width;
+	block.topDeltas = topDeltas.data();
+	block.leftDeltas = leftDeltas.data();
+	std::vector<int8_t> bottomDeltas;
+	std::vector<int8_t> rightDeltas;
+	fillBitParallel(block, operations.data(), (topRow + 1)*columns + leftColumn + 1, columns, bottomDeltas,
+	                rightDeltas);
+
+	// Cells left of the block cannot be reached
+	for (int64_t rowIndex = topRow + 1; rowIndex <= lastRow; rowIndex++) {
+		for (int64_t columnIndex = 0; columnIndex < leftColumn; columnIndex++) {
+			storeOperation(rowIndex, columnIndex, Failed);
+		}
+	}
+
+	// Last column, one row at a time, from the scores next to it
+	int64_t leftScore = topScores[lastColumn];
+	int64_t upScore = topScores[lastColumn + 1];
+	for (int64_t rowIndex = topRow + 1; rowIndex <= lastRow; rowIndex++) {
+		cell(rowIndex-1,lastColumn) = leftScore;
+		cell(rowIndex-1,lastColumn+1) = upScore;
+		leftScore = leftScore + rightDeltas[rowIndex - topRow - 1]*cost;
+		cell(rowIndex,lastColumn) = leftScore;
+		cell(rowIndex,lastColumn+1) = editDistance(rowIndex,lastColumn+1);
+		storeOperation(rowIndex, lastColumn+1, backtrackOperation(rowIndex,lastColumn+1));
+		upScore = cell(rowIndex,lastColumn+1);
+	}
+
+	// Last row of the block, which the rows under it start from
+	for (int64_t columnIndex = 0; columnIndex < leftColumn; columnIndex++) {
+		cell(lastRow,columnIndex) = infinity;
+	}
+	cell(lastRow,leftColumn) = leftScores[blockRows];
+	for (int64_t columnIndex = leftColumn + 1; columnIndex <= lastColumn; columnIndex++) {
+		cell(lastRow,columnIndex) = cell(lastRow,columnIndex-1) + bottomDeltas[columnIndex - leftColumn - 1]*cost;
 	}
+	cell(lastRow,lastColumn+1) = upScore;
+	return true;
 }
 
 /* --------------------------------------------------------------------------------------------- */
@@ -437,54 +1775,277 @@ bool TrimmedAlignments::isLastBase(int64_t cIndex)
 /* Returns true if the current index is the index of a last base of a trimmed segment, false otherwise
  */
 {
-	// Check if cIndex is the first base of a read
-	if (std::find( lastBaseIndices.begin(), lastBaseIndices.end(), cIndex ) != lastBaseIndices.end()) {
-		return true;
-	} else {
-		return false;
-	} 
+	return rowFlags[cIndex+1] & SegmentEndRow;
 } 
 
 bool TrimmedAlignments::isFirstBase(int64_t cIndex)
 /* Returns true if current corrected long read base is the first base of trimmed segment, false otherwise
  */
 {
-	// Check if cIndex is the first base of a read
-	if (cIndex == 0 or std::find( lastBaseIndices.begin(), lastBaseIndices.end(), cIndex-1 ) != lastBaseIndices.end()) {
-		return true;
-	} else {
-		return false;
-	} 
+	return rowFlags[cIndex+1] & SegmentStartRow;
+}
+
+bool TrimmedAlignments::supportsAntiDiagonal()
+{
+	return fitsVectorLanes();
+}
 
+bool TrimmedAlignments::supportsBatching()
+{
+	return rows > 1 and columns > 1 and fitsVectorLanes();
 }
 
-void TrimmedAlignments::preprocessReads()
+void TrimmedAlignments::describeLane(BatchLane &lane)
+/* Every row of the trimmed recurrence allows all three moves; deletions are free after the last base
+ * of a segment */
+{
+	lane.rowBases = clr;
+	lane.columnBases = ref;
+	lane.ulrBases = ulr;
+	std::transform(lane.rowBases.begin(), lane.rowBases.end(), lane.rowBases.begin(), ::toupper);
+	std::transform(lane.columnBases.begin(), lane.columnBases.end(), lane.columnBases.begin(), ::toupper);
+	std::transform(lane.ulrBases.begin(), lane.ulrBases.end(), lane.ulrBases.begin(), ::toupper);
+
+	lane.rowRules.assign(rows, AllowDeletion | AllowInsertion | AllowSubstitution);
+	lane.deletionCosts.assign(rows, cost);
+	lane.rowBaseScores.assign(rows, 0);
+	lane.columnBaseScores.assign(columns, 0);
+	for (int64_t rowIndex = 1; rowIndex < rows; rowIndex++) {
+		if (isLastBase(rowIndex - 1)) {
+			lane.deletionCosts[rowIndex] = 0;
+		}
+		lane.rowBaseScores[rowIndex] = rowBaseCase(rowIndex);
+	}
+	lane.cost = cost;
+	lane.lastColumnInsertionCost = lastColumnInsertionCost();
+}
+
+int64_t TrimmedAlignments::lastColumnInsertionCost()
+{
+	return cost;
+}
+
+int64_t TrimmedAlignments::fillByAntiDiagonals()
+/* Fills the matrix with the vectorized anti-diagonal kernel. The kernel evaluates the same recurrence
+ * as editDistance and picks the operations in the same order as backtrackOperation. */
 {
-	// Make sure the vector is empty
-	lastBaseIndices.clear();
+	kernelRowBases = clr;
+	kernelColumnBases.assign(ref.rbegin(), ref.rend());
+	std::transform(kernelRowBases.begin(), kernelRowBases.end(), kernelRowBases.begin(), ::toupper);
+	std::transform(kernelColumnBases.begin(), kernelColumnBases.end(), kernelColumnBases.begin(), ::toupper);
 
-	// Split the clr into its corrected parts
-	std::vector< std::string > trimmedClrVector = split(clr);
-	std::string trimmedClr;
+	kernelDeletionCosts.assign(rows, cost);
+	kernelRowBaseScores.assign(rows, 0);
+	for (int64_t rowIndex = 1; rowIndex < rows; rowIndex++) {
+		if (isLastBase(rowIndex - 1)) {
+			kernelDeletionCosts[rowIndex] = 0;
+		}
+		kernelRowBaseScores[rowIndex] = rowBaseCase(rowIndex);
+	}
 
-	// Record the indices of the last bases of all the reads
-	int64_t lastBaseIndex = -1;
+	AntiDiagonalProblem problem;
+	problem.rowBases = kernelRowBases.data();
+	problem.reversedColumnBases = kernelColumnBases.data();
+	problem.deletionCosts = kernelDeletionCosts.data();
+	problem.rowBaseScores = kernelRowBaseScores.data();
+	problem.rows = rows;
+	problem.columns = columns;
+	problem.cost = cost;
+	problem.lastColumnInsertionCost = lastColumnInsertionCost();
+
+	// Only anti-diagonals of at least two parts are shared, so more threads than that would wait idle
+	int64_t helpers = borrowIdleThreads( std::min(rows, columns)/antiDiagonalPartCells - 1 );
+	int64_t finalScore = fillAntiDiagonals(problem, diagonalStart, diagonalOperations, helpers + 1);
+	returnIdleThreads(helpers);
+	return finalScore;
+}
 
-	for (int64_t index = 0; index < trimmedClrVector.size(); index++) {
-		trimmedClr = trimmedClrVector.at(index);
-		lastBaseIndex = lastBaseIndex + trimmedClr.length();
-		lastBaseIndices.push_back(lastBaseIndex);	
+bool TrimmedAlignments::findAnchors()
+/* Looks up the k-mers of every segment among the k-mers that occur once in the reference. The
+ * diagonals of a segment's matches cluster around its place in the reference; matches far from their
+ * median are repeats or chance matches and are left out. */
+{
+	const int64_t k = 16;
+	auto baseCode = [](char base) -> int {
+		switch (toupper(base)) {
+			case 'A': return 0;
+			case 'C': return 1;
+			case 'G': return 2;
+			case 'T': return 3;
+			default: return -1;
+		}
+	};
+
+	// k-mers of the reference bases, 2 bits per base, with the column of their last base
+	std::vector< std::pair<uint32_t,int64_t> > refKmers;
+	uint32_t kmer = 0;
+	int64_t kmerLength = 0;
+	for (int64_t urIndex = 0; urIndex < ref.length(); urIndex++) {
+		if (ref[urIndex] == '-') {
+			continue;
+		}
+		int code = baseCode(ref[urIndex]);
+		if (code < 0) {
+			kmerLength = 0;
+			continue;
+		}
+		kmer = (kmer << 2) | code;
+		kmerLength++;
+		if (kmerLength >= k) {
+			refKmers.push_back( std::make_pair(kmer, urIndex + 1) );
+		}
+	}
+	std::sort(refKmers.begin(), refKmers.end());
+	std::vector< std::pair<uint32_t,int64_t> > uniqueKmers;
+	for (int64_t index = 0; index < refKmers.size(); index++) {
+		bool repeated = (index > 0 and refKmers[index-1].first == refKmers[index].first) or
+		                (index + 1 < refKmers.size() and refKmers[index+1].first == refKmers[index].first);
+		if (!repeated) {
+			uniqueKmers.push_back(refKmers[index]);
+		}
 	}
 
-	// Remove spaces in clr
-	clr.erase(std::remove(clr.begin(), clr.end(), ' '), clr.end());
+	segmentFirstRows.clear();
+	segmentLastRows.clear();
+	for (int64_t rowIndex = 1; rowIndex < rows; rowIndex++) {
+		if (rowFlags[rowIndex] & SegmentStartRow) {
+			segmentFirstRows.push_back(rowIndex);
+		}
+		if (rowFlags[rowIndex] & SegmentEndRow) {
+			segmentLastRows.push_back(rowIndex);
+		}
+	}
 
-	rows = clr.length() + 1;
+	int64_t segments = segmentFirstRows.size();
+	anchorLow.assign(segments, std::numeric_limits<int64_t>::max());
+	anchorHigh.assign(segments, std::numeric_limits<int64_t>::min());
+	bool anchored = false;
+	std::vector<int64_t> diagonals;
+	for (int64_t segment = 0; segment < segments; segment++) {
+		diagonals.clear();
+		kmerLength = 0;
+		for (int64_t rowIndex = segmentFirstRows[segment]; rowIndex <= segmentLastRows[segment]; rowIndex++) {
+			int code = baseCode(clr[rowIndex-1]);
+			if (code < 0) {
+				kmerLength = 0;
+				continue;
+			}
+			kmer = (kmer << 2) | code;
+			kmerLength++;
+			if (kmerLength < k) {
+				continue;
+			}
+			auto match = std::lower_bound( uniqueKmers.begin(), uniqueKmers.end(),
+			                               std::make_pair(kmer, (int64_t) 0) );
+			if (match != uniqueKmers.end() and match->first == kmer) {
+				diagonals.push_back(match->second - rowIndex);
+			}
+		}
+		if (diagonals.empty()) {
+			continue;
+		}
+		std::nth_element(diagonals.begin(), diagonals.begin() + diagonals.size()/2, diagonals.end());
+		int64_t median = diagonals[diagonals.size()/2];
+		int64_t tolerance = 32 + (segmentLastRows[segment] - segmentFirstRows[segment] + 1)/8;
+		for (int64_t diagonal : diagonals) {
+			if (std::abs(diagonal - median) <= tolerance) {
+				anchorLow[segment] = std::min(anchorLow[segment], diagonal);
+				anchorHigh[segment] = std::max(anchorHigh[segment], diagonal);
+			}
+		}
+		anchored = true;
+	}
+	return anchored;
+}
+
+void TrimmedAlignments::setAnchoredBand()
+/* Rows of a placed segment keep the cells within bandRadius columns of its anchor diagonals. Rows of a
+ * segment without anchors span from where the row above begins to where the next placed segment
+ * begins. Deletions are free after the last base of a segment, so its row is stretched to the end of
+ * the first row of the next segment; this is how the alignment moves from one segment to the next. */
+{
+	int64_t lastColumn = columns - 1;
+	int64_t segments = segmentFirstRows.size();
+	bandBegin.assign(rows, 0);
+	bandEnd.assign(rows, lastColumn);
+
+	int64_t nextEnd = lastColumn;
+	for (int64_t segment = segments - 1; segment >= 0; segment--) {
+		bool placed = anchorLow[segment] <= anchorHigh[segment];
+		for (int64_t rowIndex = segmentFirstRows[segment]; rowIndex <= segmentLastRows[segment]; rowIndex++) {
+			if (placed) {
+				bandBegin[rowIndex] = std::min( std::max(rowIndex + anchorLow[segment] - bandRadius, (int64_t) 0),
+				                                lastColumn );
+				bandEnd[rowIndex] = std::max( std::min(rowIndex + anchorHigh[segment] + bandRadius, lastColumn),
+				                              bandBegin[rowIndex] );
+			} else {
+				bandEnd[rowIndex] = nextEnd;
+			}
+		}
+		if (placed) {
+			nextEnd = bandEnd[segmentFirstRows[segment]];
+		}
+	}
+	for (int64_t segment = 0; segment < segments; segment++) {
+		if (anchorLow[segment] > anchorHigh[segment]) {
+			for (int64_t rowIndex = segmentFirstRows[segment]; rowIndex <= segmentLastRows[segment]; rowIndex++) {
+				bandBegin[rowIndex] = std::min(bandBegin[rowIndex-1], bandEnd[rowIndex]);
+			}
+		}
+	}
+
+	// Row 0 and the last row of every segment lead into the first row of the next one
+	if (rows > 1) {
+		bandEnd[0] = bandEnd[1];
+	}
+	for (int64_t segment = 0; segment < segments; segment++) {
+		int64_t lastRow = segmentLastRows[segment];
+		if (segment + 1 < segments) {
+			bandEnd[lastRow] = std::max( bandEnd[lastRow], bandEnd[segmentFirstRows[segment+1]] );
+		} else {
+			bandEnd[lastRow] = lastColumn;
+		}
+	}
+	setBandRows();
+}
+
+void TrimmedAlignments::preprocessReads()
+/* Flags the first and last bases of the trimmed segments in rowFlags, so that looking them up does not
+ * depend on the number of segments */
+{
+	rows = clr.length() - std::count(clr.begin(), clr.end(), ' ') + 1;
 	columns = ref.length() + 1;
+
+	// Segments are the runs of bases between the spaces; flag the first and last base of each
+	rowFlags.assign(rows, 0);
+	int64_t rowIndex = 0;
+	bool segmentEnded = true;
+	for (int64_t index = 0; index < clr.length(); index++) {
+		if (clr[index] == ' ') {
+			if (!segmentEnded) {
+				rowFlags[rowIndex] |= SegmentEndRow;
+			}
+			segmentEnded = true;
+			continue;
+		}
+		rowIndex++;
+		if (segmentEnded) {
+			rowFlags[rowIndex] |= SegmentStartRow;
+		}
+		segmentEnded = false;
+	}
+	if (!segmentEnded) {
+		rowFlags[rowIndex] |= SegmentEndRow;
+	}
+
+	// Remove spaces in clr
+	clr.erase(std::remove(clr.begin(), clr.end(), ' '), clr.end());
 }
 
-int64_t TrimmedAlignments::editDistance(int64_t rowIndex, int64_t columnIndex)
-/* Constructs the DP matrix for trimmed corrected long reads
+template <bool extended>
+int64_t TrimmedAlignments::trimmedScore(int64_t rowIndex, int64_t columnIndex)
+/* Constructs the DP matrix for trimmed corrected long reads. Extended reads pay fractionalCost
+ * for insertions in the last column.
  */
 {
 	int64_t substitute;
@@ -495,15 +2056,20 @@ int64_t TrimmedAlignments::editDistance(int64_t rowIndex, int64_t columnIndex)
 	bool lastBase = isLastBase(cIndex);
 
 	if (lastBase) {
-		deletion = matrix[rowIndex][columnIndex-1];
+		deletion = score(rowIndex,columnIndex-1);
 	} else {
-		deletion = matrix[rowIndex][columnIndex-1] + cost;
+		deletion = plusCost(score(rowIndex,columnIndex-1), cost);
 	}	
-	insert = matrix[rowIndex-1][columnIndex] + cost;
-	substitute = matrix[rowIndex-1][columnIndex-1] + delta(clr[cIndex], ref[urIndex]);
+	if (extended and columnIndex == columns - 1) {
+		insert = plusCost(score(rowIndex-1,columnIndex), fractionalCost);
+	} else {
+		insert = plusCost(score(rowIndex-1,columnIndex), cost);
+	}
+	substitute = plusCost(score(rowIndex-1,columnIndex-1), delta(clr[cIndex], ref[urIndex]));
 	return std::min( deletion, std::min( insert, substitute ) );
 }
 
+template <bool extended>
 void TrimmedAlignments::operationCosts(int64_t rowIndex, int64_t columnIndex, int64_t& deletion, int64_t& insert,
                                        int64_t& substitute)
 	// Set the costs of the different operations, 
@@ -519,25 +2085,27 @@ void TrimmedAlignments::operationCosts(int64_t rowIndex, int64_t columnIndex, in
 	substitute = infinity;
 
 	if (rowIndex > 0) {
-		insert = matrix[rowIndex-1][columnIndex] + cost;
+		if (extended and columnIndex == columns - 1) {
+			insert = plusCost(score(rowIndex-1,columnIndex), fractionalCost);
+		} else {
+			insert = plusCost(score(rowIndex-1,columnIndex), cost);
+		}
 	}
 	if (columnIndex > 0) {
 		if (lastBase) {
-			deletion = matrix[rowIndex][columnIndex-1];
+			deletion = score(rowIndex,columnIndex-1);
 		} else {
-			deletion = matrix[rowIndex][columnIndex-1] + cost;
+			deletion = plusCost(score(rowIndex,columnIndex-1), cost);
 		}
 	}
 	if (rowIndex > 0 and columnIndex > 0) {
-		substitute = matrix[rowIndex-1][columnIndex-1] + delta(ref[urIndex], clr[cIndex]);	
+		substitute = plusCost(score(rowIndex-1,columnIndex-1), delta(ref[urIndex], clr[cIndex]));	
 	}
 }
 
 void TrimmedAlignments::placeDeletion(int64_t cIndex, int64_t urIndex) 
 {
-	refAlignment = ref[urIndex] + refAlignment;
-	ulrAlignment = ulr[urIndex] + ulrAlignment;
-	clrAlignment = '-' + clrAlignment;
+	placeColumn(ref[urIndex], ulr[urIndex], '-');
 }
 
 void TrimmedAlignments::placeInsertion(int64_t cIndex, int64_t urIndex) 
@@ -546,20 +2114,14 @@ void TrimmedAlignments::placeInsertion(int64_t cIndex, int64_t urIndex)
 	bool firstBase = isFirstBase(cIndex);
 	// Mark the end of a trimmed long read
 	if (lastBase) {
-		refAlignment = '-' + refAlignment;
-		ulrAlignment = 'X' + ulrAlignment;
-		clrAlignment = 'X' + clrAlignment;
+		placeColumn('-', 'X', 'X');
 	}	
 
-	refAlignment = '-' + refAlignment;
-	ulrAlignment = '-' + ulrAlignment;
-	clrAlignment = clr[cIndex] + clrAlignment;
+	placeColumn('-', '-', clr[cIndex]);
 
 	// Mark the beginning of a trimmed long read
 	if (firstBase) {
-		refAlignment = '-' + refAlignment;
-		ulrAlignment = 'X' + ulrAlignment;
-		clrAlignment = 'X' + clrAlignment;
+		placeColumn('-', 'X', 'X');
 	}
 }
 
@@ -569,181 +2131,183 @@ void TrimmedAlignments::placeSubstitution(int64_t cIndex, int64_t urIndex)
 	bool firstBase = isFirstBase(cIndex);
 	// Mark the end of a trimmed long read
 	if (lastBase) {
-		refAlignment = '-' + refAlignment;
-		ulrAlignment = 'X' + ulrAlignment;
-		clrAlignment = 'X' + clrAlignment;
+		placeColumn('-', 'X', 'X');
 	}	
 
-	refAlignment = ref[urIndex] + refAlignment;
-	ulrAlignment = ulr[urIndex] + ulrAlignment;
-	clrAlignment = clr[cIndex] + clrAlignment;
+	placeColumn(ref[urIndex], ulr[urIndex], clr[cIndex]);
 
 	if (firstBase) {
-		refAlignment = '-' + refAlignment;
-		ulrAlignment = 'X' + ulrAlignment;
-		clrAlignment = 'X' + clrAlignment;
+		placeColumn('-', 'X', 'X');
 	}
 }
 
-void TrimmedAlignments::findAlignments()
-/* Construct the optimal alignments between the trimmed corrected long reads, 
- * uncorrected long read and reference sequence. These algorithm indicates the boundaries
- * of the original trimmed long reads by placing X's immediately left and right
- * of the trimmed long reads.
+template <bool extended>
+Operation TrimmedAlignments::trimmedOperation(int64_t rowIndex, int64_t columnIndex)
+/* Returns the operation that leads to the given cell of the DP matrix when backtracking.
+ * The path we follow is restricted to the conditions set when computing the matrix,
+ * i.e. we can never follow a path that the edit distance equations do not allow.
  */
 {
-	int64_t rowIndex = rows - 1;
-	int64_t columnIndex = columns - 1;
-	int64_t infinity = std::numeric_limits<int64_t>::max();
+	int64_t urIndex = columnIndex - 1;
+	int64_t cIndex = rowIndex - 1;
+	int64_t currentCost = score(rowIndex,columnIndex);
 
-	// Follow the best path from the bottom right to the top left of the matrix.
-	// This is equivalent to the optimal alignment between ulr and clr.
-	// The path we follow is restricted to the conditions set when computing the matrix,
-	// i.e. we can never follow a path that the edit distance equations do not allow.
-	while (rowIndex > 0 or columnIndex > 0) {
-		int64_t urIndex = columnIndex - 1;
-		int64_t cIndex = rowIndex - 1;
-		int64_t currentCost = matrix[rowIndex][columnIndex];
+	int64_t insert;
+	int64_t deletion;
+	int64_t substitute;
+	operationCosts<extended>(rowIndex,columnIndex,deletion,insert,substitute);
+
+	if (rowIndex == 0 or currentCost == deletion) {
+		return Deletion;
+	} else if (columnIndex == 0 or currentCost == insert) {
+		return Insertion;
+	} else if (currentCost == substitute) {
+		return Substitution;
+	} else {
+		std::cout << "ERROR: Terminating backtracking.\n";
+		std::cout << "cIndex is " << cIndex << "\n";
+		std::cout << "urIndex is " << urIndex << "\n";
+		std::exit(1);
+	}
+}
 
-		int64_t insert;
-		int64_t deletion;
-		int64_t substitute;
-		operationCosts(rowIndex,columnIndex,deletion,insert,substitute);
+int64_t TrimmedAlignments::rowScore(int64_t rowIndex)
+{
+	return rowIndex*cost;
+}
 
-		if (rowIndex == 0 or currentCost == deletion) {
-			placeDeletion(cIndex,urIndex);
-			columnIndex--;
-		} else if (columnIndex == 0 or currentCost == insert) {
-			placeInsertion(cIndex,urIndex);
-			rowIndex--;
-		} else if (currentCost == substitute) {
-			placeSubstitution(cIndex,urIndex);
-			rowIndex--;
-			columnIndex--;
-		} else {
-			std::cout << "ERROR: Terminating backtracking.\n";
-			std::cout << "cIndex is " << cIndex << "\n";
-			std::cout << "urIndex is " << urIndex << "\n";
-			std::exit(1);
-		}
-	}
+int64_t TrimmedAlignments::columnScore(int64_t columnIndex)
+{
+	return 0;
+}
+
+int64_t TrimmedAlignments::cellScore(int64_t rowIndex, int64_t columnIndex)
+{
+	return trimmedScore<false>(rowIndex,columnIndex);
+}
+
+Operation TrimmedAlignments::cellOperation(int64_t rowIndex, int64_t columnIndex)
+{
+	return trimmedOperation<false>(rowIndex,columnIndex);
+}
+
+void TrimmedAlignments::fillRows(int64_t firstRow, int64_t lastRow, bool recordOperations)
+{
+	fillRowsOf<TrimmedAlignments>(firstRow, lastRow, recordOperations);
+}
+
+void TrimmedAlignments::fillTile(int64_t firstRow, int64_t lastRow, int64_t firstColumn, int64_t lastColumn)
+{
+	fillRowsOf<TrimmedAlignments>(firstRow, lastRow, false, firstColumn, lastColumn);
+}
+
+int64_t TrimmedAlignments::editDistance(int64_t rowIndex, int64_t columnIndex)
+{
+	return cellScore(rowIndex,columnIndex);
+}
+
+Operation TrimmedAlignments::backtrackOperation(int64_t rowIndex, int64_t columnIndex)
+{
+	return cellOperation(rowIndex,columnIndex);
 }
 
 ExtendedUntrimmedAlignments::ExtendedUntrimmedAlignments() : UntrimmedAlignments() {};
 
-int64_t ExtendedUntrimmedAlignments::rowBaseCase(int64_t rowIndex)
+int64_t ExtendedUntrimmedAlignments::rowScore(int64_t rowIndex)
 {
-	int64_t infinity = std::numeric_limits<int64_t>::max();
+	return untrimmedRowScore<true>(rowIndex);
+}
 
-	int64_t cIndex = rowIndex - 1;
+int64_t ExtendedUntrimmedAlignments::cellScore(int64_t rowIndex, int64_t columnIndex)
+{
+	return untrimmedScore<true>(rowIndex,columnIndex);
+}
 
-	if ( cIndex >= 0 and islower(clr[cIndex]) ) {
-		return infinity;
-	} else {
-		return matrix[rowIndex-1][0];
-	}
-	//return 0;
+Operation ExtendedUntrimmedAlignments::cellOperation(int64_t rowIndex, int64_t columnIndex)
+{
+	return untrimmedOperation<true>(rowIndex,columnIndex);
 }
 
-int64_t ExtendedUntrimmedAlignments::levenshteinDistance(int64_t rowIndex, int64_t columnIndex)
+void ExtendedUntrimmedAlignments::fillRows(int64_t firstRow, int64_t lastRow, bool recordOperations)
 {
-	int64_t cIndex = rowIndex - 1;
-	int64_t urIndex = columnIndex - 1;
+	fillRowsOf<ExtendedUntrimmedAlignments>(firstRow, lastRow, recordOperations);
+}
 
-	int64_t insert;
-	if (columnIndex == columns - 1) {
-		insert = matrix[rowIndex-1][columnIndex];
-	} else {
-		insert = std::abs(matrix[rowIndex-1][columnIndex] + cost);
-	}
-	int64_t deletion = std::abs( matrix[rowIndex][columnIndex-1] + cost);
-	int64_t substitute = std::abs( matrix[rowIndex-1][columnIndex-1] + delta(ref[urIndex], clr[cIndex]) );
+void ExtendedUntrimmedAlignments::fillTile(int64_t firstRow, int64_t lastRow, int64_t firstColumn, int64_t lastColumn)
+{
+	fillRowsOf<ExtendedUntrimmedAlignments>(firstRow, lastRow, false, firstColumn, lastColumn);
+}
 
-	return std::min( deletion, std::min(insert, substitute) );
+int64_t ExtendedUntrimmedAlignments::rowBaseCase(int64_t rowIndex)
+{
+	return rowScore(rowIndex);
 }
 
-void ExtendedUntrimmedAlignments::operationCosts(int64_t rowIndex, int64_t columnIndex, int64_t& deletion,
-                                                 int64_t& insert, int64_t& substitute)
+int64_t ExtendedUntrimmedAlignments::editDistance(int64_t rowIndex, int64_t columnIndex)
 {
-	int64_t infinity = std::numeric_limits<int64_t>::max();
-	int64_t cIndex = rowIndex - 1;
-	int64_t urIndex = columnIndex - 1;
+	return cellScore(rowIndex,columnIndex);
+}
 
-	bool isEndingLC = checkIfEndingLowerCase(cIndex);
+Operation ExtendedUntrimmedAlignments::backtrackOperation(int64_t rowIndex, int64_t columnIndex)
+{
+	return cellOperation(rowIndex,columnIndex);
+}
 
-	if (columnIndex == columns - 1) {
-		insert = matrix[rowIndex-1][columnIndex];
-	} else {
-		insert = std::abs(matrix[rowIndex-1][columnIndex] + cost);
-	}
-	if (isEndingLC) {
-		deletion = std::abs(matrix[rowIndex][columnIndex-1] + delta(ref[urIndex], '-'));
-	} else {
-		deletion = std::abs(matrix[rowIndex][columnIndex-1] + cost);
+void ExtendedUntrimmedAlignments::describeLane(BatchLane &lane)
+/* Column 0 and insertions in the last column are free while they are reachable */
+{
+	UntrimmedAlignments::describeLane(lane);
+	for (int64_t rowIndex = 1; rowIndex < rows; rowIndex++) {
+		if (lane.rowBaseScores[rowIndex] < batchInfinity()) {
+			lane.rowBaseScores[rowIndex] = 0;
+		}
 	}
-	substitute = std::abs(matrix[rowIndex-1][columnIndex-1] + delta(ref[urIndex], clr[cIndex]));
+	lane.lastColumnInsertionCost = 0;
 }
 
 ExtendedTrimmedAlignments::ExtendedTrimmedAlignments() : TrimmedAlignments() {}
 
-int64_t ExtendedTrimmedAlignments::rowBaseCase(int64_t rowIndex)
+int64_t ExtendedTrimmedAlignments::lastColumnInsertionCost()
+{
+	return fractionalCost;
+}
+
+int64_t ExtendedTrimmedAlignments::rowScore(int64_t rowIndex)
 {
 	return rowIndex*fractionalCost;
 }
 
-int64_t ExtendedTrimmedAlignments::editDistance(int64_t rowIndex, int64_t columnIndex)
+int64_t ExtendedTrimmedAlignments::cellScore(int64_t rowIndex, int64_t columnIndex)
 {
-	int64_t substitute;
-	int64_t insert;
-	int64_t deletion;
-	int64_t cIndex = rowIndex - 1;
-	int64_t urIndex = columnIndex - 1;
-	bool lastBase = isLastBase(cIndex);
+	return trimmedScore<true>(rowIndex,columnIndex);
+}
 
-	if (lastBase) {
-		deletion = matrix[rowIndex][columnIndex-1];
-	} else {
-		deletion = std::abs(matrix[rowIndex][columnIndex-1] + cost);
-	}	
-	if (columnIndex == columns - 1) {
-		insert = std::abs(matrix[rowIndex-1][columnIndex] + fractionalCost);
-	} else {
-		insert = std::abs(matrix[rowIndex-1][columnIndex] + cost);
-	}
-	substitute = matrix[rowIndex-1][columnIndex-1] + delta(clr[cIndex], ref[urIndex]);
+Operation ExtendedTrimmedAlignments::cellOperation(int64_t rowIndex, int64_t columnIndex)
+{
+	return trimmedOperation<true>(rowIndex,columnIndex);
+}
 
-	return std::min( deletion, std::min( insert, substitute ) );
+void ExtendedTrimmedAlignments::fillRows(int64_t firstRow, int64_t lastRow, bool recordOperations)
+{
+	fillRowsOf<ExtendedTrimmedAlignments>(firstRow, lastRow, recordOperations);
 }
 
-void ExtendedTrimmedAlignments::operationCosts(int64_t rowIndex, int64_t columnIndex, int64_t& deletion,
-                                                int64_t& insert, int64_t& substitute)
-	// Set the costs of the different operations, 
-	// ensuring we don't go out of bounds of the matrix.
+void ExtendedTrimmedAlignments::fillTile(int64_t firstRow, int64_t lastRow, int64_t firstColumn, int64_t lastColumn)
 {
-	int64_t infinity = std::numeric_limits<int64_t>::max();
-	int64_t cIndex = rowIndex - 1;
-	int64_t urIndex = columnIndex - 1;
-	bool lastBase = isLastBase(cIndex);
+	fillRowsOf<ExtendedTrimmedAlignments>(firstRow, lastRow, false, firstColumn, lastColumn);
+}
 
-	deletion = infinity;
-	insert = infinity;
-	substitute = infinity;
+int64_t ExtendedTrimmedAlignments::rowBaseCase(int64_t rowIndex)
+{
+	return rowScore(rowIndex);
+}
 
-	if (rowIndex > 0) {
-		if (columnIndex == columns - 1) {
-			insert = std::abs(matrix[rowIndex-1][columnIndex] + fractionalCost);
-		} else {
-			insert = std::abs(matrix[rowIndex-1][columnIndex] + cost);
-		}
-	}
-	if (columnIndex > 0) {
-		if (lastBase) {
-			deletion = matrix[rowIndex][columnIndex-1];
-		} else {
-			deletion = std::abs(matrix[rowIndex][columnIndex-1] + cost);
-		}
-	}
-	if (rowIndex > 0 and columnIndex > 0) {
-		substitute = std::abs(matrix[rowIndex-1][columnIndex-1] + delta(ref[urIndex], clr[cIndex]));	
-	}
+int64_t ExtendedTrimmedAlignments::editDistance(int64_t rowIndex, int64_t columnIndex)
+{
+	return cellScore(rowIndex,columnIndex);
+}
+
+Operation ExtendedTrimmedAlignments::backtrackOperation(int64_t rowIndex, int64_t columnIndex)
+{
+	return cellOperation(rowIndex,columnIndex);
 }
@@ -1,16 +1,81 @@
 #ifndef ALIGNMENTS_H
 #define ALIGNMENTS_H
 
+#include <vector>
+#include <limits>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
 #include "data.hpp"
+#include "kernels.hpp"
+
+// Strategy used to fill the dynamic programming matrix
+enum EngineType {FullMatrix,Banded,Traceback,LinearSpace,AntiDiagonal,Batched,BitParallel,Segmented,Anchored,ScoreBounded};
+// Operation that leads into a cell of the DP matrix when backtracking; Failed if the cell can't be reached
+enum Operation {Failed,Deletion,Insertion,Substitution};
+// Facts about the cLR base of a row of the DP matrix, worked out once per read by preprocessReads
+enum RowFlag
+{
+	LowerCaseRow = 1,
+	// Lower case base followed by an upper case base or the end of the cLR
+	EndingLowerCaseRow = 2,
+	// First and last bases of a corrected (untrimmed) or trimmed segment
+	SegmentStartRow = 4,
+	SegmentEndRow = 8
+};
+
+class MemoryBudget
+/* Bytes that the DP structures of all threads may take together. Alignment objects reserve the
+ * footprint of each read before filling its matrix and give back what they no longer hold. */
+{
+	public:
+		MemoryBudget(int64_t bytes);
+		// Reserves the bytes if that many are left; returns false otherwise
+		bool tryReserve(int64_t bytes);
+		// Waits until the bytes are left, or until nothing is reserved if they exceed the budget,
+		// and reserves them
+		void reserve(int64_t bytes);
+		void release(int64_t bytes);
+		int64_t totalBytes();
+		int64_t reservedBytes();
+	private:
+		std::mutex mutex;
+		std::condition_variable released;
+		int64_t total;
+		int64_t reserved;
+};
 
 class Alignments
 /* Is the parent class of UntrimmedAlignments and TrimmedAlignments - for ease of maintenance. */
 {
 	public:
 		Alignments();
-		~Alignments();
+		virtual ~Alignments();
 		// Returns the ref, uLR and cLR alignments
-		Read_t align(std::string reference, std::string uRead, std::string cRead);
+		Read_t align(const std::string &reference, const std::string &uRead, const std::string &cRead);
+		// Aligns up to batchLanes() reads at once, one read per vector lane; returns the alignments in
+		// the order of the reads
+		std::vector<Read_t> alignBatch(const std::vector<Read_t> &reads);
+		// Selects how the DP matrix is filled; classes that cannot use the engine fall back to FullMatrix
+		void setEngine(EngineType engineType);
+		// Reads whose DP structures would need more than this many bytes are aligned with LinearSpace
+		void setMemoryLimit(int64_t bytes);
+		// Shares the budget with the alignment objects of other threads: every read reserves the bytes
+		// of its DP structures from it, falling back to engines that need less when they do not fit
+		void setMemoryBudget(MemoryBudget *budget);
+		// Reads whose stored DP matrix has at least minimumCells cells are filled tile by tile with the
+		// help of the threads counted in idleThreads, which are borrowed for the fill and given back
+		void setWavefront(int64_t minimumCells, std::atomic<int64_t> *idleThreads);
+		// The DP buffers only grow, so that they are allocated once for reads of similar size. With a
+		// positive number of reads, they are released once that many reads in a row have needed less
+		// than an eighth of them, so that one very long read does not hold on to its memory for good.
+		void setWorkspaceShrinking(int64_t reads);
+		// When counting, the traceback adds every column to the counts of the read and of its corrected
+		// segments instead of building the alignment strings, which are then left empty
+		void setCountingOnly(bool counting);
+		// Frees the DP buffers and gives their bytes back to the memory budget, for a thread that is about
+		// to wait for something other than memory
+		void releaseMemory();
 		void printMatrix();	
 	protected:
 		std::string clr;
@@ -19,17 +84,214 @@ class Alignments
 		std::string refAlignment;
 		std::string ulrAlignment;
 		std::string clrAlignment;
+		// Counts of the current read when counting only, and the corrected segment the traceback is in
+		bool countingOnly;
+		ReadCounts readCounts;
+		bool inCountedSegment;
+		MutationCounts segmentCounts;
                 int64_t rows;
                 int64_t columns;
-                int64_t** matrix;
-		// Costs of mutations
-		int64_t cost;
-		int64_t fractionalCost;
+		// RowFlag bits of every row; row r describes cLR base r-1 and row 0 has none
+		std::vector<uint8_t> rowFlags;
+		// DP matrix in one contiguous block. Only the cells in [bandBegin[i], bandEnd[i]] of row i are
+		// stored, row after row; cell (i,j) is at matrix[rowStart[i] + j]. Without a band every row
+		// is complete and the block is a plain row-major matrix.
+		// The block is kept between calls to align() and only grows when a larger read is seen.
+                int64_t* matrix;
+		// Number of cells the current block can hold
+		int64_t matrixCapacity;
+		std::vector<int64_t> rowStart;
+		std::vector<int64_t> bandBegin;
+		std::vector<int64_t> bandEnd;
+		// Number of cells the band layout of the current read needs
+		int64_t matrixCells;
+		// With the Traceback engine only the two most recent rows of scores are kept; the operation
+		// of every cell is recorded instead, packed four cells (2 bits each) to a byte
+		std::vector<uint8_t> operations;
+		// Rows whose operations are currently recorded
+		int64_t operationsFirstRow;
+		int64_t operationsLastRow;
+		// Rows of scores saved by the LinearSpace engine, one every checkpointInterval() rows
+		std::vector<int64_t> checkpoints;
+		// Operations recorded by the AntiDiagonal engine, 2 bits per cell, one anti-diagonal after the
+		// other; diagonalStart holds the index of the first cell of each anti-diagonal
+		std::vector<uint64_t> diagonalOperations;
+		std::vector<int64_t> diagonalStart;
+		// Operations recorded by the batched kernel for every read of the batch, row after row of the
+		// largest matrix of the batch; the current read is in lane batchLane
+		std::vector<uint32_t> batchOperations;
+		int64_t batchColumns;
+		int64_t batchLane;
+		// Lanes of the current batch; kept between batches so that their buffers are reused
+		std::vector<BatchLane> lanes;
+		EngineType engine;
+		// Engine used for the current read
+		EngineType readEngine;
+		int64_t memoryLimit;
+		// Budget shared with other threads, if any, and the bytes this object has reserved from it
+		MemoryBudget *memoryBudget;
+		int64_t budgetBytes;
+		// Half the width of the band around the diagonal when the Banded engine is used
+		int64_t bandRadius;
+		// The ScoreBounded engine only keeps the cells that score at most this much
+		int64_t scoreBound;
+		// Set during backtracking if the alignment passes through a cell on the edge of the band
+		bool bandEdgeReached;
+		// Reads in a row that needed less than an eighth of the DP buffers, the most bytes any of them
+		// needed, and how many such reads release the buffers (0 never does)
+		int64_t smallReads;
+		int64_t smallReadsBytes;
+		int64_t shrinkAfterReads;
+		// Smallest matrix filled by several threads, and the count of threads it may borrow
+		int64_t wavefrontCells;
+		std::atomic<int64_t> *idleThreads;
+		// Costs of mutations; compile-time constants so the recurrences fold them into the cell updates
+		static constexpr int64_t cost = 10;
+		static constexpr int64_t fractionalCost = 5;
 		bool alignmentSuccessful;
 
 		// Allocate and delete the dynamic programming matrix in the heap
-		void createMatrix();
+		bool createMatrix();
 		void deleteMatrix();
+		// Fills the given rows with the recurrence of the read type; every class dispatches once here to
+		// fillRowsOf with its own recurrence
+		virtual void fillRows(int64_t firstRow, int64_t lastRow, bool recordOperations);
+		// Fills the rows with the recurrence of class Recurrence, whose rowScore, columnScore, cellScore
+		// and cellOperation are called directly rather than through the vtable, so they are inlined
+		// into the loop
+		template <class Recurrence>
+		void fillRowsOf(int64_t firstRow, int64_t lastRow, bool recordOperations, int64_t firstColumn = 0,
+		                int64_t lastColumn = std::numeric_limits<int64_t>::max());
+		// Fills the cells of the rows between firstColumn and lastColumn without recording operations;
+		// classes override it with fillRowsOf like fillRows
+		virtual void fillTile(int64_t firstRow, int64_t lastRow, int64_t firstColumn, int64_t lastColumn);
+		// Fills the cells scoring at most scoreBound for the ScoreBounded engine, laying out the band of
+		// each row as it goes; returns false if the matrix block could not grow
+		bool fillWithinScore();
+		// Most cells the ScoreBounded engine keeps before the full matrix is cheaper
+		int64_t scoreBoundedCells();
+		// Fills the whole matrix in tiles with threads borrowed from idleThreads; returns false, leaving
+		// the matrix unfilled, if the matrix is too small or no thread is idle
+		bool fillByWavefront();
+		// Takes up to most of the idle threads for filling the current read's matrix, if it has at least
+		// wavefrontCells cells; returns how many were taken
+		int64_t borrowIdleThreads(int64_t most);
+		void returnIdleThreads(int64_t threads);
+		void recomputeBlock(int64_t rowIndex);
+		int64_t estimatedMatrixBytes(EngineType engineType);
+		// Switches the current read to the fastest of its engine, Traceback and LinearSpace whose DP
+		// structures fit in memoryLimit and in the memory budget, and reserves them
+		void planMemory();
+		// Makes sure the given bytes are reserved from the memory budget, giving up the buffers this
+		// object holds if that makes them fit; returns false if they still do not
+		bool reserveMemory(int64_t bytes);
+		// Keeps exactly the bytes of the buffers this object holds reserved after a read
+		void settleMemory();
+		int64_t checkpointInterval();
+		// Set the band of the rows according to the engine of the current read
+		void layoutMatrix();
+		// Make sure the matrix block can hold the given number of cells, keeping the first keptCells
+		// cells if it has to grow; returns false if allocation failed
+		bool reserveMatrix(int64_t cells, int64_t keptCells = 0);
+		// Store every cell of every row
+		void setFullBand();
+		// Store only the cells within bandRadius columns of the diagonal from (0,0) to (rows-1,columns-1)
+		void setDiagonalBand();
+		// Store every cell of the current and previous rows, reusing the storage of older rows
+		void setRollingRows();
+		// Lay the rows out one after the other with the current bandBegin and bandEnd
+		void setBandRows();
+		bool isFullBand();
+		// Bytes the DP buffers currently hold
+		int64_t workspaceBytes();
+		// Counts a read that needed the given number of bytes of DP buffers, releasing the buffers after
+		// shrinkAfterReads reads that needed much less than they hold
+		void trackWorkspace(int64_t neededBytes);
+		// Frees the DP buffers; the next read allocates them again
+		void releaseWorkspace();
+		// Returns true if the engine may restrict this class' matrix to a band around the diagonal
+		virtual bool supportsBanding();
+		// Returns true if this class can fill the current read's matrix with the vectorized
+		// anti-diagonal kernel
+		virtual bool supportsAntiDiagonal();
+		// Fills the matrix with the anti-diagonal kernel, recording the operations in
+		// diagonalOperations; returns the score of the bottom right cell
+		virtual int64_t fillByAntiDiagonals();
+		// Returns true if this class can fill the matrix of the current read with the bit-parallel kernel
+		virtual bool supportsBitParallel();
+		// Fills the matrix with the bit-parallel kernel where it applies, recording every operation
+		virtual void fillByBitVectors();
+		// Sets bandBegin and bandEnd to the cells of each row that can lie on a path from the top left
+		// to the bottom right corner for the Segmented engine; returns false if the read cannot use it
+		virtual bool findSegmentBand();
+		// Places the segments of the current read on the reference for the Anchored engine; returns
+		// false if none of them could be placed
+		virtual bool findAnchors();
+		// Store only the cells within bandRadius columns of the placed segments
+		virtual void setAnchoredBand();
+		// Returns true if this class can align the current read with the batched kernel
+		virtual bool supportsBatching();
+		// Describes the recurrence of the current read to the batched kernel
+		virtual void describeLane(BatchLane &lane);
+		// Returns true if every score of the current read fits in the 32-bit lanes of the vector kernels
+		bool fitsVectorLanes();
+		// Returns the alignments of the current read
+		Read_t alignedRead();
+		// Records whether the given cell lies on an edge of the band that is not a matrix boundary
+		void checkBandEdge(int64_t rowIndex, int64_t columnIndex);
+		// Returns the stored cell of the DP matrix at the given row and column
+		inline int64_t& cell(int64_t rowIndex, int64_t columnIndex)
+		{
+			return matrix[rowStart[rowIndex] + columnIndex];
+		}
+		// Returns the score at the given row and column; cells outside the band are infinite
+		inline int64_t score(int64_t rowIndex, int64_t columnIndex)
+		{
+			if (columnIndex < bandBegin[rowIndex] or columnIndex > bandEnd[rowIndex]) {
+				return std::numeric_limits<int64_t>::max();
+			}
+			return matrix[rowStart[rowIndex] + columnIndex];
+		}
+		inline void storeOperation(int64_t rowIndex, int64_t columnIndex, Operation operation)
+		{
+			int64_t index = (rowIndex - operationsFirstRow)*columns + columnIndex;
+			int shift = (index & 3) * 2;
+			operations[index >> 2] = (operations[index >> 2] & ~(3 << shift)) | (operation << shift);
+		}
+		inline Operation storedOperation(int64_t rowIndex, int64_t columnIndex)
+		{
+			int64_t index = (rowIndex - operationsFirstRow)*columns + columnIndex;
+			return (Operation) ((operations[index >> 2] >> ((index & 3) * 2)) & 3);
+		}
+		inline Operation batchedOperation(int64_t rowIndex, int64_t columnIndex)
+		{
+			uint32_t bits = batchOperations[rowIndex*batchColumns + columnIndex] >> batchLane;
+			return (Operation) ( (bits & 1) | ((bits >> 15) & 2) );
+		}
+		inline Operation diagonalOperation(int64_t rowIndex, int64_t columnIndex)
+		{
+			int64_t diagonal = rowIndex + columnIndex;
+			int64_t firstRow = diagonal > columns - 1 ? diagonal - (columns - 1) : 0;
+			int64_t index = diagonalStart[diagonal] + rowIndex - firstRow;
+			return (Operation) ((diagonalOperations[index >> 5] >> ((index & 31) * 2)) & 3);
+		}
+		// Adds a cost to a score; cells outside the band stay infinite rather than overflowing
+		inline int64_t plusCost(int64_t score, int64_t cost)
+		{
+			return score == std::numeric_limits<int64_t>::max() ? score : score + cost;
+		}
+		// Appends a column to the alignments, or only counts it when counting
+		inline void placeColumn(char refBase, char uBase, char cBase)
+		{
+			if (countingOnly) {
+				countPlacedColumn(refBase, uBase, cBase);
+				return;
+			}
+			refAlignment += refBase;
+			ulrAlignment += uBase;
+			clrAlignment += cBase;
+		}
+		void countPlacedColumn(char refBase, char uBase, char cBase);
 		// Cost function for dynamic programming matrix
                 int64_t delta(char refBase, char cBase);
 		// Print the matrix - debugging purposes only
@@ -42,7 +304,10 @@ class Alignments
 		virtual void placeInsertion(int64_t cIndex, int64_t urIndex);
 		virtual void placeSubstitution(int64_t cIndex, int64_t urIndex);
 
-		virtual void findAlignments();
+		// Returns the operation that leads to the given cell; needs the cell's row and the row above it
+		virtual Operation backtrackOperation(int64_t rowIndex, int64_t columnIndex);
+		// Backtrack through the matrix to find the alignments
+		void findAlignments();
 };
 
 class UntrimmedAlignments : public Alignments
@@ -52,6 +317,11 @@ class UntrimmedAlignments : public Alignments
         public:
                 UntrimmedAlignments();
 	protected:
+		// The lowercase bases pin the cLR to the uLR diagonal, so the band is a good fit
+		bool supportsBanding() override;
+		// Annotates the rows with the case and corrected segment boundaries of their cLR bases
+		void preprocessReads() override;
+		bool isLowerCase(int64_t cIndex);
 		// Returns true if the current base is an uncorrected, lower case base that precedes 
 		// a corrected, upper case base or the end of the read
 		bool checkIfEndingLowerCase(int64_t cIndex);
@@ -61,19 +331,52 @@ class UntrimmedAlignments : public Alignments
 		// Returns true if the current base in the cLR is the last base of a corrected segment;
 		// false otherwise
 		bool isEndingCorrectedIndex(int64_t cIndex);
-		virtual int64_t rowBaseCase(int64_t rowIndex) override;
+		friend class Alignments;
+		// The untrimmed recurrence; extended selects the one of extended reads at compile time
+		template <bool extended>
+		int64_t untrimmedRowScore(int64_t rowIndex);
 		// Returns the conventional levenshtein distance for alignments, sans the base case
-		virtual int64_t levenshteinDistance(int64_t rowIndex, int64_t columnIndex);
+		template <bool extended>
+		int64_t levenshteinDistance(int64_t rowIndex, int64_t columnIndex);
+		template <bool extended>
+		int64_t untrimmedScore(int64_t rowIndex, int64_t columnIndex);
+		// Returns the operations costs for insertion, deletion and substitute by reference
+		template <bool extended>
+		void operationCosts(int64_t rowIndex, int64_t columnIndex,
+		                    int64_t& deletion, int64_t& insert, int64_t& substitute);
+		template <bool extended>
+		Operation untrimmedOperation(int64_t rowIndex, int64_t columnIndex);
+		// Cell functions of this class' recurrence for fillRowsOf
+		int64_t rowScore(int64_t rowIndex);
+		int64_t columnScore(int64_t columnIndex);
+		int64_t cellScore(int64_t rowIndex, int64_t columnIndex);
+		Operation cellOperation(int64_t rowIndex, int64_t columnIndex);
+		void fillRows(int64_t firstRow, int64_t lastRow, bool recordOperations) override;
+		void fillTile(int64_t firstRow, int64_t lastRow, int64_t firstColumn, int64_t lastColumn) override;
+		int64_t rowBaseCase(int64_t rowIndex) override;
 		// Fill the dynamic programming matrix
 		int64_t editDistance(int64_t rowIndex, int64_t columnIndex) override;
-		// Returns the operations costs for insertion, deletion and substitute by reference
-		virtual void operationCosts(int64_t rowIndex, int64_t columnIndex,
-                                    int64_t& deletion, int64_t& insert, int64_t& substitute);
 		void placeDeletion(int64_t cIndex, int64_t urIndex) override;
 		void placeInsertion(int64_t cIndex, int64_t urIndex) override;
 		void placeSubstitution(int64_t cIndex, int64_t urIndex) override;
-		// Backtrack through the matrix to find the alignments
-                void findAlignments() override;
+		Operation backtrackOperation(int64_t rowIndex, int64_t columnIndex) override;
+		bool supportsBatching() override;
+		void describeLane(BatchLane &lane) override;
+		// Runs of upper case rows are plain edit distance, which the bit-parallel kernel fills; the
+		// lower case rows in between stay scalar
+		bool supportsBitParallel() override;
+		void fillByBitVectors() override;
+		// Fills the upper case rows under topRow down to lastRow with the bit-parallel kernel; returns
+		// false, leaving the rows unfilled, if the scores along topRow do not allow it
+		bool fillUnitCostBlock(int64_t topRow, int64_t lastRow);
+		// Fills a lower case row and records its operations, without going through editDistance and
+		// backtrackOperation for every cell
+		void fillLowerCaseRow(int64_t rowIndex);
+		// The lower case runs can only keep bases that match the uLR, which pins them to a few columns;
+		// the band follows them and spans the upper case segments in between
+		bool findSegmentBand() override;
+		// Returns true if the cLR base of the row matches the uLR base of the column
+		bool matchesUlr(int64_t rowIndex, int64_t columnIndex);
 };
 
 class TrimmedAlignments: public Alignments
@@ -83,19 +386,54 @@ class TrimmedAlignments: public Alignments
 		TrimmedAlignments();
 	protected:
 		int64_t columnBaseCase(int64_t columnIndex) override;
-		std::vector<int64_t> lastBaseIndices;
 		bool isLastBase(int64_t cIndex);
 		bool isFirstBase(int64_t cIndex);
 		void preprocessReads() override;
-		virtual int64_t editDistance(int64_t rowIndex, int64_t columnIndex) override;
+		friend class Alignments;
+		// The trimmed recurrence; extended selects the one of extended reads at compile time
+		template <bool extended>
+		int64_t trimmedScore(int64_t rowIndex, int64_t columnIndex);
 		// Returns the operations costs for insertion, deletion and substitute by reference
-		virtual void operationCosts(int64_t rowIndex, int64_t columnIndex,
-                                    int64_t& deletion, int64_t& insert, int64_t& substitute);
+		template <bool extended>
+		void operationCosts(int64_t rowIndex, int64_t columnIndex,
+		                    int64_t& deletion, int64_t& insert, int64_t& substitute);
+		template <bool extended>
+		Operation trimmedOperation(int64_t rowIndex, int64_t columnIndex);
+		// Cell functions of this class' recurrence for fillRowsOf
+		int64_t rowScore(int64_t rowIndex);
+		int64_t columnScore(int64_t columnIndex);
+		int64_t cellScore(int64_t rowIndex, int64_t columnIndex);
+		Operation cellOperation(int64_t rowIndex, int64_t columnIndex);
+		void fillRows(int64_t firstRow, int64_t lastRow, bool recordOperations) override;
+		void fillTile(int64_t firstRow, int64_t lastRow, int64_t firstColumn, int64_t lastColumn) override;
+		int64_t editDistance(int64_t rowIndex, int64_t columnIndex) override;
 		void placeDeletion(int64_t cIndex, int64_t urIndex) override;
 		void placeInsertion(int64_t cIndex, int64_t urIndex) override;
 		void placeSubstitution(int64_t cIndex, int64_t urIndex) override;
-		// Backtrack through the matrix to find the alignments
-                void findAlignments() override;
+		Operation backtrackOperation(int64_t rowIndex, int64_t columnIndex) override;
+		// The trimmed recurrence is the same for every cell, so it can be vectorized
+		bool supportsAntiDiagonal() override;
+		int64_t fillByAntiDiagonals() override;
+		bool supportsBatching() override;
+		void describeLane(BatchLane &lane) override;
+		// Cost of an insertion in the last column of the matrix
+		virtual int64_t lastColumnInsertionCost();
+		// Each trimmed segment is a near exact copy of a stretch of the reference, so exact k-mer
+		// matches with the reference place it; the band follows the diagonals of the matches
+		bool findAnchors() override;
+		void setAnchoredBand() override;
+		// First and last rows of every trimmed segment
+		std::vector<int64_t> segmentFirstRows;
+		std::vector<int64_t> segmentLastRows;
+		// Range of diagonals (column - row) of the anchors of every segment; segments without
+		// anchors have an empty range
+		std::vector<int64_t> anchorLow;
+		std::vector<int64_t> anchorHigh;
+		// Inputs of the anti-diagonal kernel, kept so that their buffers are reused from read to read
+		std::string kernelRowBases;
+		std::string kernelColumnBases;
+		std::vector<int32_t> kernelDeletionCosts;
+		std::vector<int32_t> kernelRowBaseScores;
 };
 
 class ExtendedUntrimmedAlignments : public UntrimmedAlignments
@@ -103,11 +441,17 @@ class ExtendedUntrimmedAlignments : public UntrimmedAlignments
 	public:
 		ExtendedUntrimmedAlignments();
 	protected: 
+		friend class Alignments;
+		// The untrimmed recurrence with free base cases and zero cost insertions at the end of reads
+		int64_t rowScore(int64_t rowIndex);
+		int64_t cellScore(int64_t rowIndex, int64_t columnIndex);
+		Operation cellOperation(int64_t rowIndex, int64_t columnIndex);
+		void fillRows(int64_t firstRow, int64_t lastRow, bool recordOperations) override;
+		void fillTile(int64_t firstRow, int64_t lastRow, int64_t firstColumn, int64_t lastColumn) override;
 		int64_t rowBaseCase(int64_t rowIndex) override;
-		// modified levenshtein distance to allow for zero cost insertions at the end of reads
-		int64_t levenshteinDistance(int64_t rowIndex, int64_t columnIndex) override;
-		void operationCosts(int64_t rowIndex, int64_t columnIndex,
-                                    int64_t& deletion, int64_t& insert, int64_t& substitute) override;
+		int64_t editDistance(int64_t rowIndex, int64_t columnIndex) override;
+		Operation backtrackOperation(int64_t rowIndex, int64_t columnIndex) override;
+		void describeLane(BatchLane &lane) override;
 };
 
 class ExtendedTrimmedAlignments : public TrimmedAlignments
@@ -115,10 +459,17 @@ class ExtendedTrimmedAlignments : public TrimmedAlignments
 	public:
 		ExtendedTrimmedAlignments();
 	protected:
+		friend class Alignments;
+		int64_t lastColumnInsertionCost() override;
+		// The trimmed recurrence with cheaper insertions in column 0 and in the last column
+		int64_t rowScore(int64_t rowIndex);
+		int64_t cellScore(int64_t rowIndex, int64_t columnIndex);
+		Operation cellOperation(int64_t rowIndex, int64_t columnIndex);
+		void fillRows(int64_t firstRow, int64_t lastRow, bool recordOperations) override;
+		void fillTile(int64_t firstRow, int64_t lastRow, int64_t firstColumn, int64_t lastColumn) override;
 		int64_t rowBaseCase(int64_t rowIndex) override;
 		int64_t editDistance(int64_t rowIndex, int64_t columnIndex) override;
-		void operationCosts(int64_t rowIndex, int64_t columnIndex,
-                                    int64_t& deletion, int64_t& insert, int64_t& substitute) override;
+		Operation backtrackOperation(int64_t rowIndex, int64_t columnIndex) override;
 };
 
 #endif // ALIGNMENTS_H
@@ -0,0 +1,262 @@
+#include <iostream>
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <unistd.h>
+#include "compression.hpp"
+
+// The empty block that ends a BGZF file
+static const char bgzfEndOfFile[] = "\x1f\x8b\x08\x04\0\0\0\0\0\xff\x06\0BC\x02\0\x1b\0\x03\0\0\0\0\0\0\0\0\0";
+static const int64_t bgzfEndOfFileLength = 28;
+
+static int64_t readLittleEndian(const char *bytes, int length)
+/* Reads an unsigned number of length bytes stored least significant byte first, as gzip stores them */
+{
+	int64_t number = 0;
+	for (int index = length - 1; index >= 0; index--) {
+		number = (number << 8) | (unsigned char) bytes[index];
+	}
+	return number;
+}
+
+static void storeLittleEndian(int64_t number, int length, char *bytes)
+/* Stores an unsigned number in length bytes, least significant byte first */
+{
+	for (int index = 0; index < length; index++) {
+		bytes[index] = (char) ((number >> (8*index)) & 0xff);
+	}
+}
+
+CompressionType compressionType(const char *begin, const char *end)
+{
+	if (end - begin < 2 or (unsigned char) begin[0] != 0x1f or (unsigned char) begin[1] != 0x8b) {
+		return Uncompressed;
+	}
+	return bgzfBlockLength(begin, end) > 0 ? Bgzf : Gzip;
+}
+
+int64_t bgzfBlockLength(const char *block, const char *end)
+/* A BGZF block is a gzip member with the extra field flag set and a "BC" subfield that holds the length
+ * of the whole block minus one */
+{
+	if (end - block < 18 or (unsigned char) block[0] != 0x1f or (unsigned char) block[1] != 0x8b
+	    or block[2] != 8 or (block[3] & 4) == 0) {
+		return 0;
+	}
+	int64_t extraLength = readLittleEndian(block + 10, 2);
+	const char *field = block + 12;
+	const char *extraEnd = field + std::min(extraLength, (int64_t) (end - field));
+	while (extraEnd - field >= 4) {
+		int64_t fieldLength = readLittleEndian(field + 2, 2);
+		if (field[0] == 'B' and field[1] == 'C' and fieldLength == 2 and extraEnd - field >= 6) {
+			int64_t blockLength = readLittleEndian(field + 4, 2) + 1;
+			if (blockLength < 12 + extraLength + 8 or blockLength > end - block) {
+				return 0;
+			}
+			return blockLength;
+		}
+		field += 4 + fieldLength;
+	}
+	return 0;
+}
+
+int64_t bgzfTextLength(const char *block, int64_t blockLength)
+{
+	return readLittleEndian(block + blockLength - 4, 4);
+}
+
+bool inflateBgzfBlock(z_stream &stream, const char *block, int64_t blockLength, char *text)
+{
+	int64_t extraLength = readLittleEndian(block + 10, 2);
+	int64_t textLength = bgzfTextLength(block, blockLength);
+	// Such as the empty block that marks the end of a BGZF file
+	if (textLength == 0) {
+		return true;
+	}
+	if (inflateReset(&stream) != Z_OK) {
+		return false;
+	}
+	stream.next_in = (Bytef*) (block + 12 + extraLength);
+	stream.avail_in = blockLength - 12 - extraLength - 8;
+	stream.next_out = (Bytef*) text;
+	stream.avail_out = textLength;
+	if (inflate(&stream, Z_FINISH) != Z_STREAM_END or stream.avail_out != 0) {
+		return false;
+	}
+	return crc32(0L, (Bytef*) text, textLength) == readLittleEndian(block + blockLength - 8, 4);
+}
+
+void deflateBgzfBlock(z_stream &stream, const char *text, int64_t length, std::string &block)
+/* The header is the one bgzip writes: a gzip member header whose extra field holds the "BC" subfield with
+ * the length of the block. */
+{
+	assert( length <= bgzfBlockText );
+	int64_t start = block.size();
+	int64_t deflatedBound = deflateBound(&stream, length);
+	block.resize(start + 18 + deflatedBound + 8);
+	char *header = &block[start];
+
+	deflateReset(&stream);
+	stream.next_in = (Bytef*) text;
+	stream.avail_in = length;
+	stream.next_out = (Bytef*) (header + 18);
+	stream.avail_out = deflatedBound;
+	int status = deflate(&stream, Z_FINISH);
+	assert( status == Z_STREAM_END );
+	int64_t blockLength = 18 + stream.total_out + 8;
+	assert( blockLength <= 1 << 16 );
+
+	const char headerStart[] = "\x1f\x8b\x08\x04\0\0\0\0\0\xff\x06\0BC\x02\0";
+	std::copy(headerStart, headerStart + 16, header);
+	storeLittleEndian(blockLength - 1, 2, header + 16);
+	storeLittleEndian(crc32(0L, (Bytef*) text, length), 4, header + blockLength - 8);
+	storeLittleEndian(length, 4, header + blockLength - 4);
+	block.resize(start + blockLength);
+}
+
+GzipInflater::GzipInflater(const char *begin, const char *end) : position(begin), end(end), done(begin == end)
+{
+	stream.zalloc = Z_NULL;
+	stream.zfree = Z_NULL;
+	stream.opaque = Z_NULL;
+	stream.next_in = Z_NULL;
+	stream.avail_in = 0;
+	// Accepts gzip headers only
+	inflateInit2(&stream, 15 + 16);
+}
+
+GzipInflater::~GzipInflater()
+{
+	inflateEnd(&stream);
+}
+
+bool GzipInflater::inflatePart(std::string &text, int64_t length)
+{
+	int64_t start = text.size();
+	text.resize(start + length);
+	stream.next_out = (Bytef*) &text[start];
+	stream.avail_out = length;
+	bool intact = true;
+	while (stream.avail_out > 0 and not done) {
+		if (stream.avail_in == 0) {
+			// avail_in only holds 32 bits, so larger files are fed to zlib in pieces
+			int64_t piece = std::min((int64_t) (end - position), (int64_t) 1 << 30);
+			stream.next_in = (Bytef*) position;
+			stream.avail_in = piece;
+			position += piece;
+		}
+		int status = inflate(&stream, Z_NO_FLUSH);
+		if (status == Z_STREAM_END) {
+			// Another member may follow, as in files that were concatenated
+			if (stream.avail_in == 0 and position == end) {
+				done = true;
+			} else {
+				inflateReset(&stream);
+			}
+		} else if (status != Z_OK) {
+			// Z_BUF_ERROR here means that the file ends in the middle of a member
+			intact = false;
+			break;
+		}
+	}
+	text.resize(start + length - stream.avail_out);
+	return intact;
+}
+
+bool GzipInflater::finished()
+{
+	return done;
+}
+
+BgzfWriter::BgzfWriter(int fileDescriptor, std::string indexName, int64_t threads)
+	: fileDescriptor(fileDescriptor), index(indexName, std::ios::out), nextPiece(0), fileOffset(0), failed(false),
+	  pieces(2*std::max(threads, (int64_t) 1)), deflatedPieces(2*std::max(threads, (int64_t) 1), std::max(threads, (int64_t) 1))
+{
+	if (!index.is_open()) {
+		std::cerr << "Unable to create index file " << indexName << ".\n";
+	}
+	for (int64_t i = 0; i < std::max(threads, (int64_t) 1); i++) {
+		deflaters.push_back( std::thread(&BgzfWriter::deflatePieces, this) );
+	}
+	writer = std::thread(&BgzfWriter::writePieces, this);
+}
+
+BgzfWriter::~BgzfWriter()
+{
+	pieces.close();
+	for (std::thread &deflater : deflaters) {
+		deflater.join();
+	}
+	writer.join();
+	writeFully(bgzfEndOfFile, bgzfEndOfFileLength);
+	index.close();
+}
+
+void BgzfWriter::write(std::vector<char> text, std::vector<BgzfMark> marks)
+/* Waits while the deflating threads are too far behind */
+{
+	Piece piece;
+	piece.index = nextPiece++;
+	piece.text = std::move(text);
+	piece.marks = std::move(marks);
+	pieces.push( std::move(piece) );
+}
+
+void BgzfWriter::deflatePieces()
+/* Deflates pieces into blocks until there are no more */
+{
+	z_stream stream;
+	stream.zalloc = Z_NULL;
+	stream.zfree = Z_NULL;
+	stream.opaque = Z_NULL;
+	deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY);
+	Piece piece;
+	while (pieces.pop(piece)) {
+		for (int64_t start = 0; start < piece.text.size(); start += bgzfBlockText) {
+			int64_t length = std::min(bgzfBlockText, (int64_t) piece.text.size() - start);
+			int64_t blocksLength = piece.blocks.size();
+			deflateBgzfBlock(stream, piece.text.data() + start, length, piece.blocks);
+			piece.blockLengths.push_back(piece.blocks.size() - blocksLength);
+		}
+		std::vector<char>().swap(piece.text);
+		deflatedPieces.put( piece.index, std::move(piece) );
+		piece = Piece();
+	}
+	deflateEnd(&stream);
+	deflatedPieces.producerDone();
+}
+
+void BgzfWriter::writePieces()
+/* Writes out the deflated pieces in order, and the virtual offsets of their marks */
+{
+	Piece piece;
+	while (deflatedPieces.take(piece)) {
+		std::vector<int64_t> blockOffsets (1, fileOffset);
+		for (int64_t blockLength : piece.blockLengths) {
+			blockOffsets.push_back(blockOffsets.back() + blockLength);
+		}
+		for (const BgzfMark &mark : piece.marks) {
+			int64_t block = mark.offset / bgzfBlockText;
+			index << mark.name << " " << ((blockOffsets.at(block) << 16) | (mark.offset % bgzfBlockText)) << "\n";
+		}
+		writeFully(piece.blocks.data(), piece.blocks.size());
+		fileOffset += piece.blocks.size();
+	}
+}
+
+void BgzfWriter::writeFully(const char *data, int64_t length)
+{
+	while (fileDescriptor >= 0 and not failed and length > 0) {
+		ssize_t written = ::write(fileDescriptor, data, length);
+		if (written < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			std::cerr << "Failed to write BGZF file.\n";
+			failed = true;
+			break;
+		}
+		data += written;
+		length -= written;
+	}
+}
@@ -0,0 +1,103 @@
+#ifndef COMPRESSION_H
+#define COMPRESSION_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <thread>
+#include <zlib.h>
+#include "queues.hpp"
+
+// BGZF is the blocked gzip of samtools: a series of gzip members of at most 64 KB each, whose length is
+// kept in their header, so that they can be found and inflated independently
+enum CompressionType {Uncompressed, Gzip, Bgzf};
+
+// Most text in a BGZF block, as bgzip cuts it; deflated, it fits in a block whatever it holds
+const int64_t bgzfBlockText = 0xff00;
+
+CompressionType compressionType(const char *begin, const char *end);
+/* Tells plain text, gzip and BGZF apart by the header of the first gzip member */
+
+int64_t bgzfBlockLength(const char *block, const char *end);
+/* Returns the length of the BGZF block at block, or 0 if there is no whole BGZF block there */
+
+int64_t bgzfTextLength(const char *block, int64_t blockLength);
+/* Returns the length of the text of a BGZF block once inflated */
+
+bool inflateBgzfBlock(z_stream &stream, const char *block, int64_t blockLength, char *text);
+/* Inflates a BGZF block into text, which has room for its text length, and checks its CRC. The stream is
+ * set up for raw deflate data by inflateInit2(&stream, -MAX_WBITS) and is reused from block to block.
+ * Returns false if the block is corrupt. */
+
+void deflateBgzfBlock(z_stream &stream, const char *text, int64_t length, std::string &block);
+/* Appends a BGZF block holding length bytes of text, at most bgzfBlockText, to block. The stream is set up
+ * for raw deflate data by deflateInit2 with -MAX_WBITS as its window bits and is reused from block to
+ * block. */
+
+class GzipInflater
+/* Inflates a gzip file of one or more members, one part at a time */
+{
+	public:
+		GzipInflater(const char *begin, const char *end);
+		~GzipInflater();
+		GzipInflater(const GzipInflater&) = delete;
+		GzipInflater& operator=(const GzipInflater&) = delete;
+		// Appends up to length bytes of text; returns false if the data is corrupt or cut short
+		bool inflatePart(std::string &text, int64_t length);
+		// Returns true once the whole file is inflated
+		bool finished();
+	private:
+		z_stream stream;
+		const char *position;
+		const char *end;
+		bool done;
+};
+
+struct BgzfMark
+/* A position in the text handed to a BgzfWriter, under the name it is looked up by */
+{
+	std::string name;
+	int64_t offset;
+};
+
+class BgzfWriter
+/* Writes text to an open file as BGZF. The text is handed over in pieces, which threads cut into blocks
+ * and deflate while the next pieces come in; another thread writes them out in order. The marks of each
+ * piece go to an index file, one line per mark with its name and BGZF virtual offset: the offset of its
+ * block in the file shifted left by 16 bits, plus its offset in the text of the block.
+ */
+{
+	public:
+		BgzfWriter(int fileDescriptor, std::string indexName, int64_t threads);
+		// Writes out the pieces still being deflated and the empty block that ends a BGZF file
+		~BgzfWriter();
+		BgzfWriter(const BgzfWriter&) = delete;
+		BgzfWriter& operator=(const BgzfWriter&) = delete;
+		// Hands over the next piece of text, with the marks that lie in it, offset from its start
+		void write(std::vector<char> text, std::vector<BgzfMark> marks);
+	private:
+		struct Piece
+		{
+			int64_t index;
+			std::vector<char> text;
+			std::vector<BgzfMark> marks;
+			std::string blocks;
+			std::vector<int64_t> blockLengths;
+		};
+		int fileDescriptor;
+		std::ofstream index;
+		int64_t nextPiece;
+		// Offset in the file of the next piece
+		int64_t fileOffset;
+		bool failed;
+		BoundedQueue<Piece> pieces;
+		ReorderBuffer<Piece> deflatedPieces;
+		std::vector<std::thread> deflaters;
+		std::thread writer;
+		void deflatePieces();
+		void writePieces();
+		void writeFully(const char *data, int64_t length);
+};
+
+#endif // COMPRESSION_H
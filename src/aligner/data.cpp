@@ -4,6 +4,15 @@
 #include <fstream>
 #include <vector>
 #include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <cstring>
+#include <cstdlib>
 #include "data.hpp"
 
 std::vector<std::string> split(const std::string &s)
@@ -23,88 +32,567 @@ std::vector<std::string> split(const std::string &s)
 	return elems;
 }
 
-int64_t gaplessLength(std::string read) 
+int64_t gaplessLength(const std::string &read) 
 /* Returns the gapless length of MAF formatted reads */
 {
-	read.erase(std::remove(read.begin(), read.end(), '-'), read.end());
-	read.erase(std::remove(read.begin(), read.end(), 'X'), read.end());
-	return read.length(); 
+	return read.length() - std::count(read.begin(), read.end(), '-') - std::count(read.begin(), read.end(), 'X'); 
 }
 
-int64_t boundarylessLength(std::string read)
+int64_t boundarylessLength(const std::string &read)
 /* Returns the length of MAF formatted reads without the 'X' boundaries */
 {
-	read.erase(std::remove(read.begin(), read.end(), 'X'), read.end());
-	return read.length(); 
+	return read.length() - std::count(read.begin(), read.end(), 'X'); 
 }
 
-MafFile::MafFile(std::string fileName)
-/* Constructor - holds the MAF file name */
+void splitView(StringView line, std::vector<StringView> &fields)
+/* Splits a line at its spaces like split(), without copying it; fields is reused from line to line. */
+{
+	fields.clear();
+	const char *position = line.data;
+	const char *end = line.data + line.length;
+	while (position < end) {
+		const char *space = (const char*) memchr(position, ' ', end - position);
+		if (space == NULL) {
+			space = end;
+		}
+		if (space > position) {
+			fields.push_back( StringView {position, space - position} );
+		}
+		position = space + 1;
+	}
+}
+
+MappedFile::MappedFile(std::string fileName)
+{
+	mapping = NULL;
+	size = 0;
+	fileDescriptor = open(fileName.c_str(), O_RDONLY);
+	struct stat status;
+	if (fileDescriptor < 0 or fstat(fileDescriptor, &status) != 0) {
+		return;
+	}
+	size = status.st_size;
+	// An empty file cannot be mapped, and has nothing to parse
+	if (size > 0) {
+		void *address = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fileDescriptor, 0);
+		if (address == MAP_FAILED) {
+			close(fileDescriptor);
+			fileDescriptor = -1;
+			size = 0;
+			return;
+		}
+		mapping = (char*) address;
+		// The parsers go through the file once, front to back
+		madvise(mapping, size, MADV_SEQUENTIAL);
+	}
+}
+
+MappedFile::~MappedFile()
+{
+	if (mapping != NULL) {
+		munmap(mapping, size);
+	}
+	if (fileDescriptor >= 0) {
+		close(fileDescriptor);
+	}
+}
+
+bool MappedFile::isOpen()
+{
+	return fileDescriptor >= 0;
+}
+
+const char* MappedFile::begin()
+{
+	return mapping;
+}
+
+const char* MappedFile::end()
+{
+	return mapping + size;
+}
+
+LineScanner::LineScanner(const char *begin, const char *end) : position(begin), end(end)
+{
+}
+
+bool LineScanner::nextLine(StringView &line)
+{
+	if (position >= end) {
+		line = StringView {end, 0};
+		return false;
+	}
+	const char *newline = (const char*) memchr(position, '\n', end - position);
+	if (newline == NULL) {
+		newline = end;
+	}
+	line = StringView {position, newline - position};
+	position = newline + 1;
+	return true;
+}
+
+static const char* nextMarkedLine(const char *position, const char *begin, const char *end, char marker)
+/* Returns the first line at or after position that begins with marker, or end if there is none */
+{
+	if (position > begin and position[-1] != '\n') {
+		const char *newline = (const char*) memchr(position, '\n', end - position);
+		position = newline == NULL ? end : newline + 1;
+	}
+	while (position < end and *position != marker) {
+		const char *newline = (const char*) memchr(position, '\n', end - position);
+		position = newline == NULL ? end : newline + 1;
+	}
+	return position;
+}
+
+static const char* lastMarkedLine(const char *begin, const char *end, char marker)
+/* Returns the last line after begin that begins with marker, or begin if there is none */
+{
+	const char *position = end;
+	while (position > begin) {
+		const char *newline = (const char*) memrchr(begin, '\n', position - begin);
+		if (newline == NULL) {
+			break;
+		}
+		if (newline + 1 < end and newline[1] == marker) {
+			return newline + 1;
+		}
+		position = newline;
+	}
+	return begin;
+}
+
+std::vector<const char*> splitRecords(const char *begin, const char *end, int64_t partBytes, char marker)
+/* A part ends where the first record after its partBytes bytes begins, so parts of long records are
+ * longer than partBytes. */
+{
+	std::vector<const char*> boundaries;
+	const char *position = nextMarkedLine(begin, begin, end, marker);
+	boundaries.push_back(position);
+	while (position < end) {
+		int64_t partLength = std::min(std::max(partBytes, (int64_t) 1), (int64_t) (end - position));
+		position = nextMarkedLine(position + partLength, begin, end, marker);
+		boundaries.push_back(position);
+	}
+	return boundaries;
+}
+
+static bool nextMafRead(LineScanner &mafLines, std::vector<StringView> &fields, Read_t &read)
+/* Copies the ref and uLR lines of the next block of a two-way MAF file into read; the line read in the
+ * condition skips the "a" line of the block. */
+{
+	StringView mafLine;
+
+	if (!mafLines.nextLine(mafLine)) {
+		return false;
+	}
+	// Read ref line
+	mafLines.nextLine(mafLine);
+	splitView(mafLine, fields);
+
+	assert( fields.size() == 7 );
+
+	read.ref = fields.at(6).toString();
+	read.readInfo.refOrient = fields.at(4).toString();
+	read.readInfo.start = fields.at(2).toString();
+	read.readInfo.srcSize = fields.at(5).toString();
+
+	// Read ulr line
+	mafLines.nextLine(mafLine);
+	splitView(mafLine, fields);
+
+	assert( fields.size() == 7 );
+
+	read.ulr = fields.at(6).toString();
+	read.readInfo.name = fields.at(1).toString();
+	read.readInfo.readOrient = fields.at(4).toString();
+
+	//Skip line 
+	mafLines.nextLine(mafLine);
+	return true;
+}
+
+TextInput::TextInput(std::string fileName, char marker, int64_t partBytes, int64_t threads)
+	: fileName(fileName), file(fileName), marker(marker), partBytes(std::max(partBytes, (int64_t) 1)),
+	  partIndex(0), nextPiece(0), stopping(false)
+{
+	compression = compressionType(file.begin(), file.end());
+	nextBlock = file.begin();
+	if (compression == Uncompressed) {
+		boundaries = splitRecords(file.begin(), file.end(), partBytes, marker);
+		return;
+	}
+	// The members of a gzip file are inflated in turn; BGZF blocks by several threads at once
+	int64_t inflaterCount = compression == Bgzf ? std::max(threads, (int64_t) 1) : 1;
+	inflatedPieces.reset( new ReorderBuffer<std::string>(inflaterCount + 1, inflaterCount) );
+	for (int64_t i = 0; i < inflaterCount; i++) {
+		if (compression == Bgzf) {
+			inflaters.push_back( std::thread(&TextInput::inflateBgzf, this) );
+		} else {
+			inflaters.push_back( std::thread(&TextInput::inflateGzip, this) );
+		}
+	}
+}
+
+TextInput::~TextInput()
+/* The inflating threads may be waiting for the reader to take their pieces, when it stopped before the end
+ * of the file */
+{
+	stopping = true;
+	if (inflatedPieces) {
+		std::string piece;
+		while (inflatedPieces->take(piece)) {
+		}
+	}
+	for (std::thread &inflater : inflaters) {
+		inflater.join();
+	}
+}
+
+bool TextInput::isOpen()
+{
+	return file.isOpen();
+}
+
+bool TextInput::nextPart(TextPart &part)
+{
+	std::lock_guard<std::mutex> lock (partMutex);
+	if (compression != Uncompressed) {
+		return nextInflatedPart(part);
+	}
+	if (partIndex + 1 >= boundaries.size()) {
+		return false;
+	}
+	part.index = partIndex;
+	part.begin = boundaries.at(partIndex);
+	part.end = boundaries.at(partIndex + 1);
+	part.text.reset();
+	partIndex++;
+	return true;
+}
+
+bool TextInput::nextInflatedPart(TextPart &part)
+/* Adds the next inflated piece to the text carried over, and hands out the text up to its last record
+ * start; a record longer than a piece is carried over until the start of another one comes in. */
+{
+	std::string piece;
+	while (true) {
+		bool atEnd = !inflatedPieces->take(piece);
+		if (atEnd and carried.empty()) {
+			return false;
+		}
+		std::shared_ptr<std::string> text (new std::string);
+		text->swap(carried);
+		if (!atEnd) {
+			text->append(piece);
+		}
+		const char *begin = nextMarkedLine(text->data(), text->data(), text->data() + text->size(), marker);
+		const char *end = text->data() + text->size();
+		if (!atEnd) {
+			const char *last = lastMarkedLine(begin, end, marker);
+			if (last == begin) {
+				text->swap(carried);
+				continue;
+			}
+			carried.assign(last, end);
+			end = last;
+		}
+		if (begin == end) {
+			return false;
+		}
+		part.index = partIndex++;
+		part.begin = begin;
+		part.end = end;
+		part.text = text;
+		return true;
+	}
+}
+
+void TextInput::inflateBgzf()
+/* Takes runs of BGZF blocks that hold about partBytes bytes of text, in file order, and inflates them */
+{
+	z_stream stream;
+	stream.zalloc = Z_NULL;
+	stream.zfree = Z_NULL;
+	stream.opaque = Z_NULL;
+	stream.next_in = Z_NULL;
+	stream.avail_in = 0;
+	inflateInit2(&stream, -MAX_WBITS);
+	while (true) {
+		int64_t piece;
+		const char *begin;
+		const char *end;
+		int64_t textLength = 0;
+		{
+			std::lock_guard<std::mutex> lock (blockMutex);
+			if (stopping or nextBlock == file.end()) {
+				break;
+			}
+			piece = nextPiece++;
+			begin = nextBlock;
+			while (nextBlock < file.end() and textLength < partBytes) {
+				int64_t blockLength = bgzfBlockLength(nextBlock, file.end());
+				if (blockLength == 0) {
+					inflateFailed();
+				}
+				textLength += bgzfTextLength(nextBlock, blockLength);
+				nextBlock += blockLength;
+			}
+			end = nextBlock;
+		}
+		std::string text (textLength, '\0');
+		char *output = &text[0];
+		for (const char *block = begin; block < end; ) {
+			int64_t blockLength = bgzfBlockLength(block, end);
+			if (!inflateBgzfBlock(stream, block, blockLength, output)) {
+				inflateFailed();
+			}
+			output += bgzfTextLength(block, blockLength);
+			block += blockLength;
+		}
+		inflatedPieces->put( piece, std::move(text) );
+	}
+	inflateEnd(&stream);
+	inflatedPieces->producerDone();
+}
+
+void TextInput::inflateGzip()
+/* Inflates a gzip file a piece of partBytes bytes of text at a time */
+{
+	GzipInflater inflater (file.begin(), file.end());
+	for (int64_t piece = 0; not stopping and not inflater.finished(); piece++) {
+		std::string text;
+		if (!inflater.inflatePart(text, partBytes)) {
+			inflateFailed();
+		}
+		inflatedPieces->put( piece, std::move(text) );
+	}
+	inflatedPieces->producerDone();
+}
+
+void TextInput::inflateFailed()
+/* The reads of a corrupt file cannot be told apart from its damage, so nothing more is read */
+{
+	std::cerr << "Unable to decompress " << fileName << "; the file is corrupt or cut short.\n";
+	std::exit(1);
+}
+
+void parseMafPart(const TextPart &part, std::vector<Read_t> &reads)
+{
+	LineScanner mafLines (part.begin, part.end);
+	std::vector<StringView> fields;
+	reads.push_back( Read_t() );
+	while (nextMafRead(mafLines, fields, reads.back())) {
+		reads.push_back( Read_t() );
+	}
+	reads.pop_back();
+}
+
+void parseClrPart(const TextPart &part, std::vector<std::string> &clrs)
+/* The line read in the condition skips the header line of the FASTA record. */
+{
+	LineScanner clrLines (part.begin, part.end);
+	StringView clrLine;
+	while (clrLines.nextLine(clrLine)) {
+		clrLines.nextLine(clrLine);
+		clrs.push_back( clrLine.toString() );
+	}
+}
+
+MafFile::MafFile(std::string fileName, int64_t compressionThreads)
+/* Constructor - opens the file and writes the header */
 {
 	filename = fileName;
-	std::ofstream file (filename, std::ios::out | std::ios::trunc);
+	bufferedBytes = 0;
+	bufferLimit = compressionThreads > 0 ? compressedPieceCapacity : bufferCapacity;
+	buffer.resize(bufferLimit);
+	fileDescriptor = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
 	
 	// Write the header in the file upon first opening
-	if (file.is_open()) {
-		file << "track name=" << filename << "\n";	
-		file << "##maf version=1\n";
-		file << "# tba.v8\n";
-		file << "\n";
-		file.close();
+	if (fileDescriptor >= 0) {
+		if (compressionThreads > 0) {
+			bgzfWriter.reset( new BgzfWriter(fileDescriptor, filename + ".idx", compressionThreads) );
+		}
+		append("track name=");
+		append(filename);
+		append("\n##maf version=1\n# tba.v8\n\n");
 	} else {
 		std::cerr << "Unable to create MAF file.\n";
 	}
 }
 
-void MafFile::addReads(Read_t reads)
-/* Reads data from alignment and readInfo objects and writes to file in MAF format 
+MafFile::~MafFile()
+{
+	flush();
+	// Waits for the compression threads to write everything out
+	bgzfWriter.reset();
+	if (fileDescriptor >= 0) {
+		close(fileDescriptor);
+	}
+}
+
+void MafFile::addReads(const Read_t &reads)
+/* Formats the alignments and readInfo of the reads into the buffer in MAF format 
  * as described in https://genome.ucsc.edu/FAQ/FAQformat.html */
 {
-	std::string ref = reads.ref;
-	std::string ulr = reads.ulr;
-	std::string clr = reads.clr;
-	ReadInfo readInfo = reads.readInfo;
-	bool alignmentSuccessful = reads.alignmentSuccessful;
-
-	std::string refName = "ref"; 
-	std::string uName = readInfo.name + ".uLR";
-	std::string cName = readInfo.name + ".cLR";
-
-	// The position in the original genome from which the read originates.
-	// The start position in PacBio reads are 0 since the the read is considered
-	// to be the "original" genome.
-	std::string refStart = readInfo.start;
-	int64_t uStart = 0;
-	int64_t cStart = 0;
- 
-	// Read size, sans gaps
-	int64_t refSize = gaplessLength(ref);
-	int64_t uSize = gaplessLength(ulr);
-	int64_t cSize = gaplessLength(clr);
-
-	// The original size of the source genome. Since PacBio reads are the
-	// "original" genome, the source size is simply the size of the read.
-	std::string refSrcSize = readInfo.srcSize;
-	int64_t uSrcSize = uSize;
-	int64_t cSrcSize = cSize;
-
-	std::string refOrient = readInfo.refOrient;
-	std::string readOrient = readInfo.readOrient;
-
-	std::ofstream file (filename, std::ios::out | std::ios::app);
-
-	if (file.is_open() and alignmentSuccessful) {
-		file << "a\n";
-		file << "s " << refName << " " << refStart << " " << refSize << " " << refOrient << " " 
-			<< refSrcSize << " " << ref << "\n";
-		file << "s " << uName << " " << uStart << " " << uSize << " " << readOrient << " " << uSrcSize << " " << ulr << "\n";
-		file << "s " << cName << " " << cStart << " " << cSize << " " << readOrient << " " << cSrcSize << " " << clr << "\n";
-		file << "\n";
-	} else if ( not alignmentSuccessful ) {
+	const ReadInfo &readInfo = reads.readInfo;
+
+	if (not reads.alignmentSuccessful) {
 		std::cout << "Failed to align read " << readInfo.name << ".\n";
-	} else {
+		return;
+	} else if (fileDescriptor < 0) {
 		std::cerr << "Failed to open MAF file.\n";
+		return;
 	}
 
-	file.close();
+	// Read size, sans gaps. The PacBio reads are the "original" genome, so they start at 0 and their
+	// source size is their size.
+	int64_t uSize = gaplessLength(reads.ulr);
+	int64_t cSize = gaplessLength(reads.clr);
+
+	if (bgzfWriter) {
+		marks.push_back( BgzfMark {readInfo.name, bufferedBytes} );
+	}
+	append("a\ns ref ");
+	append(readInfo.start);
+	append(' ');
+	appendNumber( gaplessLength(reads.ref) );
+	append(' ');
+	append(readInfo.refOrient);
+	append(' ');
+	append(readInfo.srcSize);
+	append(' ');
+	append(reads.ref);
+
+	append("\ns ");
+	append(readInfo.name);
+	append(".uLR 0 ");
+	appendNumber(uSize);
+	append(' ');
+	append(readInfo.readOrient);
+	append(' ');
+	appendNumber(uSize);
+	append(' ');
+	append(reads.ulr);
+
+	append("\ns ");
+	append(readInfo.name);
+	append(".cLR 0 ");
+	appendNumber(cSize);
+	append(' ');
+	append(readInfo.readOrient);
+	append(' ');
+	appendNumber(cSize);
+	append(' ');
+	append(reads.clr);
+	append("\n\n");
+}
+
+void MafFile::flush()
+{
+	if (bgzfWriter) {
+		compressBuffer();
+		return;
+	}
+	writeOut(NULL, 0);
+}
+
+void MafFile::compressBuffer()
+{
+	if (bufferedBytes == 0) {
+		return;
+	}
+	buffer.resize(bufferedBytes);
+	bgzfWriter->write( std::move(buffer), std::move(marks) );
+	buffer = std::vector<char> (bufferLimit);
+	marks.clear();
+	bufferedBytes = 0;
+}
+
+void MafFile::append(const char *data, int64_t length)
+/* A compressed file takes the data through the buffer, a full buffer at a time, so that every read starts
+ * in the buffer it is marked in. */
+{
+	if (bgzfWriter) {
+		while (length > 0) {
+			int64_t copied = std::min(length, bufferLimit - bufferedBytes);
+			std::copy(data, data + copied, buffer.data() + bufferedBytes);
+			bufferedBytes += copied;
+			data += copied;
+			length -= copied;
+			if (bufferedBytes == bufferLimit) {
+				compressBuffer();
+			}
+		}
+		return;
+	}
+	if (bufferedBytes + length > bufferLimit) {
+		writeOut(data, length);
+		return;
+	}
+	std::copy(data, data + length, buffer.data() + bufferedBytes);
+	bufferedBytes += length;
+}
+
+void MafFile::append(const std::string &data)
+{
+	append(data.data(), data.length());
+}
+
+void MafFile::append(char character)
+{
+	append(&character, 1);
+}
+
+void MafFile::appendNumber(int64_t number)
+/* Formats the number straight into the buffer */
+{
+	char digits[24];
+	int64_t length = 0;
+	bool negative = number < 0;
+	uint64_t magnitude = negative ? -(uint64_t) number : number;
+	do {
+		digits[sizeof(digits) - 1 - length] = '0' + magnitude % 10;
+		magnitude /= 10;
+		length++;
+	} while (magnitude > 0);
+	if (negative) {
+		digits[sizeof(digits) - 1 - length] = '-';
+		length++;
+	}
+	append(digits + sizeof(digits) - length, length);
+}
+
+void MafFile::writeOut(const char *data, int64_t length)
+/* Long sequences that would overflow the buffer go to the file straight from the read, without being
+ * copied into the buffer first. */
+{
+	struct iovec parts[2];
+	parts[0].iov_base = buffer.data();
+	parts[0].iov_len = bufferedBytes;
+	parts[1].iov_base = (void*) data;
+	parts[1].iov_len = length;
+	int firstPart = 0;
+
+	while (fileDescriptor >= 0 and parts[0].iov_len + parts[1].iov_len > 0) {
+		ssize_t written = writev(fileDescriptor, parts + firstPart, 2 - firstPart);
+		if (written < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			std::cerr << "Failed to write MAF file.\n";
+			break;
+		}
+		// Skip what was written; a short write leaves the rest of the parts for the next call
+		for (int part = firstPart; part < 2 and written > 0; part++) {
+			size_t skipped = std::min((size_t) written, parts[part].iov_len);
+			parts[part].iov_base = (char*) parts[part].iov_base + skipped;
+			parts[part].iov_len -= skipped;
+			written -= skipped;
+		}
+		while (firstPart < 1 and parts[firstPart].iov_len == 0) {
+			firstPart++;
+		}
+	}
+	bufferedBytes = 0;
 }
@@ -1,15 +1,72 @@
 #ifndef DATA_H
 #define DATA_H
 
+#include <string>
+#include <vector>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include "measures.hpp"
+#include "compression.hpp"
+#include "queues.hpp"
+
 std::vector<std::string> split(const std::string &str);
 /* Splits a string into its constituent tokens similar to the .split() function in python. */
 
-int64_t gaplessLength(std::string read);
+int64_t gaplessLength(const std::string &read);
 /* Returns the length of a sequence without gaps. */
 
-int64_t boundarylessLength(std::string read);
+int64_t boundarylessLength(const std::string &read);
 /* Returns the length of a sequecne without boundaries */
 
+struct StringView
+/* Characters of a mapped input file, which are not copied until a string of them is needed */
+{
+	const char *data;
+	int64_t length;
+	std::string toString() const { return std::string(data, length); }
+};
+
+void splitView(StringView line, std::vector<StringView> &fields);
+/* Splits a line at its spaces like split(), without copying it; fields is reused from line to line. */
+
+class MappedFile
+/* Maps a whole input file into memory, read-only, so that it is parsed where it lies instead of being
+ * copied line by line into strings */
+{
+	public:
+		MappedFile(std::string fileName);
+		~MappedFile();
+		MappedFile(const MappedFile&) = delete;
+		MappedFile& operator=(const MappedFile&) = delete;
+		bool isOpen();
+		const char* begin();
+		const char* end();
+	private:
+		int fileDescriptor;
+		char *mapping;
+		int64_t size;
+};
+
+class LineScanner
+/* Hands out the lines of a range of a mapped file, without their newlines */
+{
+	public:
+		LineScanner(const char *begin, const char *end);
+		// Returns false at the end of the range; like std::getline, a last line without a newline counts
+		bool nextLine(StringView &line);
+	private:
+		const char *position;
+		const char *end;
+};
+
+std::vector<const char*> splitRecords(const char *begin, const char *end, int64_t partBytes, char marker);
+/* Splits a range of a mapped file into parts of about partBytes bytes, each starting at a line that begins
+ * with marker: 'a' for the blocks of a MAF file, '>' for the records of a FASTA file. Returns the boundaries
+ * of the parts, from the first such line to end. */
+
 struct ReadInfo
 /* Contains the read information for the two-way MAF file for the uncorrected long read and reference sequence 
  */
@@ -31,17 +88,105 @@ struct Read_t
 	std::string clr;
 	ReadInfo readInfo;
 	bool alignmentSuccessful;
+	// Stats of the alignment when only counting; ref, ulr and clr are then left empty
+	ReadCounts counts;
 };
 
+struct TextPart
+/* Lines of an input file that start with a record and end where the next part starts */
+{
+	// Parts are numbered from 0 in file order
+	int64_t index;
+	const char *begin;
+	const char *end;
+	// Holds the inflated text of a compressed file; parts of a plain file point into its mapping
+	std::shared_ptr<std::string> text;
+};
+
+class TextInput
+/* Hands out the text of an input file in parts of about partBytes bytes that each start at a line beginning
+ * with marker, as splitRecords cuts them. Plain files are mapped and cut where they lie. gzip and BGZF files
+ * are inflated ahead of the reader by other threads, several BGZF blocks at once; the record cut off by the
+ * end of an inflated piece is carried over into the next part.
+ */
+{
+	public:
+		TextInput(std::string fileName, char marker, int64_t partBytes, int64_t threads);
+		~TextInput();
+		TextInput(const TextInput&) = delete;
+		TextInput& operator=(const TextInput&) = delete;
+		bool isOpen();
+		// Hands out the next part; returns false at the end of the file. Safe to call from several threads
+		// at once
+		bool nextPart(TextPart &part);
+	private:
+		std::string fileName;
+		MappedFile file;
+		char marker;
+		int64_t partBytes;
+		CompressionType compression;
+		std::mutex partMutex;
+		int64_t partIndex;
+		// Parts of a plain file
+		std::vector<const char*> boundaries;
+		// Pieces of the text of a compressed file, in file order
+		std::unique_ptr< ReorderBuffer<std::string> > inflatedPieces;
+		std::vector<std::thread> inflaters;
+		std::mutex blockMutex;
+		const char *nextBlock;
+		int64_t nextPiece;
+		std::atomic<bool> stopping;
+		// Text from the last record start of the pieces taken so far
+		std::string carried;
+		void inflateBgzf();
+		void inflateGzip();
+		void inflateFailed();
+		bool nextInflatedPart(TextPart &part);
+};
+
+void parseMafPart(const TextPart &part, std::vector<Read_t> &reads);
+/* Copies the blocks of a part of a two-way MAF file into reads, leaving their cLRs empty */
+
+void parseClrPart(const TextPart &part, std::vector<std::string> &clrs);
+/* Copies the cLRs of a part of a FASTA file */
+
 class MafFile
-/* Object to create a MAF containing 3-way alignments between a reference, uLR and cLR 
+/* Object to create a MAF containing 3-way alignments between a reference, uLR and cLR. The file stays
+ * open for the life of the object; blocks are formatted into a large buffer, which is written out
+ * whenever it fills up and when the object is destroyed. With compression threads, the file is written
+ * as BGZF instead, along with an index file, fileName.idx, of the virtual offset of each read's block.
  */
 {
 	public:
-		MafFile(std::string fileName);
-		void addReads(Read_t reads);
+		MafFile(std::string fileName, int64_t compressionThreads = 0);
+		~MafFile();
+		MafFile(const MafFile&) = delete;
+		MafFile& operator=(const MafFile&) = delete;
+		void addReads(const Read_t &reads);
+		// Writes out the buffered blocks
+		void flush();
 	private:
 		std::string filename;
+		int fileDescriptor;
+		std::vector<char> buffer;
+		int64_t bufferedBytes;
+		// Bytes buffered before they are written out
+		static constexpr int64_t bufferCapacity = 16 << 20;
+		// Bytes buffered before they are handed to the compression threads, in whole BGZF blocks
+		static constexpr int64_t compressedPieceCapacity = 16 * bgzfBlockText;
+		int64_t bufferLimit;
+		std::unique_ptr<BgzfWriter> bgzfWriter;
+		// Reads that start in the buffer, for the index of a BGZF file
+		std::vector<BgzfMark> marks;
+		// Hands the buffer to the compression threads
+		void compressBuffer();
+		// Appends bytes to the buffer; data that would not fit is written together with the buffer
+		void append(const char *data, int64_t length);
+		void append(const std::string &data);
+		void append(char character);
+		void appendNumber(int64_t number);
+		// Writes the buffer, followed by length bytes of data, with as few system calls as possible
+		void writeOut(const char *data, int64_t length);
 };
 
 #endif /* DATA_H */
@@ -0,0 +1,776 @@
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <atomic>
+#include <thread>
+// for std::memcpy
+#include <cstring>
+// for the AVX2 and AVX-512 intrinsics; other CPUs only get the scalar kernels
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#include "kernels.hpp"
+
+// Vector instructions used by the kernels; the widest the CPU has unless lowered with setVectorLevel
+static VectorLevel g_vectorLevel = supportedVectorLevel();
+
+VectorLevel supportedVectorLevel()
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f")) {
+		return Avx512;
+	} else if (__builtin_cpu_supports("avx2")) {
+		return Avx2;
+	}
+#endif
+	return Scalar;
+}
+
+void setVectorLevel(VectorLevel level)
+{
+	g_vectorLevel = std::min(level, supportedVectorLevel());
+}
+
+int64_t antiDiagonalLength(int64_t diagonal, int64_t rows, int64_t columns)
+{
+	int64_t firstRow = std::max(diagonal - (columns - 1), (int64_t) 0);
+	int64_t lastRow = std::min(diagonal, rows - 1);
+	return lastRow - firstRow + 1;
+}
+
+static inline uint64_t spreadBits(uint64_t bits)
+/* Moves bit i of a 16-bit value to bit 2i */
+{
+	bits = (bits | (bits << 8)) & 0x00FF00FF;
+	bits = (bits | (bits << 4)) & 0x0F0F0F0F;
+	bits = (bits | (bits << 2)) & 0x33333333;
+	bits = (bits | (bits << 1)) & 0x55555555;
+	return bits;
+}
+
+static inline void storeOperations(uint64_t* operations, int64_t cellIndex, uint32_t isDeletion,
+                                   uint32_t isInsertion, int lanes)
+/* Stores the operations of up to 16 consecutive cells given the lanes whose score came from a
+ * deletion and from an insertion. Deletion = 01, insertion = 10 and substitution = 11. */
+{
+	uint32_t laneMask = (1u << lanes) - 1;
+	uint64_t lowBits = (isDeletion | ~isInsertion) & laneMask;
+	uint64_t highBits = ~isDeletion & laneMask;
+	uint64_t bits = spreadBits(lowBits) | (spreadBits(highBits) << 1);
+
+	int64_t bitIndex = cellIndex * 2;
+	int shift = bitIndex & 63;
+	operations[bitIndex >> 6] |= bits << shift;
+	// Leaves the next word alone unless the cells reach it, as another thread may be filling it
+	if (shift + 2*lanes > 64) {
+		operations[(bitIndex >> 6) + 1] |= bits >> (64 - shift);
+	}
+}
+
+static inline void fillCell(const AntiDiagonalProblem &problem, int64_t diagonal, int64_t rowIndex,
+                            const int32_t* previous, const int32_t* beforePrevious, int32_t* current,
+                            uint64_t* operations, int64_t cellIndex)
+/* Scalar version of the recurrence for one cell, including the base cases */
+{
+	int64_t columnIndex = diagonal - rowIndex;
+	if (rowIndex == 0) {
+		current[0] = 0;
+		storeOperations(operations, cellIndex, 1, 0, 1);
+	} else if (columnIndex == 0) {
+		current[rowIndex] = problem.rowBaseScores[rowIndex];
+		storeOperations(operations, cellIndex, 0, 1, 1);
+	} else {
+		int32_t insertionCost = columnIndex == problem.columns - 1 ? problem.lastColumnInsertionCost : problem.cost;
+		bool match = problem.rowBases[rowIndex-1] == problem.reversedColumnBases[problem.columns - 1 - columnIndex];
+		int32_t deletion = previous[rowIndex] + problem.deletionCosts[rowIndex];
+		int32_t insertion = previous[rowIndex-1] + insertionCost;
+		int32_t substitution = beforePrevious[rowIndex-1] + (match ? 0 : problem.cost);
+		int32_t best = std::min( deletion, std::min(insertion, substitution) );
+		current[rowIndex] = best;
+		storeOperations(operations, cellIndex, best == deletion, best == insertion, 1);
+	}
+}
+
+typedef void (*InteriorKernel)(const AntiDiagonalProblem &problem, int64_t diagonal, int64_t firstRow,
+                               int64_t lastRow, const int32_t* previous, const int32_t* beforePrevious,
+                               int32_t* current, uint64_t* operations, int64_t diagonalBase);
+
+static void interiorScalar(const AntiDiagonalProblem &problem, int64_t diagonal, int64_t firstRow,
+                           int64_t lastRow, const int32_t* previous, const int32_t* beforePrevious,
+                           int32_t* current, uint64_t* operations, int64_t diagonalBase)
+{
+	for (int64_t rowIndex = firstRow; rowIndex <= lastRow; rowIndex++) {
+		fillCell(problem, diagonal, rowIndex, previous, beforePrevious, current, operations,
+		         diagonalBase + rowIndex);
+	}
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2")))
+static void interiorAvx2(const AntiDiagonalProblem &problem, int64_t diagonal, int64_t firstRow,
+                         int64_t lastRow, const int32_t* previous, const int32_t* beforePrevious,
+                         int32_t* current, uint64_t* operations, int64_t diagonalBase)
+/* Fills 8 cells of the anti-diagonal per iteration */
+{
+	const __m256i costs = _mm256_set1_epi32(problem.cost);
+	const __m256i lastColumnCosts = _mm256_set1_epi32(problem.lastColumnInsertionCost);
+	// Row of the cell of this anti-diagonal that lies in the last column
+	const __m256i lastColumnRow = _mm256_set1_epi32((int32_t) (diagonal - (problem.columns - 1)));
+	const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+	int64_t columnOffset = problem.columns - 1 - diagonal;
+
+	int64_t rowIndex = firstRow;
+	for (; rowIndex + 7 <= lastRow; rowIndex += 8) {
+		__m256i left = _mm256_loadu_si256((const __m256i*) (previous + rowIndex));
+		__m256i up = _mm256_loadu_si256((const __m256i*) (previous + rowIndex - 1));
+		__m256i diagonalScores = _mm256_loadu_si256((const __m256i*) (beforePrevious + rowIndex - 1));
+		__m256i deletionCosts = _mm256_loadu_si256((const __m256i*) (problem.deletionCosts + rowIndex));
+
+		__m128i rowBytes = _mm_loadl_epi64((const __m128i*) (problem.rowBases + rowIndex - 1));
+		__m128i columnBytes = _mm_loadl_epi64((const __m128i*) (problem.reversedColumnBases + columnOffset + rowIndex));
+		__m256i matches = _mm256_cvtepi8_epi32( _mm_cmpeq_epi8(rowBytes, columnBytes) );
+
+		__m256i rowIndices = _mm256_add_epi32( _mm256_set1_epi32((int32_t) rowIndex), lanes );
+		__m256i insertionCosts = _mm256_blendv_epi8( costs, lastColumnCosts,
+		                                             _mm256_cmpeq_epi32(rowIndices, lastColumnRow) );
+
+		__m256i deletion = _mm256_add_epi32(left, deletionCosts);
+		__m256i insertion = _mm256_add_epi32(up, insertionCosts);
+		__m256i substitution = _mm256_add_epi32( diagonalScores, _mm256_andnot_si256(matches, costs) );
+		__m256i best = _mm256_min_epi32( deletion, _mm256_min_epi32(insertion, substitution) );
+		_mm256_storeu_si256((__m256i*) (current + rowIndex), best);
+
+		uint32_t isDeletion = _mm256_movemask_ps( _mm256_castsi256_ps(_mm256_cmpeq_epi32(best, deletion)) );
+		uint32_t isInsertion = _mm256_movemask_ps( _mm256_castsi256_ps(_mm256_cmpeq_epi32(best, insertion)) );
+		storeOperations(operations, diagonalBase + rowIndex, isDeletion, isInsertion, 8);
+	}
+	interiorScalar(problem, diagonal, rowIndex, lastRow, previous, beforePrevious, current, operations,
+	               diagonalBase);
+}
+
+__attribute__((target("avx512f")))
+static void interiorAvx512(const AntiDiagonalProblem &problem, int64_t diagonal, int64_t firstRow,
+                           int64_t lastRow, const int32_t* previous, const int32_t* beforePrevious,
+                           int32_t* current, uint64_t* operations, int64_t diagonalBase)
+/* Fills 16 cells of the anti-diagonal per iteration */
+{
+	const __m512i costs = _mm512_set1_epi32(problem.cost);
+	const __m512i lastColumnCosts = _mm512_set1_epi32(problem.lastColumnInsertionCost);
+	const __m512i lastColumnRow = _mm512_set1_epi32((int32_t) (diagonal - (problem.columns - 1)));
+	const __m512i lanes = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+	int64_t columnOffset = problem.columns - 1 - diagonal;
+
+	int64_t rowIndex = firstRow;
+	for (; rowIndex + 15 <= lastRow; rowIndex += 16) {
+		__m512i left = _mm512_loadu_si512(previous + rowIndex);
+		__m512i up = _mm512_loadu_si512(previous + rowIndex - 1);
+		__m512i diagonalScores = _mm512_loadu_si512(beforePrevious + rowIndex - 1);
+		__m512i deletionCosts = _mm512_loadu_si512(problem.deletionCosts + rowIndex);
+
+		__m512i rowBytes = _mm512_cvtepu8_epi32( _mm_loadu_si128((const __m128i*) (problem.rowBases + rowIndex - 1)) );
+		__m512i columnBytes = _mm512_cvtepu8_epi32(
+			_mm_loadu_si128((const __m128i*) (problem.reversedColumnBases + columnOffset + rowIndex)) );
+		__mmask16 matches = _mm512_cmpeq_epi32_mask(rowBytes, columnBytes);
+
+		__m512i rowIndices = _mm512_add_epi32( _mm512_set1_epi32((int32_t) rowIndex), lanes );
+		__mmask16 lastColumn = _mm512_cmpeq_epi32_mask(rowIndices, lastColumnRow);
+		__m512i insertionCosts = _mm512_mask_mov_epi32(costs, lastColumn, lastColumnCosts);
+
+		__m512i deletion = _mm512_add_epi32(left, deletionCosts);
+		__m512i insertion = _mm512_add_epi32(up, insertionCosts);
+		__m512i substitution = _mm512_mask_mov_epi32( _mm512_add_epi32(diagonalScores, costs), matches,
+		                                              diagonalScores );
+		__m512i best = _mm512_min_epi32( deletion, _mm512_min_epi32(insertion, substitution) );
+		_mm512_storeu_si512(current + rowIndex, best);
+
+		uint32_t isDeletion = _mm512_cmpeq_epi32_mask(best, deletion);
+		uint32_t isInsertion = _mm512_cmpeq_epi32_mask(best, insertion);
+		storeOperations(operations, diagonalBase + rowIndex, isDeletion, isInsertion, 16);
+	}
+	interiorScalar(problem, diagonal, rowIndex, lastRow, previous, beforePrevious, current, operations,
+	               diagonalBase);
+}
+#endif
+
+// Scratch buffers of the kernels. Every thread keeps its own from one call to the next, so aligning read
+// after read does not allocate them again.
+static thread_local std::vector<int32_t> g_diagonalScores[3];
+
+class SpinBarrier
+/* Makes the threads filling an anti-diagonal wait for each other before the next one. An anti-diagonal
+ * takes microseconds, too short to put the threads to sleep in between. */
+{
+	public:
+		SpinBarrier(int64_t threads) : threads(threads), arrived(0), generation(0) {}
+		void wait()
+		{
+			int64_t waitedGeneration = generation.load(std::memory_order_acquire);
+			if (arrived.fetch_add(1, std::memory_order_acq_rel) == threads - 1) {
+				arrived.store(0, std::memory_order_relaxed);
+				generation.store(waitedGeneration + 1, std::memory_order_release);
+				return;
+			}
+			while (generation.load(std::memory_order_acquire) == waitedGeneration) {
+				std::this_thread::yield();
+			}
+		}
+	private:
+		int64_t threads;
+		std::atomic<int64_t> arrived;
+		std::atomic<int64_t> generation;
+};
+
+static int64_t antiDiagonalParts(int64_t diagonal, int64_t rows, int64_t columns, int64_t threads)
+/* Number of threads that share the given anti-diagonal */
+{
+	int64_t parts = antiDiagonalLength(diagonal, rows, columns) / antiDiagonalPartCells;
+	return std::max( std::min(parts, threads), (int64_t) 1 );
+}
+
+int64_t fillAntiDiagonals(const AntiDiagonalProblem &problem, const std::vector<int64_t> &diagonalStart,
+                          std::vector<uint64_t> &operations, int64_t threads)
+/* Each anti-diagonal long enough is cut into parts that begin on a word of operations, one per thread,
+ * so that no two threads store into the same word. The threads wait for each other after an
+ * anti-diagonal only if it or the next one is shared. */
+{
+	int64_t rows = problem.rows;
+	int64_t columns = problem.columns;
+
+	InteriorKernel interior = interiorScalar;
+#if defined(__x86_64__) || defined(__i386__)
+	if (g_vectorLevel == Avx512) {
+		interior = interiorAvx512;
+	} else if (g_vectorLevel == Avx2) {
+		interior = interiorAvx2;
+	}
+#endif
+
+	// Two bits per cell, plus a spare word for stores that straddle the last word
+	operations.assign( (rows*columns*2 + 63)/64 + 1, 0 );
+
+	// Scores of the current anti-diagonal and the two before it, indexed by row
+	for (int64_t buffer = 0; buffer < 3; buffer++) {
+		g_diagonalScores[buffer].assign(rows, 0);
+	}
+	int32_t* buffers[3] = {g_diagonalScores[0].data(), g_diagonalScores[1].data(), g_diagonalScores[2].data()};
+	SpinBarrier barrier (threads);
+
+	auto fillParts = [&](int64_t part) {
+		int32_t* current = buffers[0];
+		int32_t* previous = buffers[1];
+		int32_t* beforePrevious = buffers[2];
+
+		for (int64_t diagonal = 0; diagonal < rows + columns - 1; diagonal++) {
+			int64_t firstRow = std::max(diagonal - (columns - 1), (int64_t) 0);
+			int64_t lastRow = std::min(diagonal, rows - 1);
+			// Index of the cell of row 0 of this diagonal, whether or not the diagonal reaches row 0
+			int64_t diagonalBase = diagonalStart[diagonal] - firstRow;
+			int64_t parts = antiDiagonalParts(diagonal, rows, columns, threads);
+
+			if (part < parts) {
+				// Rows of this thread's part; inner boundaries are rounded up to the next word of 32 cells
+				int64_t length = lastRow - firstRow + 1;
+				int64_t partFirstRow = firstRow;
+				int64_t partLastRow = lastRow;
+				if (part > 0) {
+					partFirstRow = ((diagonalStart[diagonal] + length*part/parts + 31)/32)*32 - diagonalBase;
+				}
+				if (part < parts - 1) {
+					partLastRow = ((diagonalStart[diagonal] + length*(part + 1)/parts + 31)/32)*32 - diagonalBase - 1;
+				}
+
+				// Cells off the first row and column only depend on the two previous anti-diagonals
+				int64_t firstInterior = std::max(partFirstRow, (int64_t) 1);
+				int64_t lastInterior = std::min(partLastRow, diagonal - 1);
+
+				if (partFirstRow == 0) {
+					fillCell(problem, diagonal, 0, previous, beforePrevious, current, operations.data(), diagonalBase);
+				}
+				if (firstInterior <= lastInterior) {
+					interior(problem, diagonal, firstInterior, lastInterior, previous, beforePrevious, current,
+					         operations.data(), diagonalBase);
+				}
+				if (partLastRow == diagonal and diagonal > 0) {
+					fillCell(problem, diagonal, diagonal, previous, beforePrevious, current, operations.data(),
+					         diagonalBase + diagonal);
+				}
+			}
+			if (parts > 1 or antiDiagonalParts(diagonal + 1, rows, columns, threads) > 1) {
+				barrier.wait();
+			}
+
+			int32_t* oldest = beforePrevious;
+			beforePrevious = previous;
+			previous = current;
+			current = oldest;
+		}
+		return previous[rows - 1];
+	};
+
+	std::vector<std::thread> helpers;
+	for (int64_t part = 1; part < threads; part++) {
+		helpers.push_back( std::thread(fillParts, part) );
+	}
+	int64_t finalScore = fillParts(0);
+	for (std::thread &helper : helpers) {
+		helper.join();
+	}
+	return finalScore;
+}
+
+// Score of unreachable cells in the batched kernel; leaves room to add a cost without overflowing
+static const int32_t g_batchInfinity = 1 << 30;
+
+int32_t batchInfinity()
+{
+	return g_batchInfinity;
+}
+
+int64_t batchLanes()
+{
+	return g_vectorLevel == Avx512 ? 16 : 8;
+}
+
+struct BatchProfile
+/* Inputs of a batch interleaved by lane: the value of lane l at row or column i is at [i*width + l].
+ * Lanes and cells past the end of a read are padded so that they stay unreachable. */
+{
+	int64_t width;
+	int64_t columns;
+	std::vector<int32_t> rowBases;
+	std::vector<int32_t> rowRules;
+	std::vector<int32_t> deletionCosts;
+	std::vector<int32_t> rowBaseScores;
+	std::vector<int32_t> columnBases;
+	std::vector<int32_t> ulrBases;
+	// -1 where the reference or uLR has a gap, 0 elsewhere
+	std::vector<int32_t> refGaps;
+	std::vector<int32_t> ulrGaps;
+	std::vector<int32_t> insertionCosts;
+	std::vector<int32_t> columnBaseScores;
+	std::vector<int32_t> costs;
+};
+
+typedef void (*BatchRowKernel)(const BatchProfile &profile, int64_t rowIndex, const int32_t* previous,
+                               int32_t* current, uint32_t* operations);
+
+static void batchRowScalar(const BatchProfile &profile, int64_t rowIndex, const int32_t* previous,
+                           int32_t* current, uint32_t* operations)
+/* Fills columns 1 onwards of a row, one lane after the other */
+{
+	int64_t width = profile.width;
+	for (int64_t columnIndex = 1; columnIndex < profile.columns; columnIndex++) {
+		uint32_t lowBits = 0;
+		uint32_t highBits = 0;
+		for (int64_t lane = 0; lane < width; lane++) {
+			int64_t rowCell = rowIndex*width + lane;
+			int64_t columnCell = columnIndex*width + lane;
+			int32_t rules = profile.rowRules[rowCell];
+			int32_t rowBase = profile.rowBases[rowCell];
+			bool refGap = profile.refGaps[columnCell] != 0;
+			bool ulrGap = profile.ulrGaps[columnCell] != 0;
+			bool ulrMatch = profile.ulrBases[columnCell] == rowBase;
+
+			int32_t deletion = g_batchInfinity;
+			int32_t insertion = g_batchInfinity;
+			int32_t substitution = g_batchInfinity;
+			if ( (rules & AllowDeletion) or ((rules & AllowDeletionAtUlrGap) and ulrGap) ) {
+				int32_t deletionCost = (rules & FreeDeletionAtRefGap) and refGap ? 0 : profile.deletionCosts[rowCell];
+				deletion = std::min( current[columnCell - width] + deletionCost, g_batchInfinity );
+			}
+			if (rules & AllowInsertion) {
+				insertion = std::min( previous[columnCell] + profile.insertionCosts[columnCell], g_batchInfinity );
+			}
+			if ( (rules & AllowSubstitution) or ((rules & AllowSubstitutionAtUlrMatch) and ulrMatch) ) {
+				int32_t substitutionCost = profile.columnBases[columnCell] == rowBase ? 0 : profile.costs[lane];
+				substitution = std::min( previous[columnCell - width] + substitutionCost, g_batchInfinity );
+			}
+			int32_t best = std::min( deletion, std::min(insertion, substitution) );
+			current[columnCell] = best;
+
+			if (best == g_batchInfinity) {
+				continue;
+			} else if (best == deletion) {
+				lowBits |= 1u << lane;
+			} else if (best == insertion) {
+				highBits |= 1u << lane;
+			} else {
+				lowBits |= 1u << lane;
+				highBits |= 1u << lane;
+			}
+		}
+		operations[rowIndex*profile.columns + columnIndex] = lowBits | (highBits << 16);
+	}
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2")))
+static inline __m256i ruleMaskAvx2(__m256i rules, int32_t rule)
+/* Returns -1 in the lanes whose rules have the given bit */
+{
+	__m256i bit = _mm256_set1_epi32(rule);
+	return _mm256_cmpeq_epi32( _mm256_and_si256(rules, bit), bit );
+}
+
+__attribute__((target("avx2")))
+static void batchRowAvx2(const BatchProfile &profile, int64_t rowIndex, const int32_t* previous,
+                         int32_t* current, uint32_t* operations)
+/* Fills columns 1 onwards of a row, one cell of 8 reads per iteration */
+{
+	const __m256i infinity = _mm256_set1_epi32(g_batchInfinity);
+	const __m256i costs = _mm256_loadu_si256((const __m256i*) profile.costs.data());
+	const __m256i rowBase = _mm256_loadu_si256((const __m256i*) (profile.rowBases.data() + rowIndex*8));
+	const __m256i deletionCosts = _mm256_loadu_si256((const __m256i*) (profile.deletionCosts.data() + rowIndex*8));
+	const __m256i rules = _mm256_loadu_si256((const __m256i*) (profile.rowRules.data() + rowIndex*8));
+	const __m256i allowDeletion = ruleMaskAvx2(rules, AllowDeletion);
+	const __m256i allowDeletionAtUlrGap = ruleMaskAvx2(rules, AllowDeletionAtUlrGap);
+	const __m256i freeDeletionAtRefGap = ruleMaskAvx2(rules, FreeDeletionAtRefGap);
+	const __m256i allowInsertion = ruleMaskAvx2(rules, AllowInsertion);
+	const __m256i allowSubstitution = ruleMaskAvx2(rules, AllowSubstitution);
+	const __m256i allowSubstitutionAtUlrMatch = ruleMaskAvx2(rules, AllowSubstitutionAtUlrMatch);
+
+	__m256i left = _mm256_loadu_si256((const __m256i*) current);
+	__m256i diagonal = _mm256_loadu_si256((const __m256i*) previous);
+	for (int64_t columnIndex = 1; columnIndex < profile.columns; columnIndex++) {
+		int64_t columnCell = columnIndex*8;
+		__m256i up = _mm256_loadu_si256((const __m256i*) (previous + columnCell));
+		__m256i columnBase = _mm256_loadu_si256((const __m256i*) (profile.columnBases.data() + columnCell));
+		__m256i ulrBase = _mm256_loadu_si256((const __m256i*) (profile.ulrBases.data() + columnCell));
+		__m256i refGap = _mm256_loadu_si256((const __m256i*) (profile.refGaps.data() + columnCell));
+		__m256i ulrGap = _mm256_loadu_si256((const __m256i*) (profile.ulrGaps.data() + columnCell));
+		__m256i insertionCosts = _mm256_loadu_si256((const __m256i*) (profile.insertionCosts.data() + columnCell));
+
+		__m256i deletionAllowed = _mm256_or_si256( allowDeletion, _mm256_and_si256(allowDeletionAtUlrGap, ulrGap) );
+		__m256i deletionCost = _mm256_andnot_si256( _mm256_and_si256(freeDeletionAtRefGap, refGap), deletionCosts );
+		__m256i deletion = _mm256_min_epi32( _mm256_add_epi32(left, deletionCost), infinity );
+		deletion = _mm256_blendv_epi8(infinity, deletion, deletionAllowed);
+
+		__m256i insertion = _mm256_min_epi32( _mm256_add_epi32(up, insertionCosts), infinity );
+		insertion = _mm256_blendv_epi8(infinity, insertion, allowInsertion);
+
+		__m256i ulrMatch = _mm256_cmpeq_epi32(ulrBase, rowBase);
+		__m256i substitutionAllowed = _mm256_or_si256( allowSubstitution,
+		                                               _mm256_and_si256(allowSubstitutionAtUlrMatch, ulrMatch) );
+		__m256i substitutionCost = _mm256_andnot_si256( _mm256_cmpeq_epi32(columnBase, rowBase), costs );
+		__m256i substitution = _mm256_min_epi32( _mm256_add_epi32(diagonal, substitutionCost), infinity );
+		substitution = _mm256_blendv_epi8(infinity, substitution, substitutionAllowed);
+
+		__m256i best = _mm256_min_epi32( deletion, _mm256_min_epi32(insertion, substitution) );
+		_mm256_storeu_si256((__m256i*) (current + columnCell), best);
+
+		__m256i reachable = _mm256_cmpgt_epi32(infinity, best);
+		__m256i isDeletion = _mm256_and_si256( _mm256_cmpeq_epi32(best, deletion), reachable );
+		__m256i isInsertion = _mm256_andnot_si256( isDeletion,
+		                                           _mm256_and_si256(_mm256_cmpeq_epi32(best, insertion), reachable) );
+		uint32_t lowBits = _mm256_movemask_ps( _mm256_castsi256_ps(_mm256_andnot_si256(isInsertion, reachable)) );
+		uint32_t highBits = _mm256_movemask_ps( _mm256_castsi256_ps(_mm256_andnot_si256(isDeletion, reachable)) );
+		operations[rowIndex*profile.columns + columnIndex] = lowBits | (highBits << 16);
+
+		left = best;
+		diagonal = up;
+	}
+}
+
+__attribute__((target("avx512f")))
+static inline __mmask16 ruleMaskAvx512(__m512i rules, int32_t rule)
+/* Returns the lanes whose rules have the given bit */
+{
+	return _mm512_test_epi32_mask( rules, _mm512_set1_epi32(rule) );
+}
+
+__attribute__((target("avx512f")))
+static void batchRowAvx512(const BatchProfile &profile, int64_t rowIndex, const int32_t* previous,
+                           int32_t* current, uint32_t* operations)
+/* Fills columns 1 onwards of a row, one cell of 16 reads per iteration */
+{
+	const __m512i infinity = _mm512_set1_epi32(g_batchInfinity);
+	const __m512i costs = _mm512_loadu_si512(profile.costs.data());
+	const __m512i rowBase = _mm512_loadu_si512(profile.rowBases.data() + rowIndex*16);
+	const __m512i deletionCosts = _mm512_loadu_si512(profile.deletionCosts.data() + rowIndex*16);
+	const __m512i rules = _mm512_loadu_si512(profile.rowRules.data() + rowIndex*16);
+	const __mmask16 allowDeletion = ruleMaskAvx512(rules, AllowDeletion);
+	const __mmask16 allowDeletionAtUlrGap = ruleMaskAvx512(rules, AllowDeletionAtUlrGap);
+	const __mmask16 freeDeletionAtRefGap = ruleMaskAvx512(rules, FreeDeletionAtRefGap);
+	const __mmask16 allowInsertion = ruleMaskAvx512(rules, AllowInsertion);
+	const __mmask16 allowSubstitution = ruleMaskAvx512(rules, AllowSubstitution);
+	const __mmask16 allowSubstitutionAtUlrMatch = ruleMaskAvx512(rules, AllowSubstitutionAtUlrMatch);
+	const __m512i zero = _mm512_setzero_si512();
+
+	__m512i left = _mm512_loadu_si512(current);
+	__m512i diagonal = _mm512_loadu_si512(previous);
+	for (int64_t columnIndex = 1; columnIndex < profile.columns; columnIndex++) {
+		int64_t columnCell = columnIndex*16;
+		__m512i up = _mm512_loadu_si512(previous + columnCell);
+		__m512i columnBase = _mm512_loadu_si512(profile.columnBases.data() + columnCell);
+		__m512i ulrBase = _mm512_loadu_si512(profile.ulrBases.data() + columnCell);
+		__m512i refGaps = _mm512_loadu_si512(profile.refGaps.data() + columnCell);
+		__m512i ulrGaps = _mm512_loadu_si512(profile.ulrGaps.data() + columnCell);
+		__mmask16 refGap = _mm512_test_epi32_mask(refGaps, refGaps);
+		__mmask16 ulrGap = _mm512_test_epi32_mask(ulrGaps, ulrGaps);
+		__m512i insertionCosts = _mm512_loadu_si512(profile.insertionCosts.data() + columnCell);
+
+		__mmask16 deletionAllowed = allowDeletion | (allowDeletionAtUlrGap & ulrGap);
+		__m512i deletionCost = _mm512_mask_mov_epi32(deletionCosts, freeDeletionAtRefGap & refGap, zero);
+		__m512i deletion = _mm512_min_epi32( _mm512_add_epi32(left, deletionCost), infinity );
+		deletion = _mm512_mask_mov_epi32(infinity, deletionAllowed, deletion);
+
+		__m512i insertion = _mm512_min_epi32( _mm512_add_epi32(up, insertionCosts), infinity );
+		insertion = _mm512_mask_mov_epi32(infinity, allowInsertion, insertion);
+
+		__mmask16 ulrMatch = _mm512_cmpeq_epi32_mask(ulrBase, rowBase);
+		__mmask16 substitutionAllowed = allowSubstitution | (allowSubstitutionAtUlrMatch & ulrMatch);
+		__m512i substitutionCost = _mm512_mask_mov_epi32( costs, _mm512_cmpeq_epi32_mask(columnBase, rowBase), zero );
+		__m512i substitution = _mm512_min_epi32( _mm512_add_epi32(diagonal, substitutionCost), infinity );
+		substitution = _mm512_mask_mov_epi32(infinity, substitutionAllowed, substitution);
+
+		__m512i best = _mm512_min_epi32( deletion, _mm512_min_epi32(insertion, substitution) );
+		_mm512_storeu_si512(current + columnCell, best);
+
+		__mmask16 reachable = _mm512_cmplt_epi32_mask(best, infinity);
+		__mmask16 isDeletion = _mm512_cmpeq_epi32_mask(best, deletion) & reachable;
+		__mmask16 isInsertion = _mm512_cmpeq_epi32_mask(best, insertion) & reachable & ~isDeletion;
+		uint32_t lowBits = reachable & ~isInsertion;
+		uint32_t highBits = reachable & ~isDeletion;
+		operations[rowIndex*profile.columns + columnIndex] = (lowBits & 0xFFFF) | ((highBits & 0xFFFF) << 16);
+
+		left = best;
+		diagonal = up;
+	}
+}
+#endif
+
+static void interleave(std::vector<int32_t> &values, int64_t width, int64_t lane, int64_t index, int32_t value)
+{
+	values[index*width + lane] = value;
+}
+
+static thread_local BatchProfile g_batchProfile;
+static thread_local std::vector<int32_t> g_batchScores[2];
+
+void fillBatch(std::vector<BatchLane> &lanes, int64_t rows, int64_t columns, std::vector<uint32_t> &operations)
+{
+	BatchProfile &profile = g_batchProfile;
+	int64_t width = batchLanes();
+	profile.width = width;
+	profile.columns = columns;
+
+	BatchRowKernel rowKernel = batchRowScalar;
+#if defined(__x86_64__) || defined(__i386__)
+	if (g_vectorLevel == Avx512) {
+		rowKernel = batchRowAvx512;
+	} else if (g_vectorLevel == Avx2) {
+		rowKernel = batchRowAvx2;
+	}
+#endif
+
+	profile.rowBases.assign(rows*width, 0);
+	profile.rowRules.assign(rows*width, 0);
+	profile.deletionCosts.assign(rows*width, 0);
+	profile.rowBaseScores.assign(rows*width, g_batchInfinity);
+	profile.columnBases.assign(columns*width, 0);
+	profile.ulrBases.assign(columns*width, 0);
+	profile.refGaps.assign(columns*width, 0);
+	profile.ulrGaps.assign(columns*width, 0);
+	profile.insertionCosts.assign(columns*width, 0);
+	profile.columnBaseScores.assign(columns*width, g_batchInfinity);
+	profile.costs.assign(width, 0);
+
+	for (int64_t lane = 0; lane < lanes.size(); lane++) {
+		const BatchLane &read = lanes[lane];
+		int64_t laneRows = read.rowBases.length() + 1;
+		int64_t laneColumns = read.columnBases.length() + 1;
+
+		for (int64_t rowIndex = 0; rowIndex < laneRows; rowIndex++) {
+			if (rowIndex > 0) {
+				interleave(profile.rowBases, width, lane, rowIndex, (unsigned char) read.rowBases[rowIndex-1]);
+				interleave(profile.rowRules, width, lane, rowIndex, read.rowRules[rowIndex]);
+				interleave(profile.deletionCosts, width, lane, rowIndex, read.deletionCosts[rowIndex]);
+			}
+			interleave(profile.rowBaseScores, width, lane, rowIndex, read.rowBaseScores[rowIndex]);
+		}
+		for (int64_t columnIndex = 0; columnIndex < laneColumns; columnIndex++) {
+			if (columnIndex > 0) {
+				char base = read.columnBases[columnIndex-1];
+				char ulrBase = read.ulrBases[columnIndex-1];
+				interleave(profile.columnBases, width, lane, columnIndex, (unsigned char) base);
+				interleave(profile.ulrBases, width, lane, columnIndex, (unsigned char) ulrBase);
+				interleave(profile.refGaps, width, lane, columnIndex, base == '-' ? -1 : 0);
+				interleave(profile.ulrGaps, width, lane, columnIndex, ulrBase == '-' ? -1 : 0);
+				interleave(profile.insertionCosts, width, lane, columnIndex,
+				           columnIndex == laneColumns - 1 ? read.lastColumnInsertionCost : read.cost);
+			}
+			interleave(profile.columnBaseScores, width, lane, columnIndex, read.columnBaseScores[columnIndex]);
+		}
+		profile.costs[lane] = read.cost;
+	}
+
+	operations.resize(rows*columns);
+
+	// The two most recent rows of scores of every lane
+	g_batchScores[0].resize(columns*width);
+	g_batchScores[1].resize(columns*width);
+	int32_t* current = g_batchScores[0].data();
+	int32_t* previous = g_batchScores[1].data();
+	uint32_t allLanes = (1u << width) - 1;
+
+	for (int64_t rowIndex = 0; rowIndex < rows; rowIndex++) {
+		if (rowIndex == 0) {
+			std::copy(profile.columnBaseScores.begin(), profile.columnBaseScores.end(), current);
+			operations[0] = 0;
+			std::fill(operations.begin() + 1, operations.begin() + columns, allLanes);
+		} else {
+			std::copy(&profile.rowBaseScores[rowIndex*width], &profile.rowBaseScores[rowIndex*width] + width, current);
+			operations[rowIndex*columns] = allLanes << 16;
+			rowKernel(profile, rowIndex, previous, current, operations.data());
+		}
+
+		for (int64_t lane = 0; lane < lanes.size(); lane++) {
+			BatchLane &read = lanes[lane];
+			if (read.rowBases.length() == rowIndex) {
+				read.score = current[read.columnBases.length()*width + lane];
+				read.reachable = read.score < g_batchInfinity;
+			}
+		}
+		std::swap(current, previous);
+	}
+}
+
+static inline uint64_t spreadWord(uint64_t bits)
+/* Moves bit i of a 32-bit value to bit 2i */
+{
+	bits = (bits | (bits << 16)) & 0x0000FFFF0000FFFFULL;
+	bits = (bits | (bits << 8)) & 0x00FF00FF00FF00FFULL;
+	bits = (bits | (bits << 4)) & 0x0F0F0F0F0F0F0F0FULL;
+	bits = (bits | (bits << 2)) & 0x3333333333333333ULL;
+	bits = (bits | (bits << 1)) & 0x5555555555555555ULL;
+	return bits;
+}
+
+static void storeOperationWord(uint8_t* operations, int64_t cellIndex, uint64_t lowBits, uint64_t highBits,
+                               int64_t cells)
+/* Stores the 2-bit operations of up to 64 consecutive cells, given the low and high bit of each, leaving
+ * the cells around them untouched */
+{
+	uint64_t cellMask = cells == 64 ? ~0ULL : (1ULL << cells) - 1;
+	uint64_t codes[2];
+	uint64_t masks[2];
+	codes[0] = spreadWord(lowBits & 0xFFFFFFFF) | (spreadWord(highBits & 0xFFFFFFFF) << 1);
+	codes[1] = spreadWord(lowBits >> 32) | (spreadWord(highBits >> 32) << 1);
+	masks[0] = spreadWord(cellMask & 0xFFFFFFFF) * 3;
+	masks[1] = spreadWord(cellMask >> 32) * 3;
+
+	int64_t bitIndex = cellIndex * 2;
+	int shift = bitIndex & 7;
+	uint8_t* first = operations + (bitIndex >> 3);
+
+	uint64_t words[3];
+	std::memcpy(words, first, sizeof(words));
+	for (int word = 0; word < 3; word++) {
+		uint64_t code = word < 2 ? codes[word] << shift : 0;
+		uint64_t mask = word < 2 ? masks[word] << shift : 0;
+		if (word > 0 and shift != 0) {
+			code |= codes[word-1] >> (64 - shift);
+			mask |= masks[word-1] >> (64 - shift);
+		}
+		words[word] = (words[word] & ~mask) | (code & mask);
+	}
+	std::memcpy(first, words, sizeof(words));
+}
+
+static thread_local std::vector< std::vector<uint64_t> > g_baseMatches (256);
+static thread_local std::vector<uint64_t> g_positiveDeltas;
+static thread_local std::vector<uint64_t> g_negativeDeltas;
+
+void fillBitParallel(const BitParallelBlock &block, uint8_t* operations, int64_t firstCell, int64_t rowStride,
+                     std::vector<int8_t> &bottomDeltas, std::vector<int8_t> &rightDeltas)
+{
+	int64_t words = (block.width + 63) / 64;
+	int64_t lastBits = block.width - (words - 1)*64;
+	uint64_t lastBit = 1ULL << (lastBits - 1);
+
+	// Bits of the columns matching each base, built for the bases the rows use
+	std::vector< std::vector<uint64_t> > &matches = g_baseMatches;
+	for (int64_t base = 0; base < 256; base++) {
+		matches[base].clear();
+	}
+	for (int64_t rowIndex = 0; rowIndex < block.rows; rowIndex++) {
+		unsigned char base = block.rowBases[rowIndex];
+		if (matches[base].empty()) {
+			matches[base].assign(words, 0);
+			for (int64_t columnIndex = 0; columnIndex < block.width; columnIndex++) {
+				if ((unsigned char) block.columnBases[columnIndex] == base) {
+					matches[base][columnIndex >> 6] |= 1ULL << (columnIndex & 63);
+				}
+			}
+		}
+	}
+
+	// Differences along the current row: positive[c] is set if D[r][c] - D[r][c-1] = 1, negative[c] if -1
+	std::vector<uint64_t> &positive = g_positiveDeltas;
+	std::vector<uint64_t> &negative = g_negativeDeltas;
+	positive.assign(words, 0);
+	negative.assign(words, 0);
+	for (int64_t columnIndex = 0; columnIndex < block.width; columnIndex++) {
+		if (block.topDeltas[columnIndex] > 0) {
+			positive[columnIndex >> 6] |= 1ULL << (columnIndex & 63);
+		} else if (block.topDeltas[columnIndex] < 0) {
+			negative[columnIndex >> 6] |= 1ULL << (columnIndex & 63);
+		}
+	}
+
+	rightDeltas.resize(block.rows);
+	for (int64_t rowIndex = 0; rowIndex < block.rows; rowIndex++) {
+		const uint64_t* equal = matches[(unsigned char) block.rowBases[rowIndex]].data();
+		// Difference D[r][c] - D[r-1][c] carried in from the column left of the current word
+		int carry = block.leftDeltas[rowIndex];
+		int64_t cellIndex = firstCell + rowIndex*rowStride;
+
+		for (int64_t word = 0; word < words; word++) {
+			uint64_t positiveRow = positive[word];
+			uint64_t negativeRow = negative[word];
+			uint64_t equalBits = equal[word];
+			uint64_t crossRow = equalBits | negativeRow;
+			if (carry < 0) {
+				equalBits |= 1;
+			}
+			uint64_t crossColumn = (((equalBits & positiveRow) + positiveRow) ^ positiveRow) | equalBits;
+			// Differences down the columns: D[r][c] - D[r-1][c] is 1 or -1
+			uint64_t positiveColumn = negativeRow | ~(crossColumn | positiveRow);
+			uint64_t negativeColumn = positiveRow & crossColumn;
+
+			uint64_t topBit = word == words - 1 ? lastBit : 1ULL << 63;
+			int carryOut = (positiveColumn & topBit) ? 1 : ((negativeColumn & topBit) ? -1 : 0);
+
+			uint64_t shiftedPositive = (positiveColumn << 1) | (carry > 0 ? 1 : 0);
+			uint64_t shiftedNegative = (negativeColumn << 1) | (carry < 0 ? 1 : 0);
+			positiveRow = shiftedNegative | ~(crossRow | shiftedPositive);
+			negativeRow = shiftedPositive & crossRow;
+			positive[word] = positiveRow;
+			negative[word] = negativeRow;
+
+			// A cell comes from the left if its score is one more than its left neighbour's, else from
+			// above if it is one more than the score above it, else from the diagonal
+			uint64_t isDeletion = positiveRow;
+			uint64_t isInsertion = positiveColumn & ~positiveRow;
+			int64_t cells = word == words - 1 ? lastBits : 64;
+			storeOperationWord(operations, cellIndex + word*64, isDeletion | ~isInsertion, ~isDeletion, cells);
+
+			carry = carryOut;
+		}
+		rightDeltas[rowIndex] = carry;
+	}
+
+	bottomDeltas.resize(block.width);
+	for (int64_t columnIndex = 0; columnIndex < block.width; columnIndex++) {
+		uint64_t bit = 1ULL << (columnIndex & 63);
+		if (positive[columnIndex >> 6] & bit) {
+			bottomDeltas[columnIndex] = 1;
+		} else if (negative[columnIndex >> 6] & bit) {
+			bottomDeltas[columnIndex] = -1;
+		} else {
+			bottomDeltas[columnIndex] = 0;
+		}
+	}
+}
@@ -0,0 +1,131 @@
+#ifndef KERNELS_H
+#define KERNELS_H
+
+#include <cstdint>
+#include <vector>
+#include <string>
+
+// Widest vector instructions the kernels may use
+enum VectorLevel {Scalar,Avx2,Avx512};
+
+VectorLevel supportedVectorLevel();
+/* Returns the widest vector instructions this CPU has. */
+
+void setVectorLevel(VectorLevel level);
+/* Restricts the kernels to the given vector instructions, or to the supported ones if narrower. */
+
+struct AntiDiagonalProblem
+/* Inputs of the anti-diagonal kernel for the trimmed recurrence
+ *   D[r][c] = min( D[r][c-1] + deletionCosts[r], D[r-1][c] + insertion cost, D[r-1][c-1] + substitution cost )
+ * The insertion cost is lastColumnInsertionCost in the last column and cost elsewhere, and the
+ * substitution cost is 0 if the bases match and cost otherwise. Row 0 is all zeros and column 0
+ * holds rowBaseScores. */
+{
+	// Upper case cLR; row r holds rowBases[r-1]
+	const char* rowBases;
+	// Upper case reference, reversed; column c holds reversedColumnBases[columns-1-c]. This is the
+	// substitution profile of the reference: along an anti-diagonal its bases are read in order.
+	const char* reversedColumnBases;
+	const int32_t* deletionCosts;
+	const int32_t* rowBaseScores;
+	int64_t rows;
+	int64_t columns;
+	int32_t cost;
+	int32_t lastColumnInsertionCost;
+};
+
+int64_t antiDiagonalLength(int64_t diagonal, int64_t rows, int64_t columns);
+/* Returns the number of cells on the given anti-diagonal (row + column) of a rows x columns matrix. */
+
+// Fewest cells of an anti-diagonal that fillAntiDiagonals gives each of its threads
+const int64_t antiDiagonalPartCells = 2048;
+
+int64_t fillAntiDiagonals(const AntiDiagonalProblem &problem, const std::vector<int64_t> &diagonalStart,
+                          std::vector<uint64_t> &operations, int64_t threads = 1);
+/* Fills the DP matrix of the problem one anti-diagonal at a time, using AVX-512 or AVX2 when the CPU
+ * has them. Records the backtracking operation of every cell in 2 bits, cells ordered by anti-diagonal
+ * and then by row, with diagonal d starting at cell diagonalStart[d]. The operation is the first of
+ * deletion (1), insertion (2) and substitution (3) that gives the cell's score. Returns the score of
+ * the bottom right cell. The anti-diagonals of at least 2*antiDiagonalPartCells cells are split between
+ * the calling thread and up to threads - 1 more. */
+
+// Moves the rows of a read in the batched kernel may take
+enum BatchRowRule
+{
+	AllowDeletion = 1,
+	// Deletions only where the uLR has a gap
+	AllowDeletionAtUlrGap = 2,
+	// Deletions of reference gaps are free
+	FreeDeletionAtRefGap = 4,
+	AllowInsertion = 8,
+	AllowSubstitution = 16,
+	// Substitutions only where the uLR base is the cLR base
+	AllowSubstitutionAtUlrMatch = 32
+};
+
+struct BatchLane
+/* One read of the batched kernel, which fills the DP matrices of several reads at once, one read per
+ * vector lane. The recurrence of each cell is
+ *   D[r][c] = min( D[r][c-1] + deletion cost, D[r-1][c] + insertion cost, D[r-1][c-1] + substitution cost )
+ * over the moves the rules of row r allow, and is infinite if no move is allowed. The deletion cost is
+ * deletionCosts[r], the insertion cost is lastColumnInsertionCost in the last column and cost elsewhere,
+ * and the substitution cost is 0 if the bases match and cost otherwise. Row 0 holds columnBaseScores
+ * and column 0 holds rowBaseScores; either may be infinite (batchInfinity()). */
+{
+	// Upper case cLR; row r holds rowBases[r-1]
+	std::string rowBases;
+	// Upper case reference and uLR; column c holds columnBases[c-1] and ulrBases[c-1]
+	std::string columnBases;
+	std::string ulrBases;
+	// BatchRowRule bits, deletion costs and base scores of every row; index 0 is unused except for the
+	// base scores
+	std::vector<int32_t> rowRules;
+	std::vector<int32_t> deletionCosts;
+	std::vector<int32_t> rowBaseScores;
+	std::vector<int32_t> columnBaseScores;
+	int32_t cost;
+	int32_t lastColumnInsertionCost;
+	// Set by the kernel: the score of the bottom right cell, and whether it is finite
+	int32_t score;
+	bool reachable;
+};
+
+int32_t batchInfinity();
+/* Returns the score of unreachable cells in the batched kernel. Finite scores must stay below it. */
+
+int64_t batchLanes();
+/* Returns how many reads the batched kernel aligns at once. */
+
+void fillBatch(std::vector<BatchLane> &lanes, int64_t rows, int64_t columns, std::vector<uint32_t> &operations);
+/* Fills the DP matrices of up to batchLanes() reads at once, using AVX-512 or AVX2 when the CPU has them.
+ * rows and columns must be at least the largest matrix of the batch. The operation of cell (r,c) of lane
+ * l is stored in operations[r*columns + c]: bit l holds its low bit and bit 16+l its high bit, with
+ * deletion = 1, insertion = 2, substitution = 3 and 0 for unreachable cells. The operation is the first
+ * of deletion, insertion and substitution that gives the cell's score. */
+
+struct BitParallelBlock
+/* A block of rows of the unit cost edit distance recurrence
+ *   D[r][c] = min( D[r][c-1] + 1, D[r-1][c] + 1, D[r-1][c-1] + (bases match ? 0 : 1) )
+ * that lies under a filled row and right of a filled column. The block is given by the differences
+ * between neighbouring scores along these two boundaries, which must all be -1, 0 or 1. */
+{
+	// Upper case base of each row and of each column of the block
+	const char* rowBases;
+	int64_t rows;
+	const char* columnBases;
+	int64_t width;
+	// D[top][c] - D[top][c-1] for each column c of the block, along the row above it
+	const int8_t* topDeltas;
+	// D[r][left] - D[r-1][left] for each row r of the block, down the column left of it
+	const int8_t* leftDeltas;
+};
+
+void fillBitParallel(const BitParallelBlock &block, uint8_t* operations, int64_t firstCell, int64_t rowStride,
+                     std::vector<int8_t> &bottomDeltas, std::vector<int8_t> &rightDeltas);
+/* Fills a block with Myers' bit-vector algorithm, 64 cells per word operation. The operation of every cell
+ * is recovered from the bit vectors and stored in 2 bits at cell firstCell + row*rowStride + column of
+ * operations, four cells to a byte, with the codes and priorities of the anti-diagonal kernel. The
+ * operations need 24 bytes past their last cell. Returns the differences along the last row of the block
+ * in bottomDeltas (like topDeltas) and down its last column in rightDeltas (like leftDeltas). */
+
+#endif // KERNELS_H
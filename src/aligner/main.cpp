@@ -1,19 +1,26 @@
 #include <iostream>
 #include <fstream>
+#include <sstream>
 #include <string>
 #include <vector>
+#include <algorithm>
 #include <string.h>
 #include <unistd.h>
+#include <getopt.h>
 #include <cassert>
 // For multithreading
-#include <future>
 #include <thread>
+#include <atomic>
+#include <chrono>
+// For std::unique_ptr
+#include <memory>
 // For std::exit
 #include <cstdlib>
 
 #include "data.hpp"
 #include "alignments.hpp"
 #include "measures.hpp"
+#include "queues.hpp"
 
 enum CorrectedReadType {Trimmed,Untrimmed};
 enum ExtensionType {Extended,Unextended};
@@ -27,267 +34,351 @@ std::string g_outputPath = "";
 // Corrected read type
 CorrectedReadType g_trimType = Untrimmed;
 ExtensionType g_extensionType = Unextended;
-
-std::vector< Read_t > getReadsFromMafAndFasta()
-/* Get reference sequence, corrected and uncorrected reads from MAF and FASTA files.
- * Assumes reads are in the same order in MAF and FASTA files. 
- * Outputs
- * - reads: vector of Read_t objects
- */
+// How the DP matrix of each read is filled
+EngineType g_engine = FullMatrix;
+// Only count the stats of the alignments instead of building them
+bool g_countingOnly = false;
+// Stats file written by the run mode alongside the MAF file
+std::string g_statsPath = "";
+// Write the 3-way MAF file as BGZF, with an index of the virtual offset of each read
+bool g_bgzfOutput = false;
+// Bytes the DP structures of all threads may take together; 0 uses the physical memory
+int64_t g_maxMemory = 0;
+// Every read reserves the footprint of its engine from this budget before filling its matrix
+std::unique_ptr<MemoryBudget> g_memoryBudget;
+// Reads whose reference and cLR are both at most this long are aligned in batches, several reads
+// at once in the lanes of the vector unit
+int64_t g_maxBatchedLength = 5000;
+// Reads whose DP matrix has at least this many cells are filled in tiles by the threads that have
+// run out of reads to align; g_idleThreads counts those threads
+int64_t g_wavefrontCells = 16 << 20;
+// A thread gives back the DP buffers of an unusually long read once this many reads in a row have
+// needed much less
+int64_t g_shrinkAfterReads = 256;
+std::atomic<int64_t> g_idleThreads (0);
+// The input is read in windows of at most this many reads and bases, which are scheduled longest
+// read first
+int64_t g_windowReads = 4096;
+int64_t g_windowBases = 64 << 20;
+// Most reads in a chunk, the unit of work of the aligning threads
+int64_t g_chunkReads = 256;
+// The MAF and FASTA files are cut into parts of about this many bytes of text, which are parsed by
+// several threads at once
+int64_t g_partBytes = 8 << 20;
+
+struct ReadChunk
+/* Reads of a window of the input that are aligned together. index numbers the chunks in the order
+ * they are handed out; positions holds the place of each read in its window. */
 {
-	// Open the MAF and FASTA files
-	std::ifstream mafInput (g_mafInputName, std::ios::in);
-	std::ifstream clrInput (g_clrName, std::ios::in);
-
-	if (!mafInput.is_open()) {
-		std::cerr << "Unable to open maf input file\n";
-		std::exit(1);
-	}	
-
-	if (!clrInput.is_open()) {
-		std::cerr << "Unable to open corrected long reads file\n";
-		std::exit(1);
-	}	
-
-	std::string mafLine;
-	std::string clrLine;
-
-	std::vector< Read_t > reads;
-
-	// First, collect all the reads from the FASTA and MAF files
-	// The get line in the while loop conditional skips the empty "a" line in the MAF line
-	// and the header line in the FASTA file.
-	while (std::getline(mafInput, mafLine) && std::getline(clrInput, clrLine)) {
-		// Read ref line
-		std::getline(mafInput, mafLine);
-
-		std::vector<std::string> mafTokens = split(mafLine);	
-
-		assert( mafTokens.size() == 7 );
-
-		std::string ref = mafTokens.at(6);			
-		std::string refOrient = mafTokens.at(4);
-		std::string start = mafTokens.at(2);
-		std::string srcSize = mafTokens.at(5);
-
-		// Read ulr line
-		std::getline(mafInput, mafLine);
-
-		mafTokens = split(mafLine);	
-
-		assert( mafTokens.size() == 7 );
-
-		std::string ulr = mafTokens.at(6);
-		std::string readName = mafTokens.at(1);
-		// read number of the current read
-		int64_t readMafNum = atoi( readName.c_str() );
-		std::string readOrient = mafTokens.at(4);
-
-		//Skip line 
-		std::getline(mafInput, mafLine); 
-
-		ReadInfo readInfo;
-
-		readInfo.name = readName;
-		readInfo.refOrient = refOrient;
-		readInfo.readOrient = readOrient;
-		readInfo.start = start;
-		readInfo.srcSize = srcSize;
-
-		std::getline(clrInput, clrLine);
-		std::string clr = clrLine;
-
-		Read_t read;
-		read.ref = ref;	
-		read.ulr = ulr;
-		read.clr = clr;
-		read.readInfo = readInfo;
-
-		reads.push_back(read);
-	}
-
-	mafInput.close();
-	clrInput.close();
-
-	return reads;
-}
+	int64_t index;
+	std::vector<Read_t> reads;
+	std::vector<int64_t> positions;
+	// Number of reads and chunks of the window
+	int64_t windowReads;
+	int64_t windowChunks;
+};
+
+struct ParseTask
+/* A part of the MAF or of the FASTA file for a parsing thread */
+{
+	bool isMaf;
+	TextPart part;
+};
 
-std::vector< std::vector<Read_t> > partitionReads( std::vector< Read_t > &reads ) 
-/* Partitions the reads into g_threads number of partitions
- */
+struct WorkerTime
+/* Time a thread spent aligning, to check how evenly the work was spread */
 {
-	// Holds individual partitions of reads
-	std::vector< Read_t > readsPartition;
-	// Holds all partitions of reads
-	std::vector< std::vector<Read_t> > partitions;
-	std::vector< Read_t >::iterator iter = reads.begin();
-
-	// Size of partition
-	int64_t partitionSize = reads.size() / g_threads;
-	// Number of partitions that will have partitionSize + 1 number of reads
-	int64_t extra = reads.size() % g_threads;
-
-	// Partition the reads
-	for (int64_t i = 0; i < g_threads; i++) {
-		int64_t offset = partitionSize + (i < extra ? 1 : 0);
-		readsPartition.assign(iter, iter + offset);
-		partitions.push_back(readsPartition);	
-		iter += offset;
-	}
-
-	return partitions;
-}
+	double busySeconds = 0;
+	int64_t alignedReads = 0;
+};
 
-Read_t findAlignment( Read_t &unalignedReads ) 
-/* Align the reference, uncorrected and corrected read.
+std::unique_ptr<Alignments> createAlignments()
+/* Returns the alignment object matching the trim and extension type of the run.
  */
 {
-	Read_t alignedReads;
-	// Use a different alignment object depending on the trim and extension type
+	std::unique_ptr<Alignments> alignment;
 	if (g_trimType == Trimmed) {
 		if (g_extensionType == Extended) {
-			ExtendedTrimmedAlignments alignment;
-			alignedReads = alignment.align(unalignedReads.ref, unalignedReads.ulr, unalignedReads.clr);
+			alignment.reset( new ExtendedTrimmedAlignments() );
 		} else {
-			TrimmedAlignments alignment;
-			alignedReads = alignment.align(unalignedReads.ref, unalignedReads.ulr, unalignedReads.clr);
+			alignment.reset( new TrimmedAlignments() );
 		} 
 	} else {
 		if (g_extensionType == Extended) {
-			ExtendedUntrimmedAlignments alignment;
-			alignedReads = alignment.align(unalignedReads.ref, unalignedReads.ulr, unalignedReads.clr);
+			alignment.reset( new ExtendedUntrimmedAlignments() );
 		} else {
-			UntrimmedAlignments alignment;
-			alignedReads = alignment.align(unalignedReads.ref, unalignedReads.ulr, unalignedReads.clr);
+			alignment.reset( new UntrimmedAlignments() );
 		}
 	}
+	// Reads default to the vectorized kernels, which give the same alignments as the full matrix
+	if (g_trimType == Trimmed and g_engine == FullMatrix) {
+		alignment->setEngine(AntiDiagonal);
+	} else if (g_trimType == Trimmed and g_engine == Banded) {
+		// Trimmed segments do not follow the diagonal; each one gets a band around its own place
+		alignment->setEngine(Anchored);
+	} else if (g_trimType == Untrimmed and g_engine == FullMatrix) {
+		// Only fills the cells between the uncorrected anchors, or falls back to the bit-parallel kernel
+		alignment->setEngine(Segmented);
+	} else {
+		alignment->setEngine(g_engine);
+	}
+	alignment->setMemoryLimit(g_memoryBudget->totalBytes());
+	alignment->setMemoryBudget(g_memoryBudget.get());
+	alignment->setWavefront(g_wavefrontCells, &g_idleThreads);
+	alignment->setWorkspaceShrinking(g_shrinkAfterReads);
+	alignment->setCountingOnly(g_countingOnly);
+	return alignment;
+}
+
+Read_t findAlignment( Alignments &alignment, Read_t &unalignedReads ) 
+/* Align the reference, uncorrected and corrected read.
+ */
+{
+	Read_t alignedReads = alignment.align(unalignedReads.ref, unalignedReads.ulr, unalignedReads.clr);
 	alignedReads.readInfo = unalignedReads.readInfo;
 	return alignedReads;
 }
 
-std::vector<Read_t> alignReads( std::vector<Read_t> reads )
-/* Align partitions of reads
- */
+bool isBatchedRead( Read_t &read )
+/* Short reads are aligned in batches unless the user picked an engine */
 {
-	std::vector<Read_t> alignments;
-	// Align one read after the other
-	for (int64_t i = 0; i < reads.size(); i++) {
-		Read_t unalignedReads = reads.at(i);
-		Read_t alignedReads = findAlignment(unalignedReads);
-		alignments.push_back(alignedReads);
-	}
-	return alignments;
+	return g_engine == FullMatrix and read.ref.length() <= g_maxBatchedLength and
+	       read.clr.length() <= g_maxBatchedLength;
 }
 
-void generateMaf()
-/* Generates a three-way MAF file between the reference, uncorrected and corrected reads
+std::vector<Read_t> alignReads( Alignments &alignment, std::vector<Read_t> &reads )
+/* Align a chunk of reads
  */
 {
-	// Read the MAF and cLR FASTA file
-	std::cout << "Reading MAF and FASTA files...\n";
-	std::vector< Read_t > reads = getReadsFromMafAndFasta(); 
-
-	// Split the reads vector into g_threads equally sized partition(s) contained in a vector of 
-	// Read_t vectors
-	std::cout << "Partitioning reads...\n";
-	std::vector< std::vector<Read_t> > partitions = partitionReads(reads);
-
-	// Process each partition separately in its own thread 
-	std::cout << "Aligning " << ::g_threads << " partitions of reads concurrently...\n";
-	std::vector< std::future< std::vector<Read_t> > > partitionThread;
-	
-	// Only create g_threads - 1 new threads; work will also be done on the main thread
-	for (int64_t i = 1; i < partitions.size(); i++) {
-		partitionThread.push_back( std::async(std::launch::async, alignReads, 
-			partitions.at(i)) );
-	} 
-
-	// Once the threads have finished doing their thing, get all the aligned partitions of reads
-	std::vector< std::vector<Read_t> > alignedPartitions;
+	std::vector<Read_t> alignments (reads.size());
+	std::vector<int64_t> batchedReads;
 
-	// Perform work in this thread, too
-	alignedPartitions.push_back( alignReads( partitions.at(0) ) );
+	// Align long reads one after the other
+	for (int64_t i = 0; i < reads.size(); i++) {
+		if (isBatchedRead( reads.at(i) )) {
+			batchedReads.push_back(i);
+		} else {
+			alignments.at(i) = findAlignment(alignment, reads.at(i));
+		}
+	}
 
-	for (int64_t i = 0; i < partitionThread.size(); i++) {
-		alignedPartitions.push_back( partitionThread.at(i).get() );
+	// Sort the short reads by size, so that the reads of a batch have matrices of similar size
+	std::stable_sort(batchedReads.begin(), batchedReads.end(), [&reads](int64_t first, int64_t second) {
+		return reads.at(first).ref.length() + reads.at(first).clr.length() <
+		       reads.at(second).ref.length() + reads.at(second).clr.length();
+	});
+
+	int64_t lanes = batchLanes();
+	for (int64_t batchStart = 0; batchStart < batchedReads.size(); batchStart += lanes) {
+		int64_t batchEnd = std::min(batchStart + lanes, (int64_t) batchedReads.size());
+		std::vector<Read_t> batch;
+		for (int64_t i = batchStart; i < batchEnd; i++) {
+			batch.push_back( reads.at( batchedReads.at(i) ) );
+		}
+		std::vector<Read_t> alignedBatch = alignment.alignBatch(batch);
+		for (int64_t i = batchStart; i < batchEnd; i++) {
+			alignments.at( batchedReads.at(i) ) = alignedBatch.at(i - batchStart);
+			alignments.at( batchedReads.at(i) ).readInfo = reads.at( batchedReads.at(i) ).readInfo;
+		}
 	}
-	
-	// Write the alignments to MAF file
-	std::cout << "Writing alignments to MAF file...\n";
-	MafFile mafOutput(g_outputPath);
-
-	for (int64_t vectorIndex = 0; vectorIndex < alignedPartitions.size(); vectorIndex++) {
-		std::vector< Read_t > partition = alignedPartitions.at(vectorIndex);	
-		for (int64_t partitionIndex = 0; partitionIndex < partition.size(); partitionIndex++) {
-			Read_t reads = partition.at(partitionIndex);
-			mafOutput.addReads( reads );
-		} 
+	// The run mode writes the stats of every alignment too; count them here, on this thread, rather than
+	// when writing them
+	if (g_statsPath != "" and not g_countingOnly) {
+		for (Read_t &alignedReads : alignments) {
+			alignedReads.counts = countAlignment(alignedReads.ref, alignedReads.ulr, alignedReads.clr);
+		}
 	}
-	std::cout << "Three-way MAF file construction complete.\n";
+	return alignments;
 }
 
-std::vector<int64_t> untrimmedReadStats(std::string ref, std::string cRead, int64_t cSize, std::string uRead, int64_t uSize)
-/* Collects untrimmed read statistics 
+int64_t alignmentCost( const Read_t &read )
+/* Estimated work of aligning a read: the cells of its DP matrix
  */
 {
-	std::vector<int64_t> statistics;
-
-	// Length of the sequences only, sans gaps
-	statistics.push_back(cSize);
-	statistics.push_back(uSize);
-
-	// Length of the alignment
-	int64_t alignmentLength = boundarylessLength(cRead);
-	statistics.push_back( alignmentLength );
-
-	// Find the number of mutations for the corrected and uncorrected reads
-	statistics.push_back( getDeletions(ref,cRead) );
-	statistics.push_back( getInsertions(ref,cRead) );
-	statistics.push_back( getSubstitutions(ref,cRead) );
-
-	statistics.push_back( getDeletions(ref,uRead) );
-	statistics.push_back( getInsertions(ref,uRead) );
-	statistics.push_back( getSubstitutions(ref,uRead) );
-
-	return statistics;
+	return (int64_t) (read.ref.length() + 1) * (int64_t) (read.clr.length() + 1);
 }
 
-std::vector<int64_t> trimmedReadStats(CorrespondingSegments segments)
-/* Collects trimmed read statistics 
+void scheduleWindow( std::vector<Read_t> &window, int64_t &chunkIndex, BoundedQueue<ReadChunk> *chunks )
+/* Hands out a window of reads longest first, so that the threads finish it together rather than
+ * waiting on one long read picked up last. Each chunk takes reads until it holds its share of the
+ * window's work, so long reads get a chunk of their own and short ones are grouped.
  */
 {
-	std::vector<int64_t> statistics;
-
-	std::string clr = segments.cReadSegment;
-	std::string ulr = segments.uReadSegment;
+	int64_t threads = std::max(g_threads, (int64_t) 1);
+	std::vector<int64_t> order (window.size());
+	int64_t windowCost = 0;
+	for (int64_t position = 0; position < window.size(); position++) {
+		order.at(position) = position;
+		windowCost += alignmentCost( window.at(position) );
+	}
+	std::stable_sort(order.begin(), order.end(), [&window](int64_t first, int64_t second) {
+		return alignmentCost( window.at(first) ) > alignmentCost( window.at(second) );
+	});
+
+	// A few chunks per thread, so that a thread that drew short reads can take another chunk
+	int64_t chunkCost = std::max(windowCost / (4*threads), (int64_t) 1);
+	std::vector<ReadChunk> windowChunks;
+	int64_t cost = chunkCost;
+	for (int64_t position : order) {
+		if (cost >= chunkCost or windowChunks.back().reads.size() >= g_chunkReads) {
+			windowChunks.push_back( ReadChunk() );
+			cost = 0;
+		}
+		cost += alignmentCost( window.at(position) );
+		windowChunks.back().reads.push_back( std::move( window.at(position) ) );
+		windowChunks.back().positions.push_back(position);
+	}
 
-	// Length of the sequences only, sans gaps
-	int64_t cLength = gaplessLength(clr);
-	statistics.push_back(cLength);
+	for (ReadChunk &chunk : windowChunks) {
+		chunk.index = chunkIndex++;
+		chunk.windowReads = window.size();
+		chunk.windowChunks = windowChunks.size();
+		chunks->push( std::move(chunk) );
+	}
+	window.clear();
+}
 
-	int64_t uLength = gaplessLength(ulr);
-	statistics.push_back(uLength);
+void parseParts( BoundedQueue<ParseTask> *tasks, ReorderBuffer< std::vector<Read_t> > *mafParts,
+                 ReorderBuffer< std::vector<std::string> > *clrParts )
+/* Parses parts of the MAF and FASTA files until there are no more to parse
+ */
+{
+	ParseTask task;
+	while (tasks->pop(task)) {
+		if (task.isMaf) {
+			std::vector<Read_t> reads;
+			parseMafPart(task.part, reads);
+			mafParts->put( task.part.index, std::move(reads) );
+		} else {
+			std::vector<std::string> clrs;
+			parseClrPart(task.part, clrs);
+			clrParts->put( task.part.index, std::move(clrs) );
+		}
+		// Lets go of the inflated text of the part
+		task = ParseTask();
+	}
+	mafParts->producerDone();
+	clrParts->producerDone();
+}
 
-	// Length of the alignments (i.e. sequences including gaps)
-	int64_t alignmentLength = clr.length();
-	statistics.push_back( alignmentLength );
+int64_t parsingThreads()
+/* Threads that parse the input alongside the aligning threads, and inflate it when it is compressed
+ */
+{
+	return std::max(g_threads / 4, (int64_t) 1);
+}
 
-	// Push the number of mutations in the corrected segments and its
-	// corresponding segment in the uncorrected long read
+bool requestPart( TextInput *input, bool isMaf, BoundedQueue<ParseTask> *tasks )
+/* Hands the next part of the MAF or FASTA file to the parsing threads; returns false at the end of the file
+ */
+{
+	ParseTask task;
+	task.isMaf = isMaf;
+	if (!input->nextPart(task.part)) {
+		return false;
+	}
+	tasks->push( std::move(task) );
+	return true;
+}
 
-	DeletionProportion delProp = getDeletionProportion( segments );
-	InsertionProportion insProp = getInsertionProportion( segments ); 
-	SubstitutionProportion subProp = getSubstitutionProportion( segments );
+void readChunks( TextInput *mafInput, TextInput *clrInput, BoundedQueue<ReadChunk> *chunks )
+/* Reads the MAF and FASTA files a window at a time into chunks of reads for the aligning threads.
+ * The parts of both files are parsed by a few threads at once; this thread only pairs the reads of the
+ * MAF parts with the cLRs of the FASTA parts, in file order. It asks for the parts of each file at most
+ * partsAhead ahead of the one it is pairing, so neither file is parsed much ahead of the other, however
+ * differently the two are cut, and the parsing threads never wait to hand in a part.
+ */
+{
+	int64_t parseThreads = parsingThreads();
+	int64_t partsAhead = 2*parseThreads;
+	BoundedQueue<ParseTask> tasks (2*partsAhead);
+	ReorderBuffer< std::vector<Read_t> > mafParts (partsAhead, parseThreads);
+	ReorderBuffer< std::vector<std::string> > clrParts (partsAhead, parseThreads);
+	std::vector<std::thread> parsers;
+	for (int64_t i = 0; i < parseThreads; i++) {
+		parsers.push_back( std::thread(parseParts, &tasks, &mafParts, &clrParts) );
+	}
+	int64_t mafRequested = 0;
+	int64_t clrRequested = 0;
+	while (mafRequested < partsAhead and requestPart(mafInput, true, &tasks)) {
+		mafRequested++;
+	}
+	while (clrRequested < partsAhead and requestPart(clrInput, false, &tasks)) {
+		clrRequested++;
+	}
 
-	statistics.push_back(delProp.cRead);
-	statistics.push_back(insProp.cRead);
-	statistics.push_back(subProp.cRead);
+	std::vector<Read_t> window;
+	int64_t bases = 0;
+	int64_t chunkIndex = 0;
+	std::vector<Read_t> reads;
+	std::vector<std::string> clrs;
+	int64_t clrIndex = 0;
+	int64_t clrPart = 0;
+	bool paired = true;
+	for (int64_t mafPart = 0; paired and mafPart < mafRequested; mafPart++) {
+		reads.clear();
+		mafParts.take(reads);
+		if (requestPart(mafInput, true, &tasks)) {
+			mafRequested++;
+		}
+		for (Read_t &read : reads) {
+			while (clrIndex == clrs.size() and clrPart < clrRequested) {
+				clrs.clear();
+				clrParts.take(clrs);
+				if (requestPart(clrInput, false, &tasks)) {
+					clrRequested++;
+				}
+				clrPart++;
+				clrIndex = 0;
+			}
+			// A read needs both its MAF block and its cLR, so stop at the end of either file
+			if (clrIndex == clrs.size()) {
+				paired = false;
+				break;
+			}
+			read.clr = std::move( clrs.at(clrIndex++) );
+			bases += read.ref.length() + read.clr.length();
+			window.push_back( std::move(read) );
+			if (window.size() >= g_windowReads or bases >= g_windowBases) {
+				scheduleWindow(window, chunkIndex, chunks);
+				bases = 0;
+			}
+		}
+	}
+	if (!window.empty()) {
+		scheduleWindow(window, chunkIndex, chunks);
+	}
+	chunks->close();
 
-	statistics.push_back(delProp.uRead);
-	statistics.push_back(insProp.uRead);
-	statistics.push_back(subProp.uRead);
+	// Parts asked for past the end of the shorter file are parsed and dropped
+	tasks.close();
+	for (std::thread &parser : parsers) {
+		parser.join();
+	}
+}
 
-	return statistics;
+void alignChunks( BoundedQueue<ReadChunk> *chunks, ReorderBuffer<ReadChunk> *alignedChunks, WorkerTime *time )
+/* Aligns chunks of reads until there are no more
+ */
+{
+	// One alignment object per thread, so its DP workspace is reused from one read to the next
+	std::unique_ptr<Alignments> alignment = createAlignments();
+	ReadChunk chunk;
+	while (chunks->pop(chunk)) {
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		chunk.reads = alignReads(*alignment, chunk.reads);
+		time->busySeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		time->alignedReads += chunk.reads.size();
+		// Waiting for earlier chunks can take a while; do it without holding any of the memory budget,
+		// which the threads aligning them may need
+		if (!alignedChunks->fits(chunk.index)) {
+			alignment->releaseMemory();
+		}
+		alignedChunks->put( chunk.index, std::move(chunk) );
+	}
+	// This thread is free to help with the large reads of the other threads
+	g_idleThreads++;
+	alignedChunks->producerDone();
 }
 
 std::string stripReadIdSuffix(std::string readId)
@@ -303,27 +394,10 @@ std::string stripReadIdSuffix(std::string readId)
 	return strippedReadId;
 }
 
-void createStats()
-/* Given a 3-way MAF file between cLR, uLR and ref sequences, outputs a text file containing stats
+void writeStatsHeader(std::ofstream &output)
+/* Writes the legend and the header line of the stats file
  */
 {
-	std::ifstream mafFile (g_mafInputName, std::ios::in);
-	std::ofstream output (g_outputPath, std::ios::out);
-	std::string line = "";
-
-	// Indices where each respective information lies in the MAF file line
-	int readIdIndex = 1;
-	int sizeIndex = 3; 
-	int seqIndex = 6;
-	// Number of statistics we consider
-	int numStatistics = 10;
-
-	// Skip first four lines
-	for (int i = 0; i < 4; i++) {
-		assert( !mafFile.eof() );	
-		std::getline(mafFile, line); 
-	} 
-
 	//write the legend
 	std::string legend = "# [Read ID]: The ID of the read. Takes on any string value.\n"
 		"# [Type]: If 't', indicates that the statistics are for only corrected segments of the read.\n"
@@ -342,66 +416,249 @@ void createStats()
 	// write the header line
 	std::string header = "# [Read ID] [Type] [cLR Length] [uLR Length] [Alignment Length] [cLR Del] [cLR Ins] [cLR Sub] [uLR Del] [uLR Ins] [uLR Sub]";
 	output << header << std::endl;
+}
 
-	// The getline in the while loop condition skips the "a" line
-	while (std::getline(mafFile, line)) {
-		// Read ref line
-		std::getline(mafFile, line);
-
-		std::string ref = split(line).at(seqIndex);
-
-		// Read ulr line
-		std::getline(mafFile, line);
+void writeStatistics(std::ostream &output, std::string readId, std::string type, std::vector<int64_t> statistics)
+/* Writes one line of the stats file; type is u for a whole untrimmed read and t for a corrected segment
+ */
+{
+	output << readId << " ";
+	output << type << " ";
+	for (int index = 0; index < statistics.size(); index++) {
+		output << statistics.at(index) << " ";
+	}
+	output << "\n";
+}
 
-		std::vector< std::string > tokens = split(line);
+std::string partStatistics(const char *begin, const char *end)
+/* Returns the lines of the stats file for the blocks of a part of a 3-way MAF file between cLR, uLR
+ * and ref sequences. The alignments are counted where they lie in the mapped file.
+ */
+{
+	LineScanner lines (begin, end);
+	std::ostringstream output;
+	StringView line;
+	std::vector<StringView> tokens;
 
-		std::string readId = tokens.at(readIdIndex);
-		readId = stripReadIdSuffix(readId); 
+	// Indices where each respective information lies in the MAF file line
+	int readIdIndex = 1;
+	int sizeIndex = 3; 
+	int seqIndex = 6;
 
-		std::string ulr = tokens.at(seqIndex);
+	// The line read in the while loop condition skips the "a" line
+	while (lines.nextLine(line)) {
+		// Read ref line
+		lines.nextLine(line);
+		splitView(line, tokens);
+		StringView ref = tokens.at(seqIndex);
 
-		int64_t ulrSize = atoi( split(line).at(sizeIndex).c_str() );
+		// Read ulr line
+		lines.nextLine(line);
+		splitView(line, tokens);
+		std::string readId = stripReadIdSuffix( tokens.at(readIdIndex).toString() );
+		StringView ulr = tokens.at(seqIndex);
+		int64_t ulrSize = strtoll(tokens.at(sizeIndex).data, NULL, 10);
 
 		// Read clr line
-		std::getline(mafFile, line);
-
-		std::string clr = split(line).at(seqIndex);	
-
-		int64_t clrSize = atoi( split(line).at(sizeIndex).c_str() );
+		lines.nextLine(line);
+		splitView(line, tokens);
+		StringView clr = tokens.at(seqIndex);
+		int64_t clrSize = strtoll(tokens.at(sizeIndex).data, NULL, 10);
 
 		// Skip last line, which is empty 
-		std::getline(mafFile, line);
+		lines.nextLine(line);
+
+		assert( ref.length == ulr.length and ref.length == clr.length );
+		ReadCounts counts = countAlignment(ref.data, ulr.data, clr.data, ref.length);
 
-		// If the read type if untrimmed, then do untrimmed statistics 
+		// If the read type if untrimmed, then do untrimmed statistics; the lengths of the reads are
+		// the sizes given in the MAF file
 		if (g_trimType == Untrimmed) {
-			std::vector<int64_t> statistics = untrimmedReadStats(ref,clr,clrSize,ulr,ulrSize);
-			output << readId << " ";
-			output << "u ";
-			for (int index = 0; index < statistics.size(); index++) {
-				output << statistics.at(index) << " ";
-			} 
-			output << "\n";
+			counts.read.cLength = clrSize;
+			counts.read.uLength = ulrSize;
+			writeStatistics(output, readId, "u", countedStatistics(counts.read));
 		}
 
 		// Write trimmed read statistics
-		std::vector<CorrespondingSegments> correspondingSegmentsList = getCorrespondingSegmentsList(clr,ulr,ref);
-
-		for (int index = 0; index < correspondingSegmentsList.size(); index++) {
-			CorrespondingSegments segments = correspondingSegmentsList.at(index);
-			std::vector<int64_t> statistics = trimmedReadStats(segments);
-			output << readId << " ";
-			output << "t ";
-			for (int i = 0; i < statistics.size(); i++) {
-				output << statistics.at(i) << " ";
-			}
-			output << "\n";
+		for (const MutationCounts &segment : counts.segments) {
+			writeStatistics(output, readId, "t", countedStatistics(segment));
 		}
 	}
 
-	mafFile.close();
+	return output.str();
+}
+
+void countParts( TextInput *input, ReorderBuffer<std::string> *partStats )
+/* Counts the stats of parts of the MAF file until there are no more; parts are taken in file order, so
+ * the earliest part still to write is always being counted
+ */
+{
+	TextPart part;
+	while (input->nextPart(part)) {
+		partStats->put( part.index, partStatistics(part.begin, part.end) );
+	}
+	partStats->producerDone();
+}
+
+void createStats()
+/* Given a 3-way MAF file between cLR, uLR and ref sequences, outputs a text file containing stats.
+ * The MAF file, plain, gzip or BGZF, is cut into parts at its blocks, g_threads threads count the parts
+ * and this thread writes their stats in file order.
+ */
+{
+	int64_t threads = std::max(g_threads, (int64_t) 1);
+	// The parts start at the first "a" line, after the header lines. Counting is quick next to inflating,
+	// so a compressed file is inflated by as many threads as count it.
+	TextInput mafInput (g_mafInputName, 'a', g_partBytes, threads);
+	if (!mafInput.isOpen()) {
+		std::cerr << "Unable to open maf input file\n";
+		std::exit(1);
+	}
+	std::ofstream output (g_outputPath, std::ios::out);
+	writeStatsHeader(output);
+
+	ReorderBuffer<std::string> partStats (2*threads, threads);
+	std::vector<std::thread> workers;
+	for (int64_t i = 0; i < threads; i++) {
+		workers.push_back( std::thread(countParts, &mafInput, &partStats) );
+	}
+	std::string stats;
+	while (partStats.take(stats)) {
+		output << stats;
+	}
+	for (int64_t i = 0; i < workers.size(); i++) {
+		workers.at(i).join();
+	}
+
 	output.close();
 }
 
+void writeCountedStats(std::ostream &output, const Read_t &read)
+/* Writes the stats of an aligned read from its counts
+ */
+{
+	// The stats mode takes the read ID from the uLR name of the MAF, up to its first '.'
+	std::string readId = stripReadIdSuffix(read.readInfo.name + ".uLR");
+	if (g_trimType == Untrimmed) {
+		writeStatistics(output, readId, "u", countedStatistics(read.counts.read));
+	}
+	for (const MutationCounts &segment : read.counts.segments) {
+		writeStatistics(output, readId, "t", countedStatistics(segment));
+	}
+}
+
+void processReads( bool writeMaf, std::string statsPath )
+/* Streams the reads of the MAF and FASTA files through the aligning threads: one thread reads them in
+ * chunks into a bounded queue, pairing the reads that a few more threads parse, g_threads threads align
+ * the chunks, and this thread writes the aligned reads in input order as soon as their window is done.
+ * Only a window, a few parts of the input and a few chunks per thread are held at any time, whatever
+ * the size of the input.
+ */
+{
+	int64_t threads = std::max(g_threads, (int64_t) 1);
+	TextInput mafInput (g_mafInputName, 'a', g_partBytes, parsingThreads());
+	TextInput clrInput (g_clrName, '>', g_partBytes, parsingThreads());
+	if (!mafInput.isOpen() or !clrInput.isOpen()) {
+		std::cerr << "Unable to open maf input file or corrected long reads file\n";
+		std::exit(1);
+	}
+
+	std::unique_ptr<MafFile> mafOutput;
+	if (writeMaf) {
+		// As many compression threads as aligning threads; they wait while there is nothing to compress
+		mafOutput.reset( new MafFile(g_outputPath, g_bgzfOutput ? threads : 0) );
+	}
+	std::ofstream statsOutput;
+	if (statsPath != "") {
+		statsOutput.open(statsPath, std::ios::out);
+		writeStatsHeader(statsOutput);
+	}
+
+	BoundedQueue<ReadChunk> chunks (2*threads);
+	ReorderBuffer<ReadChunk> alignedChunks (4*threads, threads);
+
+	std::cout << "Aligning reads with " << threads << " threads...\n";
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	std::vector<WorkerTime> workerTimes (threads);
+	std::thread reader (readChunks, &mafInput, &clrInput, &chunks);
+	std::vector<std::thread> workers;
+	for (int64_t i = 0; i < threads; i++) {
+		workers.push_back( std::thread(alignChunks, &chunks, &alignedChunks, &workerTimes.at(i)) );
+	}
+
+	// The chunks come in the order they were handed out; put their reads back in input order and write
+	// each window once all of its chunks are in
+	std::vector<Read_t> window;
+	int64_t missingChunks = 0;
+	ReadChunk chunk;
+	while (alignedChunks.take(chunk)) {
+		if (missingChunks == 0) {
+			window.resize(chunk.windowReads);
+			missingChunks = chunk.windowChunks;
+		}
+		for (int64_t i = 0; i < chunk.reads.size(); i++) {
+			window.at( chunk.positions.at(i) ) = std::move( chunk.reads.at(i) );
+		}
+		missingChunks--;
+		if (missingChunks > 0) {
+			continue;
+		}
+		for (const Read_t &read : window) {
+			if (writeMaf) {
+				mafOutput->addReads(read);
+			} else if (not read.alignmentSuccessful) {
+				std::cout << "Failed to align read " << read.readInfo.name << ".\n";
+			}
+			if (statsPath != "" and read.alignmentSuccessful) {
+				writeCountedStats(statsOutput, read);
+			}
+		}
+		window.clear();
+	}
+
+	reader.join();
+	for (int64_t i = 0; i < workers.size(); i++) {
+		workers.at(i).join();
+	}
+
+	// Threads that were busy for much less of the run than the others point at an uneven schedule
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	for (int64_t i = 0; i < workerTimes.size(); i++) {
+		std::cout << "Thread " << i << " aligned " << workerTimes.at(i).alignedReads << " reads in "
+		          << workerTimes.at(i).busySeconds << " s, busy "
+		          << (int64_t) (100 * workerTimes.at(i).busySeconds / std::max(seconds, 1e-9)) << "% of "
+		          << seconds << " s\n";
+	}
+}
+
+void generateMaf()
+/* Generates a three-way MAF file between the reference, uncorrected and corrected reads
+ */
+{
+	processReads(true, "");
+	std::cout << "Three-way MAF file construction complete.\n";
+}
+
+void generateCounts()
+/* Writes the stats file of the reads of the MAF and FASTA files without building their 3-way alignments;
+ * the traceback counts the mutations of each read directly
+ */
+{
+	g_countingOnly = true;
+	processReads(false, g_outputPath);
+	std::cout << "Statistics complete.\n";
+}
+
+void generateRun()
+/* Writes the 3-way MAF file and its stats file in one pass. The stats are counted as soon as each read
+ * is aligned, so the MAF file is not read back; without a MAF output path only the stats are written.
+ */
+{
+	g_countingOnly = g_outputPath == "";
+	processReads(g_outputPath != "", g_statsPath);
+	std::cout << "Three-way MAF file and statistics complete.\n";
+}
+
 void displayHelp()
 {
 	std::cout << "This program has two functions: outputting three way MAF alignments between corrected long reads,\n";
@@ -410,15 +667,65 @@ void displayHelp()
 	std::cout << "long reads are trimmed and MAF file creation mode is chosen, the three way alignments will contain\n";
 	std::cout << "triples of the form (X,-,-) (where the bases correspond to the cLR, uLR and ref, respectively)\n";
 	std::cout << "that indicates the boundaries of the original individual trimmed long read segments.\n";
+	std::cout << "Reads whose DP matrix would not fit in what is left of the memory budget are aligned with\n";
+	std::cout << "2 bits of traceback per cell or in linear space, which take longer.\n";
+	std::cout << "Uncorrected bases of untrimmed reads must match the uLR, so only a band of the DP matrix is\n";
+	std::cout << "filled: the few diagonals each uncorrected run can lie on and, between them, the uLR window\n";
+	std::cout << "each corrected segment spans; mostly uncorrected reads are therefore aligned much faster.\n";
+}
+
+int64_t parseBytes(std::string size)
+/* Parses a number of bytes with an optional K, M or G suffix; returns -1 if it is not one. */
+{
+	char *end;
+	int64_t bytes = strtoll(size.c_str(), &end, 10);
+	std::string suffix = end;
+	if (end == size.c_str() or bytes <= 0) {
+		return -1;
+	}
+	if (suffix == "K" or suffix == "k") {
+		bytes = bytes << 10;
+	} else if (suffix == "M" or suffix == "m") {
+		bytes = bytes << 20;
+	} else if (suffix == "G" or suffix == "g") {
+		bytes = bytes << 30;
+	} else if (suffix != "") {
+		return -1;
+	}
+	return bytes;
 }
 
 void displayUsage()
 {
 		std::cout << "Usage: aligner [mode] [-m MAF input path] [-c cLR input path] [-t cLR are trimmed] "
-		      	  << "[-e cLR are extended] [-o output path] [-p number of threads]\n";
+		      	  << "[-e cLR are extended] [-o output path] [-p number of threads] [-b banded alignment] [-r traceback-only alignment]\n"
+			  << "       [-s score-bounded alignment]\n"
+			  << "       [-w minimum DP matrix size in millions of cells for filling it with idle threads]\n"
+			  << "       [--max-memory bytes for the DP matrices of all threads, with an optional K, M or G suffix]\n"
+			  << "       [--stats stats output path of the run mode] [--bgzf compressed MAF output]\n";
 		std::cout << "aligner maf to create 3-way MAF file\n";
 		std::cout << "aligner stats to perform statistics on MAF file\n";
-		std::cout << "Note: stats mode only uses 1 thread and ignores the -p option\n";
+		std::cout << "aligner counts to perform the same statistics directly on the 2-way MAF and cLR files,\n"
+			  << "   without building the 3-way MAF file\n";
+		std::cout << "aligner run to create the 3-way MAF file (-o, optional) and its statistics (--stats) in one pass\n";
+		std::cout << "The MAF and FASTA inputs may be plain text or compressed with gzip or bgzip; BGZF blocks are\n"
+			  << "   inflated by several threads at once\n";
+		std::cout << "Note: stats mode uses the -p threads to count parts of the MAF file at once\n";
+		std::cout << "-b only computes the DP matrix near the diagonal of untrimmed reads, widening the band\n"
+			  << "   until the alignment lies inside it; trimmed segments are placed on the reference by\n"
+			  << "   exact k-mer matches and only the DP matrix around each segment's place is computed\n";
+		std::cout << "-r keeps two rows of scores and 2 bits of traceback per cell instead of the full matrix\n";
+		std::cout << "-s only computes the cells of the DP matrix that score at most a bound, doubling it until\n"
+			  << "   the alignment is found; much faster for reads within about half a percent of the reference\n";
+		std::cout << "-w threads that have aligned their share of the reads help fill the DP matrix of reads with\n"
+			  << "   at least this many million cells (default 16), a tile of the matrix or a part of each\n"
+			  << "   anti-diagonal of trimmed reads at a time; the matrices of -r and -s, of reads over the memory\n"
+			  << "   budget and of untrimmed reads left to the bit-parallel kernel are filled by one thread\n";
+		std::cout << "--bgzf (or -z) writes the 3-way MAF file as BGZF, which bgzip -d and zcat read, with the virtual\n"
+			  << "   offset of each read's block in <output path>.idx, one \"read name\" \"offset\" line per read; seek\n"
+			  << "   to the block at offset >> 16 in the file and skip offset & 0xffff bytes of its text\n";
+		std::cout << "--max-memory (or -M) limits the DP matrices of all threads together (default: the physical\n"
+			  << "   memory); each read takes the fastest engine that fits in what is left, or waits for it\n";
 }
 
 int main(int argc, char *argv[])
@@ -433,7 +740,7 @@ int main(int argc, char *argv[])
 
 		std::string mode = argv[1];
 		
-		if (mode != "maf" and mode != "stats") {
+		if (mode != "maf" and mode != "stats" and mode != "counts" and mode != "run") {
 			std::cerr << "Please select a mode\n";
 			displayUsage();
 			return 1;
@@ -447,7 +754,14 @@ int main(int argc, char *argv[])
 
 	bool trimmed = false;
 
-	while ((opt = getopt(argc, argv, "m:c:o:hetp:")) != -1) {
+	static struct option longOptions[] = {
+		{"max-memory", required_argument, 0, 'M'},
+		{"stats", required_argument, 0, 'S'},
+		{"bgzf", no_argument, 0, 'z'},
+		{0, 0, 0, 0}
+	};
+
+	while ((opt = getopt_long(argc, argv, "m:c:o:hetp:brsw:M:S:z", longOptions, NULL)) != -1) {
 		switch (opt) {
 			case 'm':
 				// Source maf file name
@@ -477,6 +791,38 @@ int main(int argc, char *argv[])
 				// Number of threads to perform alignment
 				::g_threads = atoi(optarg);
 				break;
+			case 'b':
+				// Only fill a band around the diagonal of the DP matrix
+				g_engine = Banded;
+				break;
+			case 'r':
+				// Record the traceback operations instead of keeping the whole score matrix
+				g_engine = Traceback;
+				break;
+			case 's':
+				// Only fill the cells whose score is within a bound that grows with the alignment score
+				g_engine = ScoreBounded;
+				break;
+			case 'w':
+				// Size of the DP matrices that are filled by several threads
+				g_wavefrontCells = atoll(optarg) << 20;
+				break;
+			case 'M':
+				// Memory budget shared by the DP matrices of all threads
+				g_maxMemory = parseBytes(optarg);
+				if (g_maxMemory < 0) {
+					std::cerr << "ERROR: --max-memory takes a number of bytes with an optional K, M or G suffix\n";
+					return 1;
+				}
+				break;
+			case 'S':
+				// Stats output path of the run mode
+				g_statsPath = optarg;
+				break;
+			case 'z':
+				// Compress the MAF output
+				g_bgzfOutput = true;
+				break;
 			default:
 				std::cerr << "Error: unrecognized option.\n";
 				displayUsage();
@@ -492,11 +838,15 @@ int main(int argc, char *argv[])
 		std::cerr << "ERROR: MAF input path required\n";
 		optionsPresent = false;
 	}
-	if (g_outputPath == "") {
+	if (mode != "run" and g_outputPath == "") {
 		std::cerr << "ERROR: Output path required\n";
 		optionsPresent = false;
 	}
-	if (mode == "maf" and g_clrName == "") {
+	if (mode == "run" and g_statsPath == "") {
+		std::cerr << "ERROR: Stats output path required\n";
+		optionsPresent = false;
+	}
+	if ((mode == "maf" or mode == "counts" or mode == "run") and g_clrName == "") {
 		std::cerr << "ERROR: cLR input path required\n";
 		optionsPresent = false;
 	}
@@ -506,9 +856,19 @@ int main(int argc, char *argv[])
 		return 1;
 	}
 
-	// Create either a MAF file or find statistics from a three-way  MAF file
+	// All threads share one budget for their DP matrices, the physical memory unless one is given
+	if (g_maxMemory == 0) {
+		g_maxMemory = (int64_t) sysconf(_SC_PHYS_PAGES) * (int64_t) sysconf(_SC_PAGE_SIZE);
+	}
+	g_memoryBudget.reset(new MemoryBudget(g_maxMemory));
+
+	// Create a MAF file, find statistics from a three-way MAF file, or count them while aligning
 	if (mode == "maf") {
 		generateMaf();
+	} else if (mode == "counts") {
+		generateCounts();
+	} else if (mode == "run") {
+		generateRun();
 	} else {
 		createStats();				
 	}
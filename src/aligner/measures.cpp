@@ -126,6 +126,74 @@ int64_t getInsertions(std::string ref, std::string read)
 	return ins;
 }
 
+void countColumn(MutationCounts &counts, char refBase, char uBase, char cBase)
+/* Adds one column of a 3-way alignment to the counts */
+{
+	if (cBase == 'X') {
+		return;
+	}
+	counts.alignmentLength++;
+	if (cBase != '-') {
+		counts.cLength++;
+	}
+	if (uBase != '-' and uBase != 'X') {
+		counts.uLength++;
+	}
+	if (refBase == '-') {
+		counts.cInsertions += cBase != '-';
+		counts.uInsertions += uBase != '-' and uBase != 'X';
+	} else {
+		counts.cDeletions += cBase == '-';
+		counts.cSubstitutions += cBase != '-' and toupper(refBase) != toupper(cBase);
+		counts.uDeletions += uBase == '-';
+		counts.uSubstitutions += uBase != '-' and uBase != 'X' and toupper(refBase) != toupper(uBase);
+	}
+}
+
+ReadCounts countAlignment(const std::string &ref, const std::string &uRead, const std::string &cRead)
+/* Returns the counts of a whole 3-way alignment and of each of its corrected segments, the ones that
+ * getCorrespondingSegmentsList would find */
+{
+	assert(cRead.length() == uRead.length());
+	assert(cRead.length() == ref.length());
+
+	return countAlignment(ref.data(), uRead.data(), cRead.data(), ref.length());
+}
+
+ReadCounts countAlignment(const char *ref, const char *uRead, const char *cRead, int64_t length)
+/* Same as above for alignments of the given length that are not held in strings */
+{
+	ReadCounts counts;
+	MutationCounts segmentCounts;
+	bool inCorrectedSegment = false;
+
+	for (int64_t index = 0; index < length; index++) {
+		if (cRead[index] == 'X') {
+			// A segment ends at the delimiter after it
+			if (inCorrectedSegment) {
+				counts.segments.push_back(segmentCounts);
+			} else {
+				segmentCounts = MutationCounts();
+			}
+			inCorrectedSegment = not inCorrectedSegment;
+		} else {
+			countColumn(counts.read, ref[index], uRead[index], cRead[index]);
+			if (inCorrectedSegment) {
+				countColumn(segmentCounts, ref[index], uRead[index], cRead[index]);
+			}
+		}
+	}
+	return counts;
+}
+
+std::vector<int64_t> countedStatistics(const MutationCounts &counts)
+/* Returns the counts in the order of the columns of the stats file */
+{
+	return std::vector<int64_t> {counts.cLength, counts.uLength, counts.alignmentLength,
+	                             counts.cDeletions, counts.cInsertions, counts.cSubstitutions,
+	                             counts.uDeletions, counts.uInsertions, counts.uSubstitutions};
+}
+
 int64_t getDeletions(std::string ref, std::string read)
 // Returns the number of deletions between the reference and read string
 {
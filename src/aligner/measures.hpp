@@ -52,4 +52,41 @@ int64_t getInsertions(std::string ref, std::string read);
 int64_t getDeletions(std::string ref, std::string read);
 // Returns the number of insertions between the reference and read string
 
+struct MutationCounts
+/* Lengths and mutations of a 3-way alignment, or of one of its corrected segments, in the order of the
+ * columns of the stats file. They are the same counts that gaplessLength, boundarylessLength and the
+ * three functions above give for the alignment strings. */
+{
+	int64_t cLength = 0;
+	int64_t uLength = 0;
+	int64_t alignmentLength = 0;
+	int64_t cDeletions = 0;
+	int64_t cInsertions = 0;
+	int64_t cSubstitutions = 0;
+	int64_t uDeletions = 0;
+	int64_t uInsertions = 0;
+	int64_t uSubstitutions = 0;
+};
+
+struct ReadCounts
+/* Counts of a whole read and of each of its corrected segments, as the stats mode would find them in
+ * the read's 3-way alignment */
+{
+	MutationCounts read;
+	std::vector<MutationCounts> segments;
+};
+
+void countColumn(MutationCounts &counts, char refBase, char uBase, char cBase);
+/* Adds one column of a 3-way alignment to the counts */
+
+ReadCounts countAlignment(const std::string &ref, const std::string &uRead, const std::string &cRead);
+/* Returns the counts of a whole 3-way alignment and of each of its corrected segments, the ones that
+ * getCorrespondingSegmentsList would find */
+
+ReadCounts countAlignment(const char *ref, const char *uRead, const char *cRead, int64_t length);
+/* Same as above for alignments of the given length that are not held in strings */
+
+std::vector<int64_t> countedStatistics(const MutationCounts &counts);
+/* Returns the counts in the order of the columns of the stats file */
+
 #endif // MEASURES_H
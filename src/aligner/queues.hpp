@@ -0,0 +1,110 @@
+#ifndef QUEUES_H
+#define QUEUES_H
+
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <condition_variable>
+
+template <class T>
+class BoundedQueue
+/* First in, first out queue between threads that holds at most a fixed number of items; producers
+ * wait while it is full and consumers while it is empty. */
+{
+	public:
+		BoundedQueue(int64_t capacity) : capacity(capacity), closed(false) {}
+		// Waits for room and appends the item
+		void push(T item)
+		{
+			std::unique_lock<std::mutex> lock (mutex);
+			notFull.wait(lock, [this]() { return items.size() < capacity; });
+			items.push_back( std::move(item) );
+			notEmpty.notify_one();
+		}
+		// Waits for an item and removes it; returns false once the queue is closed and empty
+		bool pop(T &item)
+		{
+			std::unique_lock<std::mutex> lock (mutex);
+			notEmpty.wait(lock, [this]() { return !items.empty() or closed; });
+			if (items.empty()) {
+				return false;
+			}
+			item = std::move( items.front() );
+			items.pop_front();
+			notFull.notify_one();
+			return true;
+		}
+		// No more items will be pushed
+		void close()
+		{
+			std::lock_guard<std::mutex> lock (mutex);
+			closed = true;
+			notEmpty.notify_all();
+		}
+	private:
+		std::mutex mutex;
+		std::condition_variable notFull;
+		std::condition_variable notEmpty;
+		std::deque<T> items;
+		int64_t capacity;
+		bool closed;
+};
+
+template <class T>
+class ReorderBuffer
+/* Hands out items numbered 0, 1, 2... in order, whatever order the producers finish them in. A producer
+ * waits while its item is capacity or more places ahead of the next one to hand out, so the buffer
+ * never holds more than capacity items. */
+{
+	public:
+		ReorderBuffer(int64_t capacity, int64_t producers) : capacity(capacity), producers(producers), next(0) {}
+		// Waits until the item is within capacity of the next one and stores it
+		void put(int64_t index, T item)
+		{
+			std::unique_lock<std::mutex> lock (mutex);
+			hasRoom.wait(lock, [this, index]() { return index < next + capacity; });
+			items[index] = std::move(item);
+			if (index == next) {
+				hasNext.notify_one();
+			}
+		}
+		// Returns true if putting the item would not wait
+		bool fits(int64_t index)
+		{
+			std::lock_guard<std::mutex> lock (mutex);
+			return index < next + capacity;
+		}
+		// Waits for the next item and removes it; returns false once every producer is done and the next
+		// item never came
+		bool take(T &item)
+		{
+			std::unique_lock<std::mutex> lock (mutex);
+			hasNext.wait(lock, [this]() { return items.count(next) > 0 or producers == 0; });
+			if (items.count(next) == 0) {
+				return false;
+			}
+			item = std::move( items[next] );
+			items.erase(next);
+			next++;
+			hasRoom.notify_all();
+			return true;
+		}
+		// A producer will not put any more items
+		void producerDone()
+		{
+			std::lock_guard<std::mutex> lock (mutex);
+			producers--;
+			hasNext.notify_one();
+		}
+	private:
+		std::mutex mutex;
+		std::condition_variable hasRoom;
+		std::condition_variable hasNext;
+		std::map<int64_t, T> items;
+		int64_t capacity;
+		int64_t producers;
+		int64_t next;
+};
+
+#endif // QUEUES_H
@@ -1,9 +1,56 @@
 #include <iostream>
 #include <algorithm> // for std::count
 #include <string>
+#include <thread>
+#include <functional>
 #include "catch.hpp"
 #include "../alignments.hpp"
 #include "../data.hpp"
+#include "../kernels.hpp"
+
+struct ReadErrors
+/* Errors of a simulated read, each made at every n-th base of the reference, or never if n is 0 */
+{
+	int64_t ulrSubstitution = 0;
+	// The uLR holds a gap instead of the base, and the cLR keeps the base
+	int64_t ulrGap = 0;
+	int64_t clrSubstitution = 0;
+	int64_t clrDeletion = 0;
+	// The cLR is trimmed after every n-th base
+	int64_t segmentLength = 0;
+	// Bases the corrector left alone; the cLR copies the uLR there, in lower case
+	std::function<bool(int64_t)> uncorrected;
+};
+
+Read_t simulateRead(uint64_t seed, int64_t length, const ReadErrors &errors)
+/* Draws a random reference of the given length and derives the uLR and cLR from it. A substituted base
+ * is the next one in ACGT. */
+{
+	std::string bases = "ACGT";
+	Read_t read;
+	for (int64_t index = 0; index < length; index++) {
+		seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+		char base = bases[(seed >> 33) % 4];
+		char otherBase = bases[((seed >> 33) + 1) % 4];
+		read.ref += base;
+		if (errors.ulrGap > 0 and index % errors.ulrGap == 0) {
+			read.ulr += '-';
+		} else {
+			read.ulr += errors.ulrSubstitution > 0 and index % errors.ulrSubstitution == 0 ? otherBase : base;
+		}
+		if (errors.uncorrected and errors.uncorrected(index)) {
+			if (read.ulr.back() != '-') {
+				read.clr += (char) tolower( read.ulr.back() );
+			}
+		} else if (errors.clrDeletion == 0 or index % errors.clrDeletion != 0) {
+			read.clr += errors.clrSubstitution > 0 and index % errors.clrSubstitution == 0 ? otherBase : base;
+		}
+		if (errors.segmentLength > 0 and index % errors.segmentLength == errors.segmentLength - 1) {
+			read.clr += ' ';
+		}
+	}
+	return read;
+}
 
 TEST_CASE( "ref, uLR and cLR alignments are the same length", "[alignments]" ) {
 	SECTION( "UntrimmedAlignments are the same length" ) {
@@ -288,3 +335,649 @@ TEST_CASE( "ExtendedTrimmedAlignments on real Jabba reads" )
 		REQUIRE( ulrCount == 2 );
 	}
 }
+
+TEST_CASE( "Alignment objects give the same alignments when reused across reads", "[alignments]" )
+{
+	std::string longRef = "C-GAGTCAATAAAAA";
+	std::string longUlr = "CTG-GTC--TAAG-A";
+	std::string longClr = "ctggTCAATaaga";
+	std::string shortRef = "CGAGTCA";
+	std::string shortUlr = "CGAGTCA";
+	std::string shortClr = "cgAGTca";
+
+	UntrimmedAlignments fresh;
+	Read_t expected = fresh.align(shortRef,shortUlr,shortClr);
+
+	// Align a longer read first so the matrix is allocated larger than needed for the second
+	UntrimmedAlignments reused;
+	reused.align(longRef,longUlr,longClr);
+	Read_t alignedReads = reused.align(shortRef,shortUlr,shortClr);
+
+	REQUIRE( alignedReads.ref == expected.ref );
+	REQUIRE( alignedReads.ulr == expected.ulr );
+	REQUIRE( alignedReads.clr == expected.clr );
+	REQUIRE( alignedReads.alignmentSuccessful == expected.alignmentSuccessful );
+}
+
+TEST_CASE( "Banded engine gives the same alignments as the full matrix", "[alignments]" )
+{
+	// Build a read long enough that the band does not cover the whole matrix
+	ReadErrors errors;
+	errors.ulrSubstitution = 37;
+	errors.ulrGap = 53;
+	errors.uncorrected = [](int64_t index) { return index >= 200; };
+	Read_t read = simulateRead(42, 600, errors);
+	std::string ref = read.ref;
+	std::string ulr = read.ulr;
+	std::string clr = read.clr;
+
+	UntrimmedAlignments full;
+	Read_t expected = full.align(ref,ulr,clr);
+
+	UntrimmedAlignments banded;
+	banded.setEngine(Banded);
+	Read_t alignedReads = banded.align(ref,ulr,clr);
+
+	REQUIRE( alignedReads.alignmentSuccessful );
+	REQUIRE( alignedReads.ref == expected.ref );
+	REQUIRE( alignedReads.ulr == expected.ulr );
+	REQUIRE( alignedReads.clr == expected.clr );
+}
+
+TEST_CASE( "Traceback engine gives the same alignments as the full matrix", "[alignments]" )
+{
+	std::string ref = "C-GAGTCAATAAAAA";
+	std::string ulr = "CTG-GTC--TAAG-A";
+
+	SECTION( "ExtendedUntrimmedAlignments" ) {
+		std::string clr = "ACTACtggTCAATaagATAC"; 
+		ExtendedUntrimmedAlignments full;
+		Read_t expected = full.align(ref,ulr,clr);
+		ExtendedUntrimmedAlignments traceback;
+		traceback.setEngine(Traceback);
+		Read_t alignedReads = traceback.align(ref,ulr,clr);
+
+		REQUIRE( alignedReads.ref == expected.ref );
+		REQUIRE( alignedReads.ulr == expected.ulr );
+		REQUIRE( alignedReads.clr == expected.clr );
+	}
+	SECTION( "ExtendedTrimmedAlignments" ) {
+		std::string clr = "GGTCA TAAG"; 
+		ExtendedTrimmedAlignments full;
+		Read_t expected = full.align(ref,ulr,clr);
+		ExtendedTrimmedAlignments traceback;
+		traceback.setEngine(Traceback);
+		Read_t alignedReads = traceback.align(ref,ulr,clr);
+
+		REQUIRE( alignedReads.ref == expected.ref );
+		REQUIRE( alignedReads.ulr == expected.ulr );
+		REQUIRE( alignedReads.clr == expected.clr );
+	}
+}
+
+TEST_CASE( "Reads over the memory limit are aligned in linear space with the same result", "[alignments]" )
+{
+	std::string ref = "C-GAGTCAATAAAAA";
+	std::string ulr = "CTG-GTC--TAAG-A";
+
+	SECTION( "UntrimmedAlignments" ) {
+		std::string clr = "ctggTCAATaaga"; 
+		UntrimmedAlignments full;
+		Read_t expected = full.align(ref,ulr,clr);
+		UntrimmedAlignments limited;
+		limited.setMemoryLimit(1);
+		Read_t alignedReads = limited.align(ref,ulr,clr);
+
+		REQUIRE( alignedReads.alignmentSuccessful );
+		REQUIRE( alignedReads.ref == expected.ref );
+		REQUIRE( alignedReads.ulr == expected.ulr );
+		REQUIRE( alignedReads.clr == expected.clr );
+	}
+	SECTION( "TrimmedAlignments" ) {
+		std::string clr = "GGTCA TAAG"; 
+		TrimmedAlignments full;
+		Read_t expected = full.align(ref,ulr,clr);
+		TrimmedAlignments limited;
+		limited.setMemoryLimit(1);
+		Read_t alignedReads = limited.align(ref,ulr,clr);
+
+		REQUIRE( alignedReads.alignmentSuccessful );
+		REQUIRE( alignedReads.ref == expected.ref );
+		REQUIRE( alignedReads.ulr == expected.ulr );
+		REQUIRE( alignedReads.clr == expected.clr );
+	}
+}
+
+TEST_CASE( "Anti-diagonal engine gives the same alignments as the full matrix", "[alignments]" )
+{
+	// Build trimmed reads long enough to fill whole vectors on most anti-diagonals
+	ReadErrors errors;
+	errors.ulrGap = 41;
+	errors.clrSubstitution = 29;
+	errors.clrDeletion = 43;
+	errors.segmentLength = 97;
+	Read_t read = simulateRead(7, 300, errors);
+	std::string ref = read.ref;
+	std::string ulr = read.ulr;
+	std::string clr = read.clr;
+
+	std::vector<VectorLevel> levels = {Scalar, Avx2, Avx512};
+	for (VectorLevel level : levels) {
+		setVectorLevel(level);
+
+		TrimmedAlignments trimmedFull;
+		Read_t expected = trimmedFull.align(ref,ulr,clr);
+		TrimmedAlignments trimmed;
+		trimmed.setEngine(AntiDiagonal);
+		Read_t alignedReads = trimmed.align(ref,ulr,clr);
+
+		REQUIRE( alignedReads.ref == expected.ref );
+		REQUIRE( alignedReads.ulr == expected.ulr );
+		REQUIRE( alignedReads.clr == expected.clr );
+
+		ExtendedTrimmedAlignments extendedFull;
+		expected = extendedFull.align(ref,ulr,clr);
+		ExtendedTrimmedAlignments extended;
+		extended.setEngine(AntiDiagonal);
+		alignedReads = extended.align(ref,ulr,clr);
+
+		REQUIRE( alignedReads.ref == expected.ref );
+		REQUIRE( alignedReads.ulr == expected.ulr );
+		REQUIRE( alignedReads.clr == expected.clr );
+	}
+	setVectorLevel(supportedVectorLevel());
+}
+
+TEST_CASE( "Batched reads give the same alignments as reads aligned one at a time", "[alignments]" )
+{
+	std::vector<Read_t> reads (3);
+	reads[0].ref = "C-GAGTCAATAAAAA";
+	reads[0].ulr = "CTG-GTC--TAAG-A";
+	reads[1].ref = "CGAGTCA";
+	reads[1].ulr = "CGAGTCA";
+	reads[2].ref = "C-GAGTCAATAAAAAGGTACCA";
+	reads[2].ulr = "CTG-GTC--TAAG-AGGTAC-A";
+
+	SECTION( "UntrimmedAlignments" ) {
+		reads[0].clr = "ctggTCAATaaga";
+		reads[1].clr = "cgAGTca";
+		reads[2].clr = "CTGGTCAATaagaggtacA";
+		UntrimmedAlignments batched;
+		std::vector<Read_t> alignedReads = batched.alignBatch(reads);
+
+		REQUIRE( alignedReads.size() == reads.size() );
+		for (int64_t index = 0; index < reads.size(); index++) {
+			UntrimmedAlignments single;
+			Read_t expected = single.align(reads[index].ref, reads[index].ulr, reads[index].clr);
+			REQUIRE( alignedReads[index].alignmentSuccessful == expected.alignmentSuccessful );
+			REQUIRE( alignedReads[index].ref == expected.ref );
+			REQUIRE( alignedReads[index].ulr == expected.ulr );
+			REQUIRE( alignedReads[index].clr == expected.clr );
+		}
+	}
+	SECTION( "ExtendedTrimmedAlignments" ) {
+		reads[0].clr = "GGTCA TAAG";
+		reads[1].clr = "TTCGAG TCA";
+		reads[2].clr = "GAGTCAAT AAAAAGG ACCAT";
+		ExtendedTrimmedAlignments batched;
+		std::vector<Read_t> alignedReads = batched.alignBatch(reads);
+
+		REQUIRE( alignedReads.size() == reads.size() );
+		for (int64_t index = 0; index < reads.size(); index++) {
+			ExtendedTrimmedAlignments single;
+			Read_t expected = single.align(reads[index].ref, reads[index].ulr, reads[index].clr);
+			REQUIRE( alignedReads[index].alignmentSuccessful == expected.alignmentSuccessful );
+			REQUIRE( alignedReads[index].ref == expected.ref );
+			REQUIRE( alignedReads[index].ulr == expected.ulr );
+			REQUIRE( alignedReads[index].clr == expected.clr );
+		}
+	}
+}
+
+TEST_CASE( "Bit-parallel engine gives the same alignments as the full matrix", "[alignments]" )
+{
+	// Upper case runs wider than a word, separated by lower case runs
+	ReadErrors errors;
+	errors.ulrSubstitution = 23;
+	errors.ulrGap = 31;
+	errors.clrSubstitution = 29;
+	errors.clrDeletion = 47;
+	errors.uncorrected = [](int64_t index) { return (index / 100) % 2 == 1; };
+	Read_t read = simulateRead(11, 400, errors);
+	std::string ref = read.ref;
+	std::string ulr = read.ulr;
+	std::string clr = read.clr;
+
+	SECTION( "UntrimmedAlignments" ) {
+		UntrimmedAlignments full;
+		Read_t expected = full.align(ref,ulr,clr);
+		UntrimmedAlignments bitParallel;
+		bitParallel.setEngine(BitParallel);
+		Read_t alignedReads = bitParallel.align(ref,ulr,clr);
+
+		REQUIRE( alignedReads.alignmentSuccessful );
+		REQUIRE( alignedReads.ref == expected.ref );
+		REQUIRE( alignedReads.ulr == expected.ulr );
+		REQUIRE( alignedReads.clr == expected.clr );
+	}
+	SECTION( "ExtendedUntrimmedAlignments" ) {
+		clr = "ACGTTGCA" + clr + "TTGACCA";
+		ExtendedUntrimmedAlignments full;
+		Read_t expected = full.align(ref,ulr,clr);
+		ExtendedUntrimmedAlignments bitParallel;
+		bitParallel.setEngine(BitParallel);
+		Read_t alignedReads = bitParallel.align(ref,ulr,clr);
+
+		REQUIRE( alignedReads.alignmentSuccessful );
+		REQUIRE( alignedReads.ref == expected.ref );
+		REQUIRE( alignedReads.ulr == expected.ulr );
+		REQUIRE( alignedReads.clr == expected.clr );
+	}
+}
+
+TEST_CASE( "Every trimmed segment is delimited, however fragmented the cLR", "[alignments]" )
+{
+	std::string ref = "CGAGTCAATA";
+	std::string ulr = "CGAGTCAATA";
+	std::string clr = "CG A GTC A ATA";
+
+	TrimmedAlignments alignments;
+	Read_t alignedReads = alignments.align(ref,ulr,clr);
+
+	REQUIRE( alignedReads.ref == "-CG--A--GTC--A--ATA-" );
+	REQUIRE( alignedReads.ulr == "XCGXXAXXGTCXXAXXATAX" );
+	REQUIRE( alignedReads.clr == "XCGXXAXXGTCXXAXXATAX" );
+}
+
+TEST_CASE( "Segmented engine gives the same alignments as the full matrix", "[alignments]" )
+{
+	// Mostly lower case reads, whose corrected segments lie between a few anchored uncorrected runs
+	ReadErrors errors;
+	errors.ulrSubstitution = 23;
+	errors.ulrGap = 31;
+	errors.clrSubstitution = 29;
+	errors.clrDeletion = 47;
+	errors.uncorrected = [](int64_t index) { return (index / 100) % 4 != 1; };
+	Read_t read = simulateRead(5, 800, errors);
+	std::string ref = read.ref;
+	std::string ulr = read.ulr;
+	std::string clr = read.clr;
+
+	SECTION( "UntrimmedAlignments" ) {
+		UntrimmedAlignments full;
+		Read_t expected = full.align(ref,ulr,clr);
+		UntrimmedAlignments segmented;
+		segmented.setEngine(Segmented);
+		Read_t alignedReads = segmented.align(ref,ulr,clr);
+
+		REQUIRE( alignedReads.alignmentSuccessful );
+		REQUIRE( alignedReads.ref == expected.ref );
+		REQUIRE( alignedReads.ulr == expected.ulr );
+		REQUIRE( alignedReads.clr == expected.clr );
+	}
+	SECTION( "ExtendedUntrimmedAlignments" ) {
+		clr = "ACGTTGCA" + clr + "TTGACCA";
+		ExtendedUntrimmedAlignments full;
+		Read_t expected = full.align(ref,ulr,clr);
+		ExtendedUntrimmedAlignments segmented;
+		segmented.setEngine(Segmented);
+		Read_t alignedReads = segmented.align(ref,ulr,clr);
+
+		REQUIRE( alignedReads.alignmentSuccessful );
+		REQUIRE( alignedReads.ref == expected.ref );
+		REQUIRE( alignedReads.ulr == expected.ulr );
+		REQUIRE( alignedReads.clr == expected.clr );
+	}
+}
+
+TEST_CASE( "Anchored engine gives the same alignments as the full matrix", "[alignments]" )
+{
+	// Trimmed reads whose segments come from scattered parts of the reference; the short one has no anchors
+	std::string bases = "ACGT";
+	std::string ref = simulateRead(11, 3000, ReadErrors()).ref;
+	std::string ulr = ref;
+	std::vector< std::pair<int64_t,int64_t> > segments = { {100,700}, {900,1400}, {1500,1512}, {2000,2900} };
+	std::string clr = "";
+	for (auto segment : segments) {
+		if (!clr.empty()) {
+			clr += ' ';
+		}
+		for (int64_t index = segment.first; index < segment.second; index++) {
+			if (index % 53 != 0) {
+				clr += index % 37 == 0 ? bases[(bases.find(ref[index]) + 1) % 4] : ref[index];
+			}
+		}
+	}
+
+	SECTION( "TrimmedAlignments" ) {
+		TrimmedAlignments full;
+		Read_t expected = full.align(ref,ulr,clr);
+		TrimmedAlignments anchored;
+		anchored.setEngine(Anchored);
+		Read_t alignedReads = anchored.align(ref,ulr,clr);
+
+		REQUIRE( alignedReads.alignmentSuccessful );
+		REQUIRE( alignedReads.ref == expected.ref );
+		REQUIRE( alignedReads.ulr == expected.ulr );
+		REQUIRE( alignedReads.clr == expected.clr );
+	}
+	SECTION( "ExtendedTrimmedAlignments" ) {
+		ExtendedTrimmedAlignments full;
+		Read_t expected = full.align(ref,ulr,clr);
+		ExtendedTrimmedAlignments anchored;
+		anchored.setEngine(Anchored);
+		Read_t alignedReads = anchored.align(ref,ulr,clr);
+
+		REQUIRE( alignedReads.alignmentSuccessful );
+		REQUIRE( alignedReads.ref == expected.ref );
+		REQUIRE( alignedReads.ulr == expected.ulr );
+		REQUIRE( alignedReads.clr == expected.clr );
+	}
+}
+
+TEST_CASE( "Wavefront fills give the same alignments as a single thread", "[alignments]" )
+{
+	ReadErrors errors;
+	errors.ulrSubstitution = 19;
+	errors.clrSubstitution = 31;
+	errors.clrDeletion = 43;
+	errors.segmentLength = 150;
+	Read_t read = simulateRead(17, 700, errors);
+	std::string ref = read.ref;
+	std::string ulr = read.ulr;
+	std::string clr = read.clr;
+	std::string untrimmedClr = clr;
+	untrimmedClr.erase( std::remove(untrimmedClr.begin(), untrimmedClr.end(), ' '), untrimmedClr.end() );
+	std::atomic<int64_t> idleThreads (3);
+
+	SECTION( "UntrimmedAlignments" ) {
+		UntrimmedAlignments single;
+		Read_t expected = single.align(ref,ulr,untrimmedClr);
+		UntrimmedAlignments wavefront;
+		wavefront.setWavefront(0, &idleThreads);
+		Read_t alignedReads = wavefront.align(ref,ulr,untrimmedClr);
+
+		REQUIRE( alignedReads.ref == expected.ref );
+		REQUIRE( alignedReads.ulr == expected.ulr );
+		REQUIRE( alignedReads.clr == expected.clr );
+	}
+	SECTION( "ExtendedUntrimmedAlignments" ) {
+		ExtendedUntrimmedAlignments single;
+		Read_t expected = single.align(ref,ulr,untrimmedClr);
+		ExtendedUntrimmedAlignments wavefront;
+		wavefront.setWavefront(0, &idleThreads);
+		Read_t alignedReads = wavefront.align(ref,ulr,untrimmedClr);
+
+		REQUIRE( alignedReads.ref == expected.ref );
+		REQUIRE( alignedReads.ulr == expected.ulr );
+		REQUIRE( alignedReads.clr == expected.clr );
+	}
+	SECTION( "TrimmedAlignments" ) {
+		TrimmedAlignments single;
+		Read_t expected = single.align(ref,ulr,clr);
+		TrimmedAlignments wavefront;
+		wavefront.setWavefront(0, &idleThreads);
+		Read_t alignedReads = wavefront.align(ref,ulr,clr);
+
+		REQUIRE( alignedReads.ref == expected.ref );
+		REQUIRE( alignedReads.ulr == expected.ulr );
+		REQUIRE( alignedReads.clr == expected.clr );
+	}
+	SECTION( "ExtendedTrimmedAlignments" ) {
+		ExtendedTrimmedAlignments single;
+		Read_t expected = single.align(ref,ulr,clr);
+		ExtendedTrimmedAlignments wavefront;
+		wavefront.setWavefront(0, &idleThreads);
+		Read_t alignedReads = wavefront.align(ref,ulr,clr);
+
+		REQUIRE( alignedReads.ref == expected.ref );
+		REQUIRE( alignedReads.ulr == expected.ulr );
+		REQUIRE( alignedReads.clr == expected.clr );
+	}
+	SECTION( "TrimmedAlignments with the anti-diagonal kernel" ) {
+		// Long enough that the longest anti-diagonals are split between the threads
+		errors.ulrSubstitution = 0;
+		errors.segmentLength = 1500;
+		Read_t longRead = simulateRead(19, 2*antiDiagonalPartCells + 500, errors);
+		std::string longRef = longRead.ref;
+		std::string longClr = longRead.clr;
+		TrimmedAlignments single;
+		single.setEngine(AntiDiagonal);
+		Read_t expected = single.align(longRef,longRef,longClr);
+		TrimmedAlignments wavefront;
+		wavefront.setEngine(AntiDiagonal);
+		wavefront.setWavefront(0, &idleThreads);
+		Read_t alignedReads = wavefront.align(longRef,longRef,longClr);
+
+		REQUIRE( alignedReads.ref == expected.ref );
+		REQUIRE( alignedReads.ulr == expected.ulr );
+		REQUIRE( alignedReads.clr == expected.clr );
+	}
+	// Every borrowed thread is given back
+	REQUIRE( idleThreads == 3 );
+}
+
+TEST_CASE( "ScoreBounded engine gives the same alignments as the full matrix", "[alignments]" )
+{
+	// An accurate read, whose alignment is found within a few raises of the bound
+	ReadErrors errors;
+	errors.ulrSubstitution = 13;
+	errors.clrSubstitution = 97;
+	errors.clrDeletion = 211;
+	errors.segmentLength = 300;
+	Read_t read = simulateRead(23, 900, errors);
+	std::string ref = read.ref;
+	std::string ulr = read.ulr;
+	std::string clr = read.clr;
+	std::string untrimmedClr = clr;
+	untrimmedClr.erase( std::remove(untrimmedClr.begin(), untrimmedClr.end(), ' '), untrimmedClr.end() );
+	std::transform( untrimmedClr.begin() + 400, untrimmedClr.begin() + 500, untrimmedClr.begin() + 400, ::tolower );
+
+	SECTION( "UntrimmedAlignments" ) {
+		UntrimmedAlignments full;
+		Read_t expected = full.align(ref,ulr,untrimmedClr);
+		UntrimmedAlignments bounded;
+		bounded.setEngine(ScoreBounded);
+		Read_t alignedReads = bounded.align(ref,ulr,untrimmedClr);
+
+		REQUIRE( alignedReads.alignmentSuccessful == expected.alignmentSuccessful );
+		REQUIRE( alignedReads.ref == expected.ref );
+		REQUIRE( alignedReads.clr == expected.clr );
+	}
+	SECTION( "ExtendedUntrimmedAlignments" ) {
+		ExtendedUntrimmedAlignments full;
+		Read_t expected = full.align(ref,ulr,"ACGTTGCA" + untrimmedClr);
+		ExtendedUntrimmedAlignments bounded;
+		bounded.setEngine(ScoreBounded);
+		Read_t alignedReads = bounded.align(ref,ulr,"ACGTTGCA" + untrimmedClr);
+
+		REQUIRE( alignedReads.ref == expected.ref );
+		REQUIRE( alignedReads.clr == expected.clr );
+	}
+	SECTION( "TrimmedAlignments" ) {
+		TrimmedAlignments full;
+		Read_t expected = full.align(ref,ulr,clr);
+		TrimmedAlignments bounded;
+		bounded.setEngine(ScoreBounded);
+		Read_t alignedReads = bounded.align(ref,ulr,clr);
+
+		REQUIRE( alignedReads.ref == expected.ref );
+		REQUIRE( alignedReads.clr == expected.clr );
+	}
+	SECTION( "ExtendedTrimmedAlignments" ) {
+		ExtendedTrimmedAlignments full;
+		Read_t expected = full.align(ref,ulr,clr);
+		ExtendedTrimmedAlignments bounded;
+		bounded.setEngine(ScoreBounded);
+		Read_t alignedReads = bounded.align(ref,ulr,clr);
+
+		REQUIRE( alignedReads.ref == expected.ref );
+		REQUIRE( alignedReads.clr == expected.clr );
+	}
+	SECTION( "Unrelated reads fall back to the full matrix" ) {
+		std::string unrelated = clr;
+		std::reverse(unrelated.begin(), unrelated.end());
+		TrimmedAlignments full;
+		Read_t expected = full.align(ref,ulr,unrelated);
+		TrimmedAlignments bounded;
+		bounded.setEngine(ScoreBounded);
+		Read_t alignedReads = bounded.align(ref,ulr,unrelated);
+
+		REQUIRE( alignedReads.ref == expected.ref );
+		REQUIRE( alignedReads.clr == expected.clr );
+	}
+}
+
+TEST_CASE( "Releasing the workspace between reads does not change their alignments", "[alignments]" )
+{
+	std::string longRef = simulateRead(29, 2000, ReadErrors()).ref;
+	std::string longClr = longRef.substr(0, 700) + longRef.substr(720, 900) + "ACGT" + longRef.substr(1620);
+	std::string shortRef = longRef.substr(100, 60);
+	std::string shortClr = longRef.substr(100, 30) + longRef.substr(132, 28);
+
+	TrimmedAlignments fresh;
+	Read_t expectedLong = fresh.align(longRef,longRef,longClr);
+	Read_t expectedShort = fresh.align(shortRef,shortRef,shortClr);
+
+	TrimmedAlignments shrinking;
+	shrinking.setWorkspaceShrinking(2);
+	REQUIRE( shrinking.align(longRef,longRef,longClr).clr == expectedLong.clr );
+	for (int64_t read = 0; read < 3; read++) {
+		Read_t alignedReads = shrinking.align(shortRef,shortRef,shortClr);
+		REQUIRE( alignedReads.ref == expectedShort.ref );
+		REQUIRE( alignedReads.clr == expectedShort.clr );
+	}
+	Read_t alignedReads = shrinking.align(longRef,longRef,longClr);
+	REQUIRE( alignedReads.ref == expectedLong.ref );
+	REQUIRE( alignedReads.clr == expectedLong.clr );
+}
+
+class WorkspaceAlignments : public TrimmedAlignments
+/* Lets the tests see the DP buffers a TrimmedAlignments object holds */
+{
+	public:
+		using Alignments::workspaceBytes;
+};
+
+TEST_CASE( "Reads under a memory budget get the same alignments", "[alignments]" )
+{
+	std::string ref = simulateRead(31, 1500, ReadErrors()).ref;
+	std::string clr = ref.substr(0, 500) + ref.substr(530, 600) + "TTGA" + ref.substr(1130);
+
+	TrimmedAlignments unlimited;
+	Read_t expected = unlimited.align(ref,ref,clr);
+
+	SECTION( "The budget only hands out what is left" ) {
+		MemoryBudget budget (100);
+		REQUIRE( budget.tryReserve(60) );
+		REQUIRE( !budget.tryReserve(60) );
+		budget.release(60);
+		REQUIRE( budget.tryReserve(100) );
+		budget.release(100);
+		// More than the whole budget is still granted once nothing else is reserved
+		budget.reserve(500);
+		REQUIRE( budget.reservedBytes() == 500 );
+		budget.release(500);
+	}
+	SECTION( "Reads that do not fit fall back to smaller engines" ) {
+		MemoryBudget budget (64 << 10);
+		{
+			TrimmedAlignments first;
+			TrimmedAlignments second;
+			first.setMemoryLimit(budget.totalBytes());
+			first.setMemoryBudget(&budget);
+			second.setMemoryLimit(budget.totalBytes());
+			second.setMemoryBudget(&budget);
+			for (int64_t read = 0; read < 2; read++) {
+				Read_t firstReads = first.align(ref,ref,clr);
+				Read_t secondReads = second.align(ref,ref,clr);
+				REQUIRE( firstReads.ref == expected.ref );
+				REQUIRE( firstReads.clr == expected.clr );
+				REQUIRE( secondReads.ref == expected.ref );
+				REQUIRE( secondReads.clr == expected.clr );
+			}
+			REQUIRE( budget.reservedBytes() <= budget.totalBytes() );
+		}
+		REQUIRE( budget.reservedBytes() == 0 );
+	}
+	SECTION( "Reads that wait for the budget hold no DP buffers while they wait" ) {
+		MemoryBudget budget (16 << 10);
+		WorkspaceAlignments waiting;
+		waiting.setMemoryLimit(budget.totalBytes());
+		waiting.setMemoryBudget(&budget);
+		std::string shortRef = ref.substr(0, 40);
+		waiting.align(shortRef,shortRef,shortRef);
+		int64_t heldBytes = budget.reservedBytes();
+		REQUIRE( heldBytes > 0 );
+		REQUIRE( waiting.workspaceBytes() == heldBytes );
+
+		// Not even the LinearSpace footprint of the read fits, so it waits for the byte held here
+		budget.reserve(1);
+		Read_t alignedReads;
+		std::thread aligner ([&]() { alignedReads = waiting.align(ref,ref,clr); });
+		while (budget.reservedBytes() != 1) {
+			std::this_thread::yield();
+		}
+		CHECK( waiting.workspaceBytes() == 0 );
+		budget.release(1);
+		aligner.join();
+		REQUIRE( alignedReads.ref == expected.ref );
+		REQUIRE( alignedReads.clr == expected.clr );
+	}
+}
+
+TEST_CASE( "Counting only gives the stats of the alignment strings", "[alignments]" )
+{
+	// Counts of the whole alignment and of each corrected segment, as the stats mode finds them
+	auto expectedCounts = [](const Read_t &alignedReads) {
+		ReadCounts counts;
+		for (int64_t index = 0; index < alignedReads.ref.length(); index++) {
+			countColumn(counts.read, alignedReads.ref[index], alignedReads.ulr[index], alignedReads.clr[index]);
+		}
+		for (CorrespondingSegments segments : getCorrespondingSegmentsList(alignedReads.clr, alignedReads.ulr, alignedReads.ref)) {
+			MutationCounts segmentCounts;
+			for (int64_t index = 0; index < segments.refSegment.length(); index++) {
+				countColumn(segmentCounts, segments.refSegment[index], segments.uReadSegment[index],
+				            segments.cReadSegment[index]);
+			}
+			counts.segments.push_back(segmentCounts);
+		}
+		return counts;
+	};
+	auto requireSameCounts = [](const ReadCounts &counts, const ReadCounts &expected) {
+		REQUIRE( countedStatistics(counts.read) == countedStatistics(expected.read) );
+		REQUIRE( counts.segments.size() == expected.segments.size() );
+		for (int64_t index = 0; index < expected.segments.size(); index++) {
+			REQUIRE( countedStatistics(counts.segments.at(index)) == countedStatistics(expected.segments.at(index)) );
+		}
+	};
+
+	SECTION( "UntrimmedAlignments" ) {
+		std::string ref = "ACTACTGGTC-ATAAAGTATAC";
+		std::string ulr = "ACTACTGG-CAATAAAG-ATAC";
+		std::string clr = "ACTGCtggTCTATaagATAC";
+		UntrimmedAlignments full;
+		Read_t expected = full.align(ref,ulr,clr);
+		UntrimmedAlignments counting;
+		counting.setCountingOnly(true);
+		Read_t alignedReads = counting.align(ref,ulr,clr);
+
+		REQUIRE( alignedReads.clr == "" );
+		REQUIRE( expectedCounts(expected).segments.size() == 3 );
+		requireSameCounts(alignedReads.counts, expectedCounts(expected));
+	}
+	SECTION( "TrimmedAlignments" ) {
+		std::string ref = "CGAGTCAATAAAAAGGCAT";
+		std::string ulr = "CGAGTCAATAAAAAGGCAT";
+		std::string clr = "CGAGT CAAT AAAAA";
+		TrimmedAlignments full;
+		Read_t expected = full.align(ref,ulr,clr);
+		TrimmedAlignments counting;
+		counting.setCountingOnly(true);
+		Read_t alignedReads = counting.align(ref,ulr,clr);
+
+		REQUIRE( alignedReads.clr == "" );
+		REQUIRE( expectedCounts(expected).segments.size() == 3 );
+		requireSameCounts(alignedReads.counts, expectedCounts(expected));
+	}
+}
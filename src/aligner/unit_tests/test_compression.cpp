@@ -0,0 +1,188 @@
+#include <vector>
+#include <string>
+#include <fstream>
+#include <cstdio>
+#include <cstdint>
+#include <zlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <iterator>
+#include "catch.hpp"
+#include "../compression.hpp"
+#include "../data.hpp"
+
+static std::string bgzfBlock(const std::string &text)
+{
+	z_stream stream;
+	stream.zalloc = Z_NULL;
+	stream.zfree = Z_NULL;
+	stream.opaque = Z_NULL;
+	deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY);
+	std::string block;
+	deflateBgzfBlock(stream, text.data(), text.length(), block);
+	deflateEnd(&stream);
+	return block;
+}
+
+TEST_CASE( "BGZF blocks are recognized, measured and inflated", "[compression]" ) {
+	std::string text = "a\ns ref 0 4 + 100 ACGT\n\n";
+	std::string file = bgzfBlock(text) + bgzfBlock("");
+	// The empty block is the one that ends every BGZF file
+	REQUIRE( file.substr(file.length() - 28) == std::string("\x1f\x8b\x08\x04\0\0\0\0\0\xff\x06\0BC\x02\0\x1b\0\x03\0\0\0\0\0\0\0\0\0", 28) );
+	const char *begin = file.data();
+	const char *end = file.data() + file.length();
+
+	REQUIRE( compressionType(begin, end) == Bgzf );
+	REQUIRE( compressionType(text.data(), text.data() + text.length()) == Uncompressed );
+	int64_t blockLength = bgzfBlockLength(begin, end);
+	REQUIRE( blockLength == file.length() - 28 );
+	REQUIRE( bgzfBlockLength(begin + blockLength, end) == 28 );
+	REQUIRE( bgzfBlockLength(begin, begin + blockLength - 1) == 0 );
+	REQUIRE( bgzfTextLength(begin, blockLength) == text.length() );
+
+	z_stream stream;
+	stream.zalloc = Z_NULL;
+	stream.zfree = Z_NULL;
+	stream.opaque = Z_NULL;
+	stream.next_in = Z_NULL;
+	stream.avail_in = 0;
+	inflateInit2(&stream, -MAX_WBITS);
+	std::string inflated (text.length(), '\0');
+	REQUIRE( inflateBgzfBlock(stream, begin, blockLength, &inflated[0]) );
+	REQUIRE( inflated == text );
+
+	// A damaged CRC
+	file[blockLength - 8] ^= 1;
+	REQUIRE( not inflateBgzfBlock(stream, begin, blockLength, &inflated[0]) );
+	inflateEnd(&stream);
+}
+
+TEST_CASE( "GzipInflater inflates every member of a gzip file, a part at a time", "[compression]" ) {
+	std::string fileName = "test_gzip_inflater.gz";
+	std::string text;
+	for (int i = 0; i < 1000; i++) {
+		text += ">" + std::to_string(i) + "\nACGT\n";
+	}
+	// Two members, as in concatenated files
+	for (int member = 0; member < 2; member++) {
+		gzFile gzip = gzopen(fileName.c_str(), member == 0 ? "wb" : "ab");
+		gzwrite(gzip, text.data(), text.length());
+		gzclose(gzip);
+	}
+	std::ifstream input (fileName);
+	std::string file ( (std::istreambuf_iterator<char>(input)), std::istreambuf_iterator<char>() );
+	REQUIRE( compressionType(file.data(), file.data() + file.length()) == Gzip );
+
+	GzipInflater inflater (file.data(), file.data() + file.length());
+	std::string inflated;
+	while (not inflater.finished()) {
+		REQUIRE( inflater.inflatePart(inflated, 1000) );
+	}
+	REQUIRE( inflated == text + text );
+
+	GzipInflater cutShort (file.data(), file.data() + file.length() / 3);
+	inflated.clear();
+	REQUIRE( not cutShort.inflatePart(inflated, 1 << 20) );
+
+	std::remove(fileName.c_str());
+}
+
+TEST_CASE( "TextInput inflates the blocks of a BGZF file into parts of whole records", "[TextInput]" ) {
+	std::string fileName = "test_text_input.fasta.bgz";
+	std::string text;
+	for (int i = 0; i < 200; i++) {
+		text += ">" + std::to_string(i) + "\n" + std::string(i % 37 + 1, 'C') + "\n";
+	}
+	{
+		// Blocks of 100 bytes cut most records in two
+		std::ofstream output (fileName, std::ios::binary);
+		for (int64_t start = 0; start < text.length(); start += 100) {
+			output << bgzfBlock(text.substr(start, 100));
+		}
+		output << bgzfBlock("");
+	}
+
+	for (int64_t partBytes : {1, 250, 1 << 20}) {
+		TextInput input (fileName, '>', partBytes, 3);
+		REQUIRE( input.isOpen() );
+		std::string joined;
+		TextPart part;
+		int64_t parts = 0;
+		while (input.nextPart(part)) {
+			REQUIRE( part.index == parts++ );
+			REQUIRE( *part.begin == '>' );
+			REQUIRE( *(part.end - 1) == '\n' );
+			joined.append(part.begin, part.end);
+		}
+		REQUIRE( joined == text );
+	}
+
+	std::remove(fileName.c_str());
+}
+
+TEST_CASE( "BgzfWriter writes the pieces in order, with the virtual offsets of their marks", "[BgzfWriter]" ) {
+	std::string fileName = "test_bgzf_writer.bgz";
+	std::string text;
+	std::vector<int64_t> markOffsets;
+	int fileDescriptor = open(fileName.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	{
+		BgzfWriter writer (fileDescriptor, fileName + ".idx", 3);
+		for (int i = 0; i < 12; i++) {
+			// Pieces of several blocks, which do not compress much
+			std::string piece;
+			std::vector<BgzfMark> marks;
+			while (piece.length() < i * 12000) {
+				marks.push_back( BgzfMark {std::to_string(markOffsets.size()), (int64_t) piece.length()} );
+				markOffsets.push_back(text.length() + piece.length());
+				piece += "read " + std::to_string(markOffsets.size() - 1) + " ";
+				for (int j = 0; j < 200; j++) {
+					piece += "ACGT"[(i * 7 + j * j + piece.length()) % 4];
+				}
+				piece += "\n";
+			}
+			text += piece;
+			writer.write( std::vector<char> (piece.begin(), piece.end()), marks );
+		}
+	}
+	close(fileDescriptor);
+
+	std::ifstream input (fileName);
+	std::string file ( (std::istreambuf_iterator<char>(input)), std::istreambuf_iterator<char>() );
+	REQUIRE( compressionType(file.data(), file.data() + file.length()) == Bgzf );
+	GzipInflater inflater (file.data(), file.data() + file.length());
+	std::string inflated;
+	while (not inflater.finished()) {
+		REQUIRE( inflater.inflatePart(inflated, 1 << 20) );
+	}
+	REQUIRE( inflated == text );
+
+	std::ifstream index (fileName + ".idx");
+	std::string name;
+	int64_t virtualOffset;
+	int64_t marks = 0;
+	z_stream stream;
+	stream.zalloc = Z_NULL;
+	stream.zfree = Z_NULL;
+	stream.opaque = Z_NULL;
+	stream.next_in = Z_NULL;
+	stream.avail_in = 0;
+	inflateInit2(&stream, -MAX_WBITS);
+	while (index >> name >> virtualOffset) {
+		REQUIRE( name == std::to_string(marks) );
+		const char *block = file.data() + (virtualOffset >> 16);
+		int64_t blockLength = bgzfBlockLength(block, file.data() + file.length());
+		REQUIRE( blockLength > 0 );
+		std::string blockText (bgzfTextLength(block, blockLength), '\0');
+		REQUIRE( inflateBgzfBlock(stream, block, blockLength, &blockText[0]) );
+		int64_t offset = virtualOffset & 0xffff;
+		REQUIRE( offset < blockText.length() );
+		std::string expected = text.substr(markOffsets.at(marks), blockText.length() - offset);
+		REQUIRE( blockText.substr(offset) == expected );
+		marks++;
+	}
+	inflateEnd(&stream);
+	REQUIRE( marks == markOffsets.size() );
+
+	std::remove(fileName.c_str());
+	std::remove((fileName + ".idx").c_str());
+}
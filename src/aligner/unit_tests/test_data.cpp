@@ -1,5 +1,9 @@
 #include <vector>
 #include <string>
+#include <fstream>
+#include <cstdio>
+#include <iterator>
+#include <zlib.h>
 #include "catch.hpp"
 #include "../data.hpp"
 
@@ -16,3 +20,257 @@ TEST_CASE("gaplessLength returns an integer whose value is equal to the size of
 	int length = gaplessLength(testString);
 	REQUIRE( length == testString.length() - numGaps );	
 }
+
+TEST_CASE( "parseMafPart and parseClrPart read the blocks of the MAF file and the records of the FASTA file", "[TextInput]" ) {
+	std::string mafName = "test_parse_parts.maf";
+	std::string clrName = "test_parse_parts.fasta";
+	std::ofstream maf (mafName);
+	maf << "a\n"
+	    << "s ref 10 4 + 1000 AC-GT\n"
+	    << "s 1.uLR 0 5 + 5 ACCGT\n"
+	    << "\n"
+	    << "a\n"
+	    << "s ref 20 3 - 1000 TTA\n"
+	    << "s 2.uLR 0 3 - 3 TTA\n"
+	    << "\n";
+	maf.close();
+	std::ofstream clr (clrName);
+	clr << ">1\nACCGT\n>2\nTCA\n";
+	clr.close();
+
+	TextInput mafInput (mafName, 'a', 1 << 20, 1);
+	TextInput clrInput (clrName, '>', 1 << 20, 1);
+	REQUIRE( mafInput.isOpen() );
+	REQUIRE( clrInput.isOpen() );
+	std::vector<Read_t> reads;
+	std::vector<std::string> clrs;
+	TextPart part;
+	REQUIRE( mafInput.nextPart(part) );
+	parseMafPart(part, reads);
+	REQUIRE( not mafInput.nextPart(part) );
+	REQUIRE( clrInput.nextPart(part) );
+	parseClrPart(part, clrs);
+	REQUIRE( not clrInput.nextPart(part) );
+
+	REQUIRE( reads.size() == 2 );
+	REQUIRE( reads.at(0).ref == "AC-GT" );
+	REQUIRE( reads.at(0).ulr == "ACCGT" );
+	REQUIRE( reads.at(0).clr == "" );
+	REQUIRE( reads.at(0).readInfo.name == "1.uLR" );
+	REQUIRE( reads.at(0).readInfo.start == "10" );
+	REQUIRE( reads.at(0).readInfo.srcSize == "1000" );
+	REQUIRE( reads.at(0).readInfo.refOrient == "+" );
+	REQUIRE( reads.at(1).ref == "TTA" );
+	REQUIRE( reads.at(1).readInfo.name == "2.uLR" );
+	REQUIRE( reads.at(1).readInfo.refOrient == "-" );
+	REQUIRE( reads.at(1).readInfo.readOrient == "-" );
+	REQUIRE( clrs == std::vector<std::string>({"ACCGT", "TCA"}) );
+
+	std::remove(mafName.c_str());
+	std::remove(clrName.c_str());
+}
+
+TEST_CASE( "MafFile writes the header and a block for every aligned read", "[MafFile]" ) {
+	std::string fileName = "test_maf_file.maf";
+	Read_t read;
+	read.ref = "AC-GT";
+	read.ulr = "ACCGT";
+	read.clr = "AX-GT";
+	read.readInfo.name = "7";
+	read.readInfo.start = "10";
+	read.readInfo.refOrient = "+";
+	read.readInfo.readOrient = "-";
+	read.readInfo.srcSize = "1000";
+	read.alignmentSuccessful = true;
+	Read_t failedRead = read;
+	failedRead.alignmentSuccessful = false;
+	// Longer than the buffer, so that it is written straight from the read
+	Read_t longRead = read;
+	longRead.ref = std::string(20 << 20, 'A');
+	longRead.ulr = longRead.ref;
+	longRead.clr = longRead.ref;
+	{
+		MafFile maf (fileName);
+		maf.addReads(read);
+		maf.addReads(failedRead);
+		maf.addReads(longRead);
+	}
+
+	std::ifstream input (fileName);
+	std::string contents ( (std::istreambuf_iterator<char>(input)), std::istreambuf_iterator<char>() );
+	std::string expected = "track name=" + fileName + "\n##maf version=1\n# tba.v8\n\n"
+		"a\ns ref 10 4 + 1000 AC-GT\ns 7.uLR 0 5 - 5 ACCGT\ns 7.cLR 0 3 - 3 AX-GT\n\n";
+	REQUIRE( contents.substr(0, expected.length()) == expected );
+	std::string longBlock = "a\ns ref 10 20971520 + 1000 " + longRead.ref + "\ns 7.uLR 0 20971520 - 20971520 "
+		+ longRead.ulr + "\ns 7.cLR 0 20971520 - 20971520 " + longRead.clr + "\n\n";
+	REQUIRE( contents.length() == expected.length() + longBlock.length() );
+	REQUIRE( contents.substr(expected.length()) == longBlock );
+
+	std::remove(fileName.c_str());
+}
+
+TEST_CASE( "LineScanner and splitView read the lines and fields of a mapped file in place", "[MappedFile]" ) {
+	std::string fileName = "test_mapped_file.txt";
+	{
+		std::ofstream output (fileName);
+		output << "s ref 10\n\nlast line";
+	}
+
+	MappedFile file (fileName);
+	REQUIRE( file.isOpen() );
+	LineScanner lines (file.begin(), file.end());
+	StringView line;
+	std::vector<StringView> fields;
+
+	REQUIRE( lines.nextLine(line) );
+	splitView(line, fields);
+	REQUIRE( fields.size() == 3 );
+	REQUIRE( fields.at(0).toString() == "s" );
+	REQUIRE( fields.at(2).toString() == "10" );
+	REQUIRE( fields.at(2).data + fields.at(2).length == line.data + line.length );
+
+	REQUIRE( lines.nextLine(line) );
+	REQUIRE( line.length == 0 );
+	REQUIRE( lines.nextLine(line) );
+	REQUIRE( line.toString() == "last line" );
+	REQUIRE( not lines.nextLine(line) );
+
+	std::remove(fileName.c_str());
+
+	MappedFile missing ("no_such_file.txt");
+	REQUIRE( not missing.isOpen() );
+}
+
+TEST_CASE( "splitRecords cuts a range into parts that start at the marked lines", "[splitRecords]" ) {
+	std::string text = "# header\na\ns 1\n\na\ns 2\n\na\ns 3\n";
+	const char *begin = text.data();
+	const char *end = text.data() + text.length();
+
+	std::vector<const char*> boundaries = splitRecords(begin, end, 1, 'a');
+	REQUIRE( boundaries.size() == 4 );
+	REQUIRE( boundaries.at(0) - begin == 9 );
+	REQUIRE( boundaries.at(1) - begin == 16 );
+	REQUIRE( boundaries.at(2) - begin == 23 );
+	REQUIRE( boundaries.at(3) == end );
+
+	// A part takes every record that starts within its bytes
+	boundaries = splitRecords(begin, end, 8, 'a');
+	REQUIRE( boundaries.size() == 3 );
+	REQUIRE( boundaries.at(1) - begin == 23 );
+
+	boundaries = splitRecords(begin, end, 1000, 'a');
+	REQUIRE( boundaries.size() == 2 );
+	REQUIRE( splitRecords(begin, end, 1, '>').size() == 1 );
+}
+
+TEST_CASE( "TextInput hands out the parts of a plain or gzip file, which parse into the same reads", "[TextInput]" ) {
+	std::string mafName = "test_text_input.maf";
+	std::string clrName = "test_text_input.fasta";
+	std::string gzipName = "test_text_input.maf.gz";
+	std::string maf;
+	std::string clr;
+	for (int i = 0; i < 5; i++) {
+		std::string id = std::to_string(i);
+		maf += "a\ns ref " + id + " 4 + 100 ACGT\ns " + id + " 0 4 + 4 AC-T\n\n";
+		clr += ">" + id + "\n" + std::string(i + 1, 'G') + "\n";
+	}
+	std::ofstream (mafName) << maf;
+	std::ofstream (clrName) << clr;
+	gzFile gzip = gzopen(gzipName.c_str(), "wb");
+	gzwrite(gzip, maf.data(), maf.length());
+	gzclose(gzip);
+
+	for (std::string inputName : {mafName, gzipName}) {
+		TextInput mafInput (inputName, 'a', 30, 2);
+		TextInput clrInput (clrName, '>', 12, 2);
+		REQUIRE( mafInput.isOpen() );
+		std::vector<Read_t> reads;
+		std::vector<std::string> clrs;
+		TextPart part;
+		int64_t parts = 0;
+		while (mafInput.nextPart(part)) {
+			REQUIRE( part.index == parts++ );
+			REQUIRE( *part.begin == 'a' );
+			parseMafPart(part, reads);
+		}
+		REQUIRE( parts > 1 );
+		while (clrInput.nextPart(part)) {
+			parseClrPart(part, clrs);
+		}
+		REQUIRE( not mafInput.nextPart(part) );
+
+		REQUIRE( reads.size() == 5 );
+		REQUIRE( clrs.size() == 5 );
+		for (int i = 0; i < 5; i++) {
+			std::string id = std::to_string(i);
+			REQUIRE( reads.at(i).ref == "ACGT" );
+			REQUIRE( reads.at(i).ulr == "AC-T" );
+			REQUIRE( reads.at(i).readInfo.name == id );
+			REQUIRE( reads.at(i).readInfo.start == id );
+			REQUIRE( clrs.at(i) == std::string(i + 1, 'G') );
+		}
+	}
+
+	// Stopping before the end lets go of the inflating thread
+	{
+		TextInput mafInput (gzipName, 'a', 1, 2);
+		TextPart part;
+		REQUIRE( mafInput.nextPart(part) );
+	}
+
+	std::remove(mafName.c_str());
+	std::remove(clrName.c_str());
+	std::remove(gzipName.c_str());
+}
+
+TEST_CASE( "MafFile with compression threads writes the same text as BGZF, with an index of its reads", "[MafFile]" ) {
+	std::string plainName = "test_maf_file_plain.maf";
+	std::string bgzfName = "test_maf_file.maf.gz";
+	std::vector<Read_t> reads (3);
+	for (int i = 0; i < reads.size(); i++) {
+		reads.at(i).ref = std::string(40000 * (i + 1), 'A') + "C-GT";
+		reads.at(i).ulr = std::string(40000 * (i + 1), 'A') + "CCGT";
+		reads.at(i).clr = std::string(40000 * (i + 1), 'A') + "X-GT";
+		reads.at(i).readInfo.name = std::to_string(i);
+		reads.at(i).readInfo.start = "10";
+		reads.at(i).readInfo.refOrient = "+";
+		reads.at(i).readInfo.readOrient = "+";
+		reads.at(i).readInfo.srcSize = "1000000";
+		reads.at(i).alignmentSuccessful = i != 1;
+	}
+	{
+		MafFile plain (plainName);
+		MafFile bgzf (bgzfName, 2);
+		for (const Read_t &read : reads) {
+			plain.addReads(read);
+			bgzf.addReads(read);
+		}
+	}
+
+	std::ifstream plainInput (plainName);
+	std::string plainText ( (std::istreambuf_iterator<char>(plainInput)), std::istreambuf_iterator<char>() );
+	std::ifstream bgzfInput (bgzfName);
+	std::string file ( (std::istreambuf_iterator<char>(bgzfInput)), std::istreambuf_iterator<char>() );
+	REQUIRE( compressionType(file.data(), file.data() + file.length()) == Bgzf );
+	GzipInflater inflater (file.data(), file.data() + file.length());
+	std::string text;
+	while (not inflater.finished()) {
+		REQUIRE( inflater.inflatePart(text, 1 << 20) );
+	}
+	// The header names the file
+	REQUIRE( text.substr(text.find('\n')) == plainText.substr(plainText.find('\n')) );
+
+	// Only the aligned reads are indexed
+	std::ifstream index (bgzfName + ".idx");
+	std::string name;
+	int64_t virtualOffset;
+	std::vector<std::string> names;
+	while (index >> name >> virtualOffset) {
+		names.push_back(name);
+	}
+	REQUIRE( names == std::vector<std::string> ({"0", "2"}) );
+
+	std::remove(plainName.c_str());
+	std::remove(bgzfName.c_str());
+	std::remove((bgzfName + ".idx").c_str());
+}
@@ -2,6 +2,7 @@
 #include <string>
 #include "catch.hpp"
 #include "../measures.hpp"
+#include "../data.hpp"
 
 TEST_CASE( "getCorrespondingSegmentsList returns a vector of the corresponding segments of an alignment",
            "[correspondingSegments]" ) {
@@ -136,3 +137,48 @@ TEST_CASE( "get[Insertion/Deletion/Substitution]Proportion returns the correct [
 		REQUIRE( prop.uRead == trueProp.uRead );
 	}
 }
+
+TEST_CASE( "countColumn gives the same counts as the functions on alignment strings", "[countColumn]" ) {
+	std::string ref = "AAAA-AAAA-T-TTTTTTTT-GGG-GGGGG-CCCCCCCC-";
+	std::string ulr = "AA-AAAAAAX-TTTTTTTTTXGGGTGG-GGXCCACCCCCX";
+	std::string clr = "AAAATAAAAXTTTTTTTTTTXGGG-GGGGGXcCCCCgCCX";
+
+	MutationCounts counts;
+	for (int64_t index = 0; index < ref.length(); index++) {
+		countColumn(counts, ref[index], ulr[index], clr[index]);
+	}
+
+	REQUIRE( counts.cLength == gaplessLength(clr) );
+	REQUIRE( counts.uLength == gaplessLength(ulr) );
+	REQUIRE( counts.alignmentLength == boundarylessLength(clr) );
+	REQUIRE( counts.cDeletions == getDeletions(ref,clr) );
+	REQUIRE( counts.cInsertions == getInsertions(ref,clr) );
+	REQUIRE( counts.cSubstitutions == getSubstitutions(ref,clr) );
+	REQUIRE( counts.uDeletions == getDeletions(ref,ulr) );
+	REQUIRE( counts.uInsertions == getInsertions(ref,ulr) );
+	REQUIRE( counts.uSubstitutions == getSubstitutions(ref,ulr) );
+}
+
+TEST_CASE( "countAlignment counts the whole alignment and each of its corresponding segments", "[countAlignment]" ) {
+	std::string ref = "AAAAAAAA-T-TTTTTTTT-GGGGGGGG-CCCCCCCC-";
+	std::string ulr = "AAAAAAAAX-TTTTTTTTTXGGGGGGGGXCCCCCCCCX";
+	std::string clr = "AAAAAAAAXTTTTTTTTTTXGGGGGGGGXCCCCCCCCX";
+
+	ReadCounts counts = countAlignment(ref, ulr, clr);
+	std::vector<CorrespondingSegments> segmentsList = getCorrespondingSegmentsList(clr, ulr, ref);
+
+	REQUIRE( counts.read.cLength == gaplessLength(clr) );
+	REQUIRE( counts.read.uLength == gaplessLength(ulr) );
+	REQUIRE( counts.read.alignmentLength == boundarylessLength(clr) );
+	REQUIRE( counts.read.cInsertions == getInsertions(ref,clr) );
+	REQUIRE( counts.read.uDeletions == getDeletions(ref,ulr) );
+	REQUIRE( counts.segments.size() == segmentsList.size() );
+	for (int64_t index = 0; index < segmentsList.size(); index++) {
+		CorrespondingSegments segments = segmentsList.at(index);
+		MutationCounts segmentCounts = counts.segments.at(index);
+		REQUIRE( segmentCounts.cLength == gaplessLength(segments.cReadSegment) );
+		REQUIRE( segmentCounts.alignmentLength == segments.cReadSegment.length() );
+		REQUIRE( segmentCounts.cInsertions == getInsertions(segments.refSegment, segments.cReadSegment) );
+		REQUIRE( segmentCounts.uDeletions == getDeletions(segments.refSegment, segments.uReadSegment) );
+	}
+}
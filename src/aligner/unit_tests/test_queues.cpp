@@ -0,0 +1,58 @@
+#include <vector>
+#include <thread>
+#include "catch.hpp"
+#include "../queues.hpp"
+
+TEST_CASE( "BoundedQueue hands out the items in order until it is closed", "[queues]" ) {
+	BoundedQueue<int64_t> queue (2);
+	std::thread producer ([&queue]() {
+		for (int64_t item = 0; item < 100; item++) {
+			queue.push(item);
+		}
+		queue.close();
+	});
+
+	std::vector<int64_t> items;
+	int64_t item;
+	while (queue.pop(item)) {
+		items.push_back(item);
+	}
+	producer.join();
+
+	REQUIRE( items.size() == 100 );
+	for (int64_t index = 0; index < items.size(); index++) {
+		REQUIRE( items.at(index) == index );
+	}
+}
+
+TEST_CASE( "ReorderBuffer hands out the items in index order whatever order they are put in", "[queues]" ) {
+	ReorderBuffer<int64_t> buffer (4, 2);
+	// Each producer puts every other item, the odd ones running ahead of the even ones
+	std::thread even ([&buffer]() {
+		for (int64_t index = 0; index < 50; index += 2) {
+			buffer.put(index, 10*index);
+		}
+		buffer.producerDone();
+	});
+	std::thread odd ([&buffer]() {
+		for (int64_t index = 1; index < 50; index += 2) {
+			buffer.put(index, 10*index);
+		}
+		buffer.producerDone();
+	});
+
+	std::vector<int64_t> items;
+	int64_t item;
+	while (buffer.take(item)) {
+		items.push_back(item);
+	}
+	even.join();
+	odd.join();
+
+	REQUIRE( items.size() == 50 );
+	for (int64_t index = 0; index < items.size(); index++) {
+		REQUIRE( items.at(index) == 10*index );
+	}
+	REQUIRE( buffer.fits(53) );
+	REQUIRE( !buffer.fits(54) );
+}